@@ -4,6 +4,8 @@
 #include <stdbool.h>
 #include <string.h>
 #include <assert.h>
+#include "mem_stats.h"
+#include "heap_profiler.h"
 
 // ================= 配置参数 =================
 #define MEM_SIZE        (128 * 1024 * 1024) // 128 MB
@@ -14,6 +16,7 @@
 // 块状态标记
 #define BLOCK_FREE      1
 #define BLOCK_USED      0
+#define BLOCK_SAMPLED   2   // Used 块且被堆分析器采样，释放时才需要查表
 
 // ================= 数据结构 =================
 
@@ -23,9 +26,15 @@ typedef struct block_header_t {
     size_t size;                      // 当前块大小 (包含头)
     int free_flag;                    // 1 = Free, 0 = Used
 
-    // [逻辑链表管理] (只有是空闲块时才有效，Used块这里存用户数据)
-    struct block_header_t *prev_free;
-    struct block_header_t *next_free;
+    union {
+        // [逻辑链表管理] (只有是空闲块时才有效)
+        struct {
+            struct block_header_t *prev_free;
+            struct block_header_t *next_free;
+        };
+        // Used 块：调用者要的字节数 (仅用于统计)
+        size_t requested;
+    };
 } block_header_t;
 
 // TLSF 控制结构
@@ -42,6 +51,9 @@ typedef struct {
 tlsf_t *tlsf_inst = NULL;
 void *heap_start = NULL;
 
+// 占用统计：free_blocks 随空闲链表增删维护，largest_free 在 tlsf_stats() 里现找
+mem_stats_t g_stats;
+
 // ================= 辅助函数：位操作与索引计算 =================
 
 // 查找最高位是第几位 (类似 log2)
@@ -68,11 +80,10 @@ void mapping_insert(size_t size, int *fl, int *sl) {
 // 根据 FL 和 SL 查找对应的链表操作时需要的“最小尺寸” (Round Up)
 void mapping_search(size_t size, int *fl, int *sl) {
     *fl = tlsf_fls(size);
-    *sl = (size >> (*fl - SL_INDEX_SHIFT)) ^ (1 << SL_INDEX_SHIFT);
-
-    // 这里的逻辑稍微复杂一点：如果 size 比当前 split 出来的格子稍微大一点点，
-    // 我们必须去更大的格子里找，所以可能要进位。
-    // 为了简化代码，这里假设简单的向下取整查找，配合后面的 round up。
+    // 如果 size 比当前格子的下界稍微大一点点，这个格子里的块不一定装得下，
+    // 必须去更大的格子里找，所以先把 size 向上取整到下一个格子的下界再映射。
+    size += (1UL << (*fl - SL_INDEX_SHIFT)) - 1;
+    mapping_insert(size, fl, sl);
 }
 
 // ================= 核心操作：链表管理 =================
@@ -95,6 +106,7 @@ void insert_free_block(block_header_t *block) {
     // 更新位图
     tlsf_inst->fl_bitmap |= (1 << fl);
     tlsf_inst->sl_bitmap[fl] |= (1 << sl);
+    g_stats.free_blocks++;
 }
 
 void remove_free_block(block_header_t *block) {
@@ -117,6 +129,7 @@ void remove_free_block(block_header_t *block) {
             tlsf_inst->fl_bitmap &= ~(1 << fl);
         }
     }
+    g_stats.free_blocks--;
 }
 
 // ================= 核心操作：物理分割与合并 =================
@@ -209,6 +222,8 @@ void tlsf_init(void *mem, size_t size) {
     heap_start = mem;
     tlsf_inst = (tlsf_t *)malloc(sizeof(tlsf_t));
     memset(tlsf_inst, 0, sizeof(tlsf_t));
+    memset(&g_stats, 0, sizeof(g_stats));
+    g_stats.bytes_reserved = size;
 
     // 在内存起始处创建第一个大块
     block_header_t *first_block = (block_header_t *)mem;
@@ -222,11 +237,13 @@ void tlsf_init(void *mem, size_t size) {
 
 void *tlsf_malloc(size_t size) {
     // 加上头部开销并对齐
-    size_t adjust_size = size + sizeof(block_header_t);
+    // 按 8 字节对齐，保证切出来的块头都是对齐的
+    size_t adjust_size = (size + sizeof(block_header_t) + 7) & ~(size_t)7;
     if (adjust_size < 32) adjust_size = 32;
 
     int fl, sl;
-    mapping_insert(adjust_size, &fl, &sl);
+    mapping_search(adjust_size, &fl, &sl);
+    if (fl >= FL_INDEX_MAX) return NULL;
 
     // O(1) 搜索合适的块
     // 1. 在当前 SL 位图里找
@@ -251,7 +268,16 @@ void *tlsf_malloc(size_t size) {
     // 切割 (Split)
     block = block_split(block, adjust_size);
 
-    return (void *)((char *)block + sizeof(block_header_t));
+    block->requested = size;
+    g_stats.bytes_requested += size;
+    g_stats.bytes_allocated += block->size;
+
+    void *ptr = (void *)((char *)block + sizeof(block_header_t));
+    // 采样分析：没采中时只是一次减法
+    if (heapprof_should_sample(size) && heapprof_record_alloc(ptr, size)) {
+        block->free_flag = BLOCK_SAMPLED;
+    }
+    return ptr;
 }
 
 void tlsf_free(void *ptr) {
@@ -259,6 +285,10 @@ void tlsf_free(void *ptr) {
 
     block_header_t *block = (block_header_t *)((char *)ptr - sizeof(block_header_t));
 
+    g_stats.bytes_requested -= block->requested;
+    g_stats.bytes_allocated -= block->size;
+    if (block->free_flag == BLOCK_SAMPLED) heapprof_record_free(ptr);
+
     // 标记为 Free
     block->free_flag = BLOCK_FREE;
 
@@ -269,6 +299,56 @@ void tlsf_free(void *ptr) {
     insert_free_block(block);
 }
 
+// ================= 统计 =================
+
+// 最大空闲块一定在最高的非空 (fl, sl) 格子里，只需要扫这一条链表
+void tlsf_stats(mem_stats_t *st) {
+    *st = g_stats;
+    st->largest_free = 0;
+    if (!tlsf_inst->fl_bitmap) return;
+
+    int fl = tlsf_fls(tlsf_inst->fl_bitmap);
+    int sl = tlsf_fls(tlsf_inst->sl_bitmap[fl]);
+    for (block_header_t *b = tlsf_inst->blocks[fl][sl]; b; b = b->next_free) {
+        if (b->size > st->largest_free) st->largest_free = b->size;
+    }
+}
+
+// churn 适配
+static void tlsf_free_sized(void *ptr, size_t size) {
+    tlsf_free(ptr);
+}
+
+// 堆分析演示：几个不同调用点分配不同大小，其中一个"泄漏"
+// 每个 helper 都写一下 p[0]，避免编译器把分配优化成尾调用而丢掉调用点
+__attribute__((noinline)) static void *demo_alloc_texture(void) {
+    char *p = tlsf_malloc(256 * 1024);
+    p[0] = 0;
+    return p;
+}
+__attribute__((noinline)) static void *demo_alloc_command(void) {
+    char *p = tlsf_malloc(512);
+    p[0] = 0;
+    return p;
+}
+__attribute__((noinline)) static void *demo_alloc_staging(void) {
+    char *p = tlsf_malloc(64 * 1024);
+    p[0] = 0;
+    return p;
+}
+
+static int heapprof_demo(const char *path) {
+    heapprof_enable(512 * 1024); // 平均每 512KB 采一次
+
+    static void *textures[200];
+    for (int i = 0; i < 200; i++) textures[i] = demo_alloc_texture();  // 长期存活
+    for (int i = 0; i < 20000; i++) demo_alloc_command();              // 泄漏
+    for (int i = 0; i < 1000; i++) tlsf_free(demo_alloc_staging());    // 用完就释放
+    for (int i = 0; i < 100; i++) tlsf_free(textures[i]);
+
+    return heapprof_dump(path) != 0;
+}
+
 // ================= 调试工具 =================
 
 void debug_dump_ram() {
@@ -281,7 +361,7 @@ void debug_dump_ram() {
                idx++,
                curr,
                curr->size,
-               curr->free_flag ? "FREE" : "USED",
+               curr->free_flag == BLOCK_FREE ? "FREE" : "USED",
                curr->phys_prev);
 
         // 移动到下一个物理块
@@ -293,10 +373,21 @@ void debug_dump_ram() {
 
 // ================= 主函数：复现你的 2MB 场景 =================
 
-int main() {
+int main(int argc, char **argv) {
     void *memory_pool = malloc(MEM_SIZE);
     tlsf_init(memory_pool, MEM_SIZE);
 
+    // ./TLSF --csv out.csv：跑随机负载并输出占用/碎片时间序列
+    if (argc > 2 && !strcmp(argv[1], "--csv")) {
+        mem_backend_t backend = {"TLSF", tlsf_malloc, tlsf_free_sized, tlsf_stats, 16, 1024 * 1024};
+        return mem_churn_main(&backend, argv[2], 1000000, 4096);
+    }
+
+    // ./TLSF --heapprof heap.prof：采样堆分析，输出可以用 pprof --text ./TLSF heap.prof 查看
+    if (argc > 2 && !strcmp(argv[1], "--heapprof")) {
+        return heapprof_demo(argv[2]);
+    }
+
     debug_dump_ram();
 
     printf("\n=== 1. Alloc 2MB (Block A) ===\n");
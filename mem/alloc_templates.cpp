@@ -0,0 +1,555 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <new>
+#include <tuple>
+#include <utility>
+#include <initializer_list>
+
+// 把 buddy.c / TLSF.c / slub.c / linux_buddy_slub.c 里散落的 #define
+// (PAGE_SIZE, MAX_ORDER, SL_INDEX_COUNT, slab_sizes[]) 变成模板参数。
+// 所有索引计算和尺寸表都在编译期用 constexpr 生成，
+// 每种配置实例化出来的都是完全特化、几乎没有分支的热路径。
+
+// ================= 1. 编译期工具 =================
+
+constexpr bool is_pow2(size_t x) { return x && !(x & (x - 1)); }
+
+constexpr int ilog2(size_t x) {
+    int r = -1;
+    while (x) { x >>= 1; r++; }
+    return r;
+}
+
+constexpr int ceil_log2(size_t x) {
+    return x <= 1 ? 0 : ilog2(x - 1) + 1;
+}
+
+constexpr size_t round_up(size_t x, size_t align) {
+    return (x + align - 1) & ~(align - 1);
+}
+
+// 运行期版本：直接编译成 bsr / lzcnt 指令
+static inline int fls64(uint64_t x) { return 63 - __builtin_clzll(x); }
+
+// ================= 2. 尺寸分级表 (kmalloc 的 size_index[]) =================
+
+// SizeClassMap<32, 64, 128, ...> 取代 linux_buddy_slub.c 里的 slab_sizes[] 线性查找。
+// 编译期按 8 字节粒度生成 size -> class 下标的表，kmalloc 查一次表就能定位 cache。
+template <uint32_t... Sizes>
+struct SizeClassMap {
+    static constexpr int kCount = sizeof...(Sizes);
+    static constexpr std::array<uint32_t, kCount> kSizes = {Sizes...};
+    static constexpr uint32_t kMaxSize = kSizes[kCount - 1];
+    static constexpr uint32_t kGranule = 8;
+
+    static constexpr std::array<uint8_t, kMaxSize / kGranule + 1> build_index() {
+        std::array<uint8_t, kMaxSize / kGranule + 1> t{};
+        int cls = 0;
+        for (uint32_t i = 0; i < t.size(); i++) {
+            while (kSizes[cls] < i * kGranule) cls++;
+            t[i] = (uint8_t)cls;
+        }
+        return t;
+    }
+    static constexpr auto kIndex = build_index();
+
+    static_assert(kMaxSize % kGranule == 0, "class sizes must be multiples of 8");
+
+    // 调用方保证 size <= kMaxSize
+    static inline int class_of(size_t size) {
+        return kIndex[(size + kGranule - 1) / kGranule];
+    }
+};
+
+// 编译期自检：表生成结果在编译时就能验证
+using DefaultKmalloc = SizeClassMap<32, 64, 128, 256, 512, 1024, 2048>;
+static_assert(DefaultKmalloc::kIndex[0] == 0, "size 0 -> kmalloc-32");
+static_assert(DefaultKmalloc::kIndex[4] == 0, "size 32 -> kmalloc-32");
+static_assert(DefaultKmalloc::kIndex[5] == 1, "size 40 -> kmalloc-64");
+static_assert(DefaultKmalloc::kIndex[2048 / 8] == 6, "size 2048 -> kmalloc-2048");
+
+// ================= 3. Buddy<Granule, Orders> =================
+
+// Granule 对应 buddy.c 的 MIN_PAGE_SIZE，Orders 对应 MAX_ORDER + 1。
+// 空闲链表用页下标串起来 (next/prev 数组)，不再为每个空闲块 malloc 一个 FreeNode。
+template <size_t Granule, int Orders>
+class Buddy {
+    static_assert(is_pow2(Granule), "Granule must be a power of two");
+    // kOrderOf 表和 next_/prev_/order_/free_ 都按 2^(Orders-1) 页放在编译期表 / 对象里，
+    // Orders = 16 时对象约 320KB，再大就该改成运行时分配了
+    static_assert(Orders >= 1 && Orders <= 16, "per-page arrays are sized 2^(Orders-1) inside the object");
+
+public:
+    static constexpr int kMaxOrder = Orders - 1;
+    static constexpr size_t kPages = size_t(1) << kMaxOrder;
+    static constexpr size_t kHeapSize = Granule * kPages;
+    static constexpr int kGranuleShift = ilog2(Granule);
+
+    // 页数 -> order 的表，取代 get_needed_order() 里的 while 循环
+    static constexpr std::array<uint8_t, kPages + 1> build_order_table() {
+        std::array<uint8_t, kPages + 1> t{};
+        for (size_t n = 0; n <= kPages; n++) t[n] = (uint8_t)ceil_log2(n);
+        return t;
+    }
+    static constexpr auto kOrderOf = build_order_table();
+
+    static constexpr int order_for(size_t size) {
+        return kOrderOf[(size + Granule - 1) >> kGranuleShift];
+    }
+
+    Buddy() {
+        base_ = static_cast<uint8_t *>(std::aligned_alloc(Granule, kHeapSize));
+        if (!base_) throw std::bad_alloc();
+        for (int i = 0; i < Orders; i++) head_[i] = kNil;
+        for (size_t i = 0; i < kPages; i++) { order_[i] = 0; free_[i] = false; }
+        push(kMaxOrder, 0);
+    }
+    ~Buddy() { std::free(base_); }
+    Buddy(const Buddy &) = delete;
+    Buddy &operator=(const Buddy &) = delete;
+
+    void *alloc(size_t size) {
+        if (size == 0 || size > kHeapSize) return nullptr;
+        int target = order_for(size);
+
+        // 用位图一步找到 >= target 的最小非空 order
+        uint32_t avail = nonempty_ & (~0u << target);
+        if (!avail) return nullptr;
+        int order = __builtin_ctz(avail);
+
+        uint32_t idx = pop(order);
+        while (order > target) {
+            order--;
+            push(order, idx + (1u << order));
+        }
+        free_[idx] = false;
+        order_[idx] = (uint8_t)target;
+        return base_ + ((size_t)idx << kGranuleShift);
+    }
+
+    void free(void *ptr) {
+        if (!ptr) return;
+        uint32_t idx = (uint32_t)(((uint8_t *)ptr - base_) >> kGranuleShift);
+        int order = order_[idx];
+        while (order < kMaxOrder) {
+            uint32_t buddy = idx ^ (1u << order);
+            if (!free_[buddy] || order_[buddy] != order) break;
+            unlink(order, buddy);
+            idx &= buddy;
+            order++;
+        }
+        push(order, idx);
+    }
+
+    int free_blocks(int order) const {
+        int n = 0;
+        for (uint32_t i = head_[order]; i != kNil; i = next_[i]) n++;
+        return n;
+    }
+
+private:
+    static constexpr uint32_t kNil = UINT32_MAX;
+
+    void push(int order, uint32_t idx) {
+        free_[idx] = true;
+        order_[idx] = (uint8_t)order;
+        prev_[idx] = kNil;
+        next_[idx] = head_[order];
+        if (head_[order] != kNil) prev_[head_[order]] = idx;
+        head_[order] = idx;
+        nonempty_ |= 1u << order;
+    }
+
+    uint32_t pop(int order) {
+        uint32_t idx = head_[order];
+        unlink(order, idx);
+        return idx;
+    }
+
+    void unlink(int order, uint32_t idx) {
+        if (prev_[idx] != kNil) next_[prev_[idx]] = next_[idx];
+        else head_[order] = next_[idx];
+        if (next_[idx] != kNil) prev_[next_[idx]] = prev_[idx];
+        if (head_[order] == kNil) nonempty_ &= ~(1u << order);
+        free_[idx] = false;
+    }
+
+    uint8_t *base_ = nullptr;
+    uint32_t nonempty_ = 0;
+    uint32_t head_[Orders];
+    uint32_t next_[kPages];
+    uint32_t prev_[kPages];
+    uint8_t order_[kPages];
+    bool free_[kPages];
+};
+
+static_assert(Buddy<2 * 1024 * 1024, 7>::order_for(1) == 0, "1B -> order 0");
+static_assert(Buddy<2 * 1024 * 1024, 7>::order_for(5 * 1024 * 1024) == 2, "5MB -> order 2 (8MB)");
+
+// ================= 4. Tlsf<SlBits> =================
+
+// SlBits 对应 TLSF.c 的 SL_INDEX_SHIFT。
+// mapping_insert 的移位量全部是编译期常量；mapping_search 的向上取整
+// (TLSF.c 里省略掉的那一步) 也补上，保证找到的块一定够大。
+template <int SlBits, size_t MinBlock = 32>
+class Tlsf {
+    static_assert(SlBits >= 1 && SlBits <= 5, "sl_bitmap is 32 bits wide");
+    static_assert(is_pow2(MinBlock) && ilog2(MinBlock) >= SlBits, "MinBlock too small for SlBits");
+
+public:
+    static constexpr int kSlCount = 1 << SlBits;
+    static constexpr int kFlShift = ilog2(MinBlock);
+    static constexpr int kFlCount = 64 - kFlShift;
+
+    // 每个 (fl, sl) 桶的最小块尺寸，编译期生成，方便调试时打印分级情况
+    static constexpr std::array<size_t, kFlCount * kSlCount> build_class_table() {
+        std::array<size_t, kFlCount * kSlCount> t{};
+        for (int fl = 0; fl < kFlCount; fl++) {
+            for (int sl = 0; sl < kSlCount; sl++) {
+                int shift = fl + kFlShift;
+                if (shift >= 63) { t[fl * kSlCount + sl] = SIZE_MAX; continue; }
+                size_t base = size_t(1) << shift;
+                t[fl * kSlCount + sl] = base + (size_t(sl) << (shift - SlBits));
+            }
+        }
+        return t;
+    }
+    static constexpr auto kClassSize = build_class_table();
+
+    static inline void mapping_insert(size_t size, int *fl, int *sl) {
+        int f = fls64(size);
+        *sl = (int)(size >> (f - SlBits)) ^ kSlCount;
+        *fl = f - kFlShift;
+    }
+
+    static inline void mapping_search(size_t size, int *fl, int *sl) {
+        size += (size_t(1) << (fls64(size) - SlBits)) - 1;
+        mapping_insert(size, fl, sl);
+    }
+
+    Tlsf(void *mem, size_t size) : start_((uint8_t *)mem), end_((uint8_t *)mem + size) {
+        std::memset(blocks_, 0, sizeof(blocks_));
+        std::memset(sl_bitmap_, 0, sizeof(sl_bitmap_));
+        Block *first = (Block *)mem;
+        first->phys_prev = nullptr;
+        first->size = size;
+        insert(first);
+    }
+
+    void *malloc(size_t size) {
+        size_t adjust = round_up(size + sizeof(Block), alignof(std::max_align_t));
+        if (adjust < MinBlock) adjust = MinBlock;
+
+        int fl, sl;
+        mapping_search(adjust, &fl, &sl);
+        if (fl >= kFlCount) return nullptr;
+
+        uint32_t sl_map = sl_bitmap_[fl] & (~0u << sl);
+        if (!sl_map) {
+            uint64_t fl_map = fl + 1 < 64 ? fl_bitmap_ & (~0ULL << (fl + 1)) : 0;
+            if (!fl_map) return nullptr;
+            fl = __builtin_ctzll(fl_map);
+            sl_map = sl_bitmap_[fl];
+        }
+        sl = __builtin_ctz(sl_map);
+
+        Block *block = blocks_[fl][sl];
+        remove(block);
+        split(block, adjust);
+        block->free = false;
+        return (uint8_t *)block + sizeof(Block);
+    }
+
+    void free(void *ptr) {
+        if (!ptr) return;
+        Block *block = (Block *)((uint8_t *)ptr - sizeof(Block));
+
+        Block *next = phys_next(block);
+        if (next && next->free) {
+            remove(next);
+            block->size += next->size;
+            fix_next_prev(block);
+        }
+        if (block->phys_prev && block->phys_prev->free) {
+            Block *prev = block->phys_prev;
+            remove(prev);
+            prev->size += block->size;
+            fix_next_prev(prev);
+            block = prev;
+        }
+        insert(block);
+    }
+
+private:
+    struct alignas(alignof(std::max_align_t)) Block {
+        Block *phys_prev;
+        size_t size;
+        bool free;
+        Block *prev_free;
+        Block *next_free;
+    };
+
+    Block *phys_next(Block *b) const {
+        uint8_t *n = (uint8_t *)b + b->size;
+        return n < end_ ? (Block *)n : nullptr;
+    }
+
+    void fix_next_prev(Block *b) {
+        if (Block *n = phys_next(b)) n->phys_prev = b;
+    }
+
+    void insert(Block *b) {
+        int fl, sl;
+        mapping_insert(b->size, &fl, &sl);
+        b->free = true;
+        b->prev_free = nullptr;
+        b->next_free = blocks_[fl][sl];
+        if (b->next_free) b->next_free->prev_free = b;
+        blocks_[fl][sl] = b;
+        fl_bitmap_ |= 1ULL << fl;
+        sl_bitmap_[fl] |= 1u << sl;
+    }
+
+    void remove(Block *b) {
+        int fl, sl;
+        mapping_insert(b->size, &fl, &sl);
+        if (b->prev_free) b->prev_free->next_free = b->next_free;
+        else blocks_[fl][sl] = b->next_free;
+        if (b->next_free) b->next_free->prev_free = b->prev_free;
+        if (!blocks_[fl][sl]) {
+            sl_bitmap_[fl] &= ~(1u << sl);
+            if (!sl_bitmap_[fl]) fl_bitmap_ &= ~(1ULL << fl);
+        }
+        b->free = false;
+    }
+
+    // Block 按 max_align_t 对齐 (x86-64 上 48 字节)，比默认 MinBlock 大：
+    // 剩下的部分至少要放得下一个完整的头，否则 insert 写 next_free 会踩到下一块的 phys_prev
+    static constexpr size_t kMinSplit = std::max(MinBlock, sizeof(Block));
+
+    void split(Block *b, size_t size) {
+        size_t remain = b->size - size;
+        if (remain < kMinSplit) return;
+        Block *r = (Block *)((uint8_t *)b + size);
+        r->size = remain;
+        r->phys_prev = b;
+        b->size = size;
+        fix_next_prev(r);
+        insert(r);
+    }
+
+    uint8_t *start_;
+    uint8_t *end_;
+    uint64_t fl_bitmap_ = 0;
+    uint32_t sl_bitmap_[kFlCount];
+    Block *blocks_[kFlCount][kSlCount];
+};
+
+static_assert(Tlsf<2>::kClassSize[0] == 32 && Tlsf<2>::kClassSize[1] == 40, "fl 0 = [32, 40, 48, 56]");
+
+// ================= 5. SlabCache<ObjSize, Align> =================
+
+// 对象跨度、每页对象数都是编译期常量，setup_slab 里的除法变成立即数。
+// slab 页按 PageSize 对齐申请，页头 (SlabPage) 放在页首，
+// 释放时用地址掩码反查页头，相当于编译期版本的 virt_to_page。
+template <size_t ObjSize, size_t Align = alignof(void *), size_t PageSize = 4096>
+class SlabCache {
+    static_assert(is_pow2(Align), "Align must be a power of two");
+    static_assert(is_pow2(PageSize), "PageSize must be a power of two");
+
+    struct SlabPage {
+        void *freelist;
+        SlabPage *next;
+        SlabPage *prev; // 双向链表：full -> partial 时 O(1) 摘链
+        uint32_t inuse;
+    };
+
+public:
+    static constexpr size_t kStride = round_up(ObjSize < sizeof(void *) ? sizeof(void *) : ObjSize, Align);
+    static constexpr size_t kFirstObj = round_up(sizeof(SlabPage), Align);
+    static constexpr uint32_t kObjsPerSlab = (PageSize - kFirstObj) / kStride;
+    static constexpr size_t kWaste = PageSize - kFirstObj - kObjsPerSlab * kStride;
+
+    static_assert(kObjsPerSlab >= 1, "object does not fit in one slab page");
+
+    SlabCache() = default;
+    ~SlabCache() {
+        for (SlabPage *p : {partial_, full_}) {
+            while (p) { SlabPage *n = p->next; std::free(p); p = n; }
+        }
+    }
+    SlabCache(const SlabCache &) = delete;
+    SlabCache &operator=(const SlabCache &) = delete;
+
+    void *alloc() {
+        SlabPage *page = partial_;
+        if (__builtin_expect(!page, 0)) {
+            page = grow();
+            if (!page) return nullptr;
+        }
+        void *obj = page->freelist;
+        page->freelist = *(void **)obj;
+        if (++page->inuse == kObjsPerSlab) {
+            unlink(&partial_, page);
+            push(&full_, page);
+        }
+        return obj;
+    }
+
+    void free(void *obj) {
+        SlabPage *page = (SlabPage *)((uintptr_t)obj & ~(uintptr_t)(PageSize - 1));
+        *(void **)obj = page->freelist;
+        page->freelist = obj;
+        if (page->inuse-- == kObjsPerSlab) {
+            unlink(&full_, page);
+            push(&partial_, page);
+        }
+    }
+
+    int slabs() const {
+        int n = 0;
+        for (SlabPage *p : {partial_, full_})
+            for (; p; p = p->next) n++;
+        return n;
+    }
+
+private:
+    SlabPage *grow() {
+        SlabPage *page = (SlabPage *)std::aligned_alloc(PageSize, PageSize);
+        if (!page) return nullptr;
+        uint8_t *first = (uint8_t *)page + kFirstObj;
+        for (uint32_t i = 0; i < kObjsPerSlab - 1; i++)
+            *(void **)(first + i * kStride) = first + (i + 1) * kStride;
+        *(void **)(first + (kObjsPerSlab - 1) * kStride) = nullptr;
+        page->freelist = first;
+        page->inuse = 0;
+        push(&partial_, page);
+        return page;
+    }
+
+    static void push(SlabPage **head, SlabPage *page) {
+        page->prev = nullptr;
+        page->next = *head;
+        if (*head) (*head)->prev = page;
+        *head = page;
+    }
+
+    static void unlink(SlabPage **head, SlabPage *page) {
+        if (page->prev) page->prev->next = page->next;
+        else *head = page->next;
+        if (page->next) page->next->prev = page->prev;
+    }
+
+    SlabPage *partial_ = nullptr;
+    SlabPage *full_ = nullptr;
+};
+
+// ================= 6. 编译期 kmalloc 体系 =================
+
+// 每个 size class 一个独立实例化的 SlabCache，整个 kmalloc 由 SizeClassMap 驱动
+template <typename Map, typename Seq> struct KmallocImpl;
+
+template <typename Map, size_t... I>
+struct KmallocImpl<Map, std::index_sequence<I...>> {
+    std::tuple<SlabCache<Map::kSizes[I]>...> caches;
+
+    using AllocFn = void *(*)(KmallocImpl *);
+    using FreeFn = void (*)(KmallocImpl *, void *);
+    static constexpr AllocFn kAlloc[] = {[](KmallocImpl *k) { return std::get<I>(k->caches).alloc(); }...};
+    static constexpr FreeFn kFree[] = {[](KmallocImpl *k, void *p) { std::get<I>(k->caches).free(p); }...};
+
+    void *kmalloc(size_t size) {
+        if (size > Map::kMaxSize) return nullptr;
+        return kAlloc[Map::class_of(size)](this);
+    }
+    void kfree(void *p, size_t size) { kFree[Map::class_of(size)](this, p); }
+};
+
+template <typename Map>
+using Kmalloc = KmallocImpl<Map, std::make_index_sequence<Map::kCount>>;
+
+// ================= 7. 测试主程序 =================
+
+int main() {
+    printf("=== 1. SizeClassMap (linux_buddy_slub.c slab_sizes) ===\n");
+    for (size_t sz : {1, 32, 33, 100, 500, 2048}) {
+        int c = DefaultKmalloc::class_of(sz);
+        printf("  size %4zu -> class %d (kmalloc-%u)\n", sz, c, DefaultKmalloc::kSizes[c]);
+    }
+    printf("  Index table: %zu bytes, generated at compile time\n", sizeof(DefaultKmalloc::kIndex));
+
+    printf("\n=== 2. Buddy<2MB, 7> (buddy.c MAX_ORDER=6) ===\n");
+    using VramBuddy = Buddy<2 * 1024 * 1024, 7>;
+    auto *buddy = new VramBuddy();
+    printf("  Heap %zu MB, %zu pages\n", VramBuddy::kHeapSize >> 20, VramBuddy::kPages);
+    void *b1 = buddy->alloc(1 * 1024 * 1024);
+    void *b2 = buddy->alloc(3 * 1024 * 1024);
+    void *b3 = buddy->alloc(1 * 1024 * 1024);
+    printf("  b1=%p b2=%p b3=%p\n", b1, b2, b3);
+    for (int o = VramBuddy::kMaxOrder; o >= 0; o--)
+        printf("  Order %d: %d free\n", o, buddy->free_blocks(o));
+    buddy->free(b1);
+    buddy->free(b2);
+    buddy->free(b3);
+    printf("  After free: order %d has %d block (fully merged)\n",
+           VramBuddy::kMaxOrder, buddy->free_blocks(VramBuddy::kMaxOrder));
+    delete buddy;
+
+    printf("\n=== 3. Tlsf<2> (TLSF.c SL_INDEX_SHIFT=2) vs Tlsf<4> ===\n");
+    const size_t pool_size = 16 * 1024 * 1024;
+    void *pool = std::malloc(pool_size);
+    {
+        Tlsf<2> t(pool, pool_size);
+        void *a = t.malloc(2 * 1024 * 1024);
+        void *b = t.malloc(100);
+        printf("  Tlsf<2>: a=%p b=%p, classes per FL: %d\n", a, b, Tlsf<2>::kSlCount);
+        t.free(a);
+        t.free(b);
+    }
+    {
+        Tlsf<4> t(pool, pool_size);
+        int fl, sl;
+        Tlsf<4>::mapping_search(1000, &fl, &sl);
+        printf("  Tlsf<4>: 1000B rounds up to class (%d,%d) = %zu bytes\n",
+               fl, sl, Tlsf<4>::kClassSize[fl * Tlsf<4>::kSlCount + sl]);
+        void *a = t.malloc(1000);
+        t.free(a);
+    }
+    std::free(pool);
+
+    printf("\n=== 4. SlabCache<ObjSize, Align> ===\n");
+    using ConnCache = SlabCache<1536, 64>;
+    using TinyCache = SlabCache<24>;
+    printf("  SlabCache<1536,64>: stride %zu, %u objs/slab, waste %zu B\n",
+           ConnCache::kStride, ConnCache::kObjsPerSlab, ConnCache::kWaste);
+    printf("  SlabCache<24>:      stride %zu, %u objs/slab, waste %zu B\n",
+           TinyCache::kStride, TinyCache::kObjsPerSlab, TinyCache::kWaste);
+    TinyCache tiny;
+    void *objs[400];
+    for (int i = 0; i < 400; i++) objs[i] = tiny.alloc();
+    printf("  400 allocs -> %d slabs\n", tiny.slabs());
+    // 释放的对象压在它所在 slab 的 freelist 头上，那个 slab 又回到 partial 链表头，紧接着的 alloc 拿回同一个对象
+    // (只是单个 slab 内 LIFO：全部释放后再分配，拿到的是最后回到 partial 头的那个 slab 里最后释放的对象)
+    tiny.free(objs[200]);
+    void *again = tiny.alloc();
+    printf("  free(%p) then alloc -> %p: %s\n", objs[200], again,
+           again == objs[200] ? "same object (LIFO within the slab)" : "MISMATCH");
+    for (int i = 0; i < 400; i++) tiny.free(objs[i]);
+
+    printf("\n=== 5. Kmalloc<SizeClassMap> ===\n");
+    auto *km = new Kmalloc<DefaultKmalloc>();
+    void *s = km->kmalloc(10);
+    void *m = km->kmalloc(200);
+    void *l = km->kmalloc(4096);
+    printf("  kmalloc(10)=%p kmalloc(200)=%p kmalloc(4096)=%p (too large)\n", s, m, l);
+    km->kfree(s, 10);
+    km->kfree(m, 200);
+    delete km;
+
+    return 0;
+}
@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include "mem_stats.h"
 
 // =================配置区域=================
 #define MEM_SIZE        (128 * 1024 * 1024) // 128MB
@@ -16,6 +18,10 @@ static uint8_t *g_phys_base = NULL;
 // Bit 0 对应 Page 0, Bit 63 对应 Page 63
 static uint64_t g_bitmap = 0;
 
+// 占用统计：页数变化时顺手更新，bitmap_stats() 再现算空闲段
+static mem_stats_t g_stats;
+static bool g_verbose = true; // churn 负载里关掉逐次打印
+
 // =================核心逻辑=================
 
 void bitmap_init() {
@@ -28,6 +34,8 @@ void bitmap_init() {
 
     // 初始化位图，0 表示全空
     g_bitmap = 0;
+    memset(&g_stats, 0, sizeof(g_stats));
+    g_stats.bytes_reserved = MEM_SIZE;
 
     printf("[System] Init: 128MB VRAM, 2MB Page, Total 64 Pages.\n");
     printf("[System] Bitmap Manager Size: 8 Bytes (1x uint64_t)\n");
@@ -59,15 +67,17 @@ void *bitmap_alloc(int num_pages) {
             // 3. 标记为占用 (Set bits)
             // 把 mask 移回第 i 位，然后 OR 上去
             g_bitmap |= (mask << i);
+            g_stats.bytes_requested += (uint64_t)num_pages * PAGE_SIZE;
+            g_stats.bytes_allocated += (uint64_t)num_pages * PAGE_SIZE;
 
-            printf("[Alloc] Found %d pages at Index %d\n", num_pages, i);
+            if (g_verbose) printf("[Alloc] Found %d pages at Index %d\n", num_pages, i);
 
             // 4. 返回物理地址
             return (void *)(g_phys_base + (uint64_t)i * PAGE_SIZE);
         }
     }
 
-    printf("[Alloc] Failed to find %d contiguous pages.\n", num_pages);
+    if (g_verbose) printf("[Alloc] Failed to find %d contiguous pages.\n", num_pages);
     return NULL;
 }
 
@@ -99,8 +109,47 @@ void bitmap_free(void *ptr, int num_pages) {
     // ~(Mask<<i) = ...00011...
     // AND 操作后 = ...00000...
     g_bitmap &= ~(mask << index);
+    g_stats.bytes_requested -= (uint64_t)num_pages * PAGE_SIZE;
+    g_stats.bytes_allocated -= (uint64_t)num_pages * PAGE_SIZE;
+
+    if (g_verbose) printf("[Free] Freed %d pages at Index %d. Bitmap: 0x%016lx\n", num_pages, index, g_bitmap);
+}
+
+/**
+ * 按字节分配：上层只知道 buffer 大小时用这个，统计里能区分“要了多少”和“占了几页”
+ */
+void *bitmap_alloc_bytes(size_t bytes) {
+    int num_pages = (int)((bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+    void *ptr = bitmap_alloc(num_pages);
+    if (ptr) g_stats.bytes_requested -= (uint64_t)num_pages * PAGE_SIZE - bytes;
+    return ptr;
+}
 
-    printf("[Free] Freed %d pages at Index %d. Bitmap: 0x%016lx\n", num_pages, index, g_bitmap);
+void bitmap_free_bytes(void *ptr, size_t bytes) {
+    if (!ptr) return;
+    int num_pages = (int)((bytes + PAGE_SIZE - 1) / PAGE_SIZE);
+    g_stats.bytes_requested += (uint64_t)num_pages * PAGE_SIZE - bytes;
+    bitmap_free(ptr, num_pages);
+}
+
+// 统计快照：空闲段个数和最长空闲段只有 64 位，现算即可
+void bitmap_stats(mem_stats_t *st) {
+    *st = g_stats;
+    st->free_blocks = 0;
+    st->largest_free = 0;
+
+    int run = 0;
+    for (int i = 0; i <= PAGE_COUNT; i++) {
+        if (i < PAGE_COUNT && !((g_bitmap >> i) & 1)) {
+            run++;
+            continue;
+        }
+        if (run) {
+            st->free_blocks++;
+            if ((uint64_t)run * PAGE_SIZE > st->largest_free) st->largest_free = (uint64_t)run * PAGE_SIZE;
+        }
+        run = 0;
+    }
 }
 
 // 调试工具：打印位图状态
@@ -114,9 +163,17 @@ void bitmap_dump() {
 
 // =================测试主函数=================
 
-int main() {
+int main(int argc, char **argv) {
     bitmap_init();
 
+    // ./bitmap --csv out.csv：跑随机负载并输出占用/碎片时间序列
+    if (argc > 2 && !strcmp(argv[1], "--csv")) {
+        g_verbose = false;
+        mem_backend_t backend = {"bitmap", bitmap_alloc_bytes, bitmap_free_bytes, bitmap_stats,
+                                 256 * 1024, 16 * 1024 * 1024};
+        return mem_churn_main(&backend, argv[2], 100000, 24);
+    }
+
     // 1. 分配单个页 (最常见场景)
     void *p1 = bitmap_alloc(1); // Index 0
     void *p2 = bitmap_alloc(2); // Index 1, 2 (需要连续)
@@ -3,6 +3,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <math.h>
+#include <string.h>
+#include "mem_stats.h"
 
 // =================配置参数=================
 #define HEAP_SIZE (128 * 1024 * 1024) // 总堆大小 128MB
@@ -23,6 +25,7 @@ typedef struct FreeNode {
 typedef struct {
     bool is_free;
     int order; // 如果被分配或作为空闲块头，记录当前块的阶数
+    size_t requested; // 分配时调用者要的字节数 (仅用于统计)
 } PageDescriptor;
 
 // 全局状态
@@ -31,9 +34,16 @@ PageDescriptor *g_page_desc = NULL;   // 页描述符数组
 FreeNode *g_free_area[MAX_ORDER + 1]; // 空闲链表数组 (Order 0 ~ 6)
 int g_total_pages = 0;
 
+// 占用统计：free_blocks 随链表增删维护，largest_free 取最高的非空 order
+mem_stats_t g_stats;
+bool g_verbose = true; // churn 负载里关掉逐次打印
+
+#define LOG(...) do { if (g_verbose) printf(__VA_ARGS__); } while (0)
+
 // ================= 辅助打印函数 =================
 // 打印当前堆的空闲链表状态
 void debug_print_heap_status() {
+    if (!g_verbose) return;
     printf("\n[DEBUG] === Current Heap Status ===\n");
     for (int i = MAX_ORDER; i >= 0; i--) {
         printf("  Order %d (%3dMB): ", i, (1 << i) * 2);
@@ -68,6 +78,9 @@ void buddy_init() {
     for (int i = 0; i <= MAX_ORDER; i++) {
         g_free_area[i] = NULL;
     }
+    memset(&g_stats, 0, sizeof(g_stats));
+    g_stats.bytes_reserved = HEAP_SIZE;
+    g_stats.free_blocks = 1;
 
     // 初始状态：整个堆挂入 Max Order
     FreeNode *root = (FreeNode *)malloc(sizeof(FreeNode));
@@ -89,6 +102,7 @@ void list_add(int order, FreeNode *node) {
         g_free_area[order]->prev = node;
     }
     g_free_area[order] = node;
+    g_stats.free_blocks++;
 }
 
 void list_remove(int order, FreeNode *node) {
@@ -100,6 +114,7 @@ void list_remove(int order, FreeNode *node) {
     if (node->next) {
         node->next->prev = node->prev;
     }
+    g_stats.free_blocks--;
 }
 
 int get_needed_order(size_t size) {
@@ -118,11 +133,11 @@ void *buddy_alloc(size_t size) {
     // 在这里获取想要order的大小
     int target_order = get_needed_order(size);
     if (target_order > MAX_ORDER) {
-        printf("[Alloc] Failed: Size %zu too large (>%dMB)\n", size, (1<<MAX_ORDER)*2);
+        LOG("[Alloc] Failed: Size %zu too large (>%dMB)\n", size, (1<<MAX_ORDER)*2);
         return NULL;
     }
 
-    printf("[Alloc] Request: %zu bytes (Need Order %d, %dMB)\n", size, target_order, (1<<target_order)*2);
+    LOG("[Alloc] Request: %zu bytes (Need Order %d, %dMB)\n", size, target_order, (1<<target_order)*2);
 
     // 1. 向上查找可用的空闲块
     int current_order = target_order;
@@ -132,11 +147,11 @@ void *buddy_alloc(size_t size) {
     }
 
     if (current_order > MAX_ORDER) {
-        printf("[Alloc] Failed: OOM (Out Of Memory)\n");
+        LOG("[Alloc] Failed: OOM (Out Of Memory)\n");
         return NULL;
     }
 
-    printf("  >> Found free block at Order %d\n", current_order);
+    LOG("  >> Found free block at Order %d\n", current_order);
 
     // 2. 摘下一个块
     FreeNode *block = g_free_area[current_order];
@@ -148,10 +163,10 @@ void *buddy_alloc(size_t size) {
 
         int buddy_idx = block->page_idx + (1 << current_order);
 
-        printf("  >> Splitting Order %d [Idx %d] into Order %d:\n",
+        LOG("  >> Splitting Order %d [Idx %d] into Order %d:\n",
                current_order + 1, block->page_idx, current_order);
-        printf("     |-- Left  (Idx %d): Keep for alloc\n", block->page_idx);
-        printf("     |-- Right (Idx %d): Buddy, return to free list\n", buddy_idx);
+        LOG("     |-- Left  (Idx %d): Keep for alloc\n", block->page_idx);
+        LOG("     |-- Right (Idx %d): Buddy, return to free list\n", buddy_idx);
 
         FreeNode *buddy = (FreeNode *)malloc(sizeof(FreeNode));
         buddy->page_idx = buddy_idx;
@@ -165,9 +180,12 @@ void *buddy_alloc(size_t size) {
     // 4. 分配完成
     g_page_desc[block->page_idx].is_free = false;
     g_page_desc[block->page_idx].order = target_order;
+    g_page_desc[block->page_idx].requested = size;
+    g_stats.bytes_requested += size;
+    g_stats.bytes_allocated += (uint64_t)MIN_PAGE_SIZE << target_order;
 
     void *addr = g_heap_base + (block->page_idx * MIN_PAGE_SIZE);
-    printf("[Alloc] Success! Addr: %p (Idx %d)\n", addr, block->page_idx);
+    LOG("[Alloc] Success! Addr: %p (Idx %d)\n", addr, block->page_idx);
 
     free(block);
     debug_print_heap_status(); // 分配完打印状态
@@ -181,8 +199,10 @@ void buddy_free(void *ptr) {
 
     int page_idx = ((uint8_t *)ptr - g_heap_base) / MIN_PAGE_SIZE;
     int order = g_page_desc[page_idx].order;
+    g_stats.bytes_requested -= g_page_desc[page_idx].requested;
+    g_stats.bytes_allocated -= (uint64_t)MIN_PAGE_SIZE << order;
 
-    printf("[Free] Ptr %p (Idx %d), Order %d (%dMB)\n", ptr, page_idx, order, (1<<order)*2);
+    LOG("[Free] Ptr %p (Idx %d), Order %d (%dMB)\n", ptr, page_idx, order, (1<<order)*2);
 
     // 循环尝试合并
     while (order < MAX_ORDER) {
@@ -190,7 +210,7 @@ void buddy_free(void *ptr) {
 
         // 越界检查
         if (buddy_idx >= g_total_pages) {
-            printf("  >> Stop: Buddy idx %d out of range\n", buddy_idx);
+            LOG("  >> Stop: Buddy idx %d out of range\n", buddy_idx);
             break;
         }
 
@@ -198,16 +218,16 @@ void buddy_free(void *ptr) {
         bool buddy_free = g_page_desc[buddy_idx].is_free;
         int buddy_order = g_page_desc[buddy_idx].order;
 
-        printf("  >> Checking buddy Idx %d (Order %d): ", buddy_idx, order);
+        LOG("  >> Checking buddy Idx %d (Order %d): ", buddy_idx, order);
 
         // 合并条件检查
         if (!buddy_free || buddy_order != order) {
-            if (!buddy_free) printf("Busy (Cannot merge)\n");
-            else printf("Free but Order mismatch (Is %d, Need %d)\n", buddy_order, order);
+            if (!buddy_free) LOG("Busy (Cannot merge)\n");
+            else LOG("Free but Order mismatch (Is %d, Need %d)\n", buddy_order, order);
             break;
         }
 
-        printf("Match! Merging...\n");
+        LOG("Match! Merging...\n");
 
         // 从链表中移除 Buddy
         FreeNode *curr = g_free_area[order];
@@ -221,6 +241,7 @@ void buddy_free(void *ptr) {
                 else g_free_area[order] = curr->next;
                 if (curr->next) curr->next->prev = prev;
                 free(curr);
+                g_stats.free_blocks--;
                 found = true;
                 break;
             }
@@ -239,7 +260,7 @@ void buddy_free(void *ptr) {
             page_idx = buddy_idx;
         }
 
-        printf("     Merged Idx %d + Idx %d -> New Block Idx %d (Order %d)\n",
+        LOG("     Merged Idx %d + Idx %d -> New Block Idx %d (Order %d)\n",
                old_idx, buddy_idx, page_idx, order + 1);
 
         order++;
@@ -253,13 +274,39 @@ void buddy_free(void *ptr) {
     g_page_desc[page_idx].order = order;
 
     list_add(order, node);
-    printf("  >> Block Idx %d placed in Order %d list\n", page_idx, order);
+    LOG("  >> Block Idx %d placed in Order %d list\n", page_idx, order);
     debug_print_heap_status(); // 释放完打印状态
 }
 
+// 统计快照
+void buddy_stats(mem_stats_t *st) {
+    *st = g_stats;
+    st->largest_free = 0;
+    for (int i = MAX_ORDER; i >= 0; i--) {
+        if (g_free_area[i]) {
+            st->largest_free = (uint64_t)MIN_PAGE_SIZE << i;
+            break;
+        }
+    }
+}
+
+// churn 适配：buddy_free 不需要 size
+static void buddy_free_sized(void *ptr, size_t size) {
+    buddy_free(ptr);
+}
+
 // =================测试主程序=================
 
-int main() {
+int main(int argc, char **argv) {
+    // ./buddy --csv out.csv：跑随机负载并输出占用/碎片时间序列
+    if (argc > 2 && !strcmp(argv[1], "--csv")) {
+        g_verbose = false;
+        buddy_init();
+        mem_backend_t backend = {"buddy", buddy_alloc, buddy_free_sized, buddy_stats,
+                                 256 * 1024, 16 * 1024 * 1024};
+        return mem_churn_main(&backend, argv[2], 100000, 24);
+    }
+
     buddy_init();
 
     void *p1 = buddy_alloc(1 * 1024 * 1024);
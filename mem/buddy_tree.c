@@ -0,0 +1,361 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+// 线段树 (longest free run) 版的 buddy 分配器
+// buddy.c 用每个 order 一条 malloc 出来的 FreeNode 双向链表管理空闲块，
+// 合并时还要线性遍历链表找 buddy，链表越长越慢，节点散落在堆上对 cache 也不友好。
+// 这里换成一棵完全二叉树，按数组存 (1-based，节点 i 的孩子是 2i / 2i+1)：
+//   longest[i] = 子树里最大空闲块的 order + 1，0 表示子树里没有空闲
+// 分配从根往下走，每层看左孩子够不够，不够就走右边；释放从叶子往上找到被分配的那个节点，
+// 再一路往上重新算 longest。两者都是 O(log n)，没有任何指针，整棵树 2n 字节。
+
+// =================配置参数 (同 buddy.c)=================
+#define HEAP_SIZE (128 * 1024 * 1024) // 总堆大小 128MB
+#define MIN_PAGE_SIZE (2 * 1024 * 1024) // 最小粒度 2MB (Order 0)
+#define MAX_ORDER 6                   // 64 个页 = 2^6
+
+// benchmark 用更大的树，链表版和树版都跑在同样的 2^16 个页上
+#define BENCH_ORDER 16
+#define BENCH_PAGE_SIZE 4096
+
+// =================数据结构=================
+
+typedef struct {
+    int max_order;
+    size_t page_size;
+    uint8_t *base;
+    uint8_t *longest; // 2^(max_order+1) 个节点，下标 0 不用
+} buddy_tree_t;
+
+// 节点 i 所在的 order：根是 max_order，每往下一层减 1
+static inline int node_order(const buddy_tree_t *t, uint32_t i) {
+    return t->max_order - (31 - __builtin_clz(i));
+}
+
+void buddy_tree_init(buddy_tree_t *t, uint8_t *base, size_t page_size, int max_order) {
+    t->max_order = max_order;
+    t->page_size = page_size;
+    t->base = base;
+    t->longest = malloc((size_t)2 << max_order);
+    // 初始整棵树全空闲：每个节点的值就是自己的 order + 1
+    for (uint32_t i = 1; i < (2u << max_order); i++) {
+        t->longest[i] = node_order(t, i) + 1;
+    }
+}
+
+void buddy_tree_destroy(buddy_tree_t *t) {
+    free(t->longest);
+    t->longest = NULL;
+}
+
+static int get_needed_order(size_t size, size_t page_size) {
+    size_t num_pages = (size + page_size - 1) / page_size;
+    int order = 0;
+    while (((size_t)1 << order) < num_pages) order++;
+    return order;
+}
+
+// 子节点变化后重算父节点：两个孩子都整块空闲就合并成父节点整块，否则取较大的
+// 某一层的值没变，再往上也不会变，提前结束
+static inline void update_up(buddy_tree_t *t, uint32_t i, int order) {
+    uint8_t *lg = t->longest;
+    while (i > 1) {
+        i >>= 1;
+        order++;
+        uint8_t l = lg[2 * i], r = lg[2 * i + 1];
+        uint8_t v = (l == order && r == order) ? order + 1 : (l > r ? l : r);
+        if (lg[i] == v) break;
+        lg[i] = v;
+    }
+}
+
+/**
+ * 分配
+ * 从根往下，左孩子能放下就走左边 (优先低地址)，到目标 order 那层停下
+ */
+void *buddy_tree_alloc(buddy_tree_t *t, size_t size) {
+    int order = get_needed_order(size, t->page_size);
+    if (order > t->max_order || t->longest[1] < order + 1) return NULL;
+
+    uint32_t i = 1;
+    for (int o = t->max_order; o > order; o--) {
+        // 写成加法而不是分支：左右是随机的，分支预测基本猜不中
+        i = 2 * i + (t->longest[2 * i] < order + 1);
+    }
+    t->longest[i] = 0;
+    update_up(t, i, order);
+
+    // 节点 i 在它那一层是第 (i - 2^depth) 个，乘上块大小就是页号
+    uint32_t page_idx = (i - (1u << (t->max_order - order))) << order;
+    return t->base + (size_t)page_idx * t->page_size;
+}
+
+/**
+ * 释放：不需要 size
+ * 从叶子往上找第一个 longest == 0 的节点，它就是当初分配出去的块
+ * (分配时只把那个节点清 0，它下面的子孙还保持整块空闲的值)
+ */
+void buddy_tree_free(buddy_tree_t *t, void *ptr) {
+    if (!ptr) return;
+    uint32_t page_idx = ((uint8_t *)ptr - t->base) / t->page_size;
+    uint32_t i = page_idx + (1u << t->max_order);
+
+    while (i && t->longest[i] != 0) i >>= 1;
+    if (!i) {
+        printf("[Free] Error: %p (Idx %u) is not allocated\n", ptr, page_idx);
+        return;
+    }
+    int order = node_order(t, i);
+    t->longest[i] = order + 1;
+    update_up(t, i, order);
+}
+
+// 最大空闲块字节数，直接看根
+size_t buddy_tree_largest_free(const buddy_tree_t *t) {
+    return t->longest[1] ? t->page_size << (t->longest[1] - 1) : 0;
+}
+
+// 调试：逐层打印 longest (只适合小树)
+void buddy_tree_dump(const buddy_tree_t *t) {
+    printf("[DEBUG] longest[] (order+1, 0 = full), largest free %zuMB\n",
+           buddy_tree_largest_free(t) >> 20);
+    for (int d = 0; d <= t->max_order; d++) {
+        printf("  Order %d: ", t->max_order - d);
+        for (uint32_t i = 1u << d; i < (2u << d); i++) printf("%d", t->longest[i]);
+        printf("\n");
+    }
+}
+
+// =================对照组：buddy.c 的链表版 (去掉打印，order 可配)=================
+
+typedef struct FreeNode {
+    int page_idx;
+    struct FreeNode *prev;
+    struct FreeNode *next;
+} FreeNode;
+
+typedef struct {
+    bool is_free;
+    int order;
+} PageDescriptor;
+
+static uint8_t *g_list_base;
+static size_t g_list_page_size;
+static int g_list_max_order;
+static PageDescriptor *g_page_desc;
+static FreeNode *g_free_area[BENCH_ORDER + 1];
+
+void list_buddy_init(uint8_t *base, size_t page_size, int max_order) {
+    g_list_base = base;
+    g_list_page_size = page_size;
+    g_list_max_order = max_order;
+    g_page_desc = calloc((size_t)1 << max_order, sizeof(PageDescriptor));
+    memset(g_free_area, 0, sizeof(g_free_area));
+
+    FreeNode *root = malloc(sizeof(FreeNode));
+    root->page_idx = 0;
+    root->prev = root->next = NULL;
+    g_free_area[max_order] = root;
+    g_page_desc[0].is_free = true;
+    g_page_desc[0].order = max_order;
+}
+
+static void list_add(int order, FreeNode *node) {
+    node->next = g_free_area[order];
+    node->prev = NULL;
+    if (g_free_area[order]) g_free_area[order]->prev = node;
+    g_free_area[order] = node;
+}
+
+static void list_remove(int order, FreeNode *node) {
+    if (node->prev) node->prev->next = node->next;
+    else g_free_area[order] = node->next;
+    if (node->next) node->next->prev = node->prev;
+}
+
+void *list_buddy_alloc(size_t size) {
+    int target_order = get_needed_order(size, g_list_page_size);
+    if (target_order > g_list_max_order) return NULL;
+
+    int current_order = target_order;
+    while (current_order <= g_list_max_order && g_free_area[current_order] == NULL) current_order++;
+    if (current_order > g_list_max_order) return NULL;
+
+    FreeNode *block = g_free_area[current_order];
+    list_remove(current_order, block);
+
+    while (current_order > target_order) {
+        current_order--;
+        int buddy_idx = block->page_idx + (1 << current_order);
+        FreeNode *buddy = malloc(sizeof(FreeNode));
+        buddy->page_idx = buddy_idx;
+        g_page_desc[buddy_idx].is_free = true;
+        g_page_desc[buddy_idx].order = current_order;
+        list_add(current_order, buddy);
+    }
+
+    g_page_desc[block->page_idx].is_free = false;
+    g_page_desc[block->page_idx].order = target_order;
+    void *addr = g_list_base + (size_t)block->page_idx * g_list_page_size;
+    free(block);
+    return addr;
+}
+
+void list_buddy_free(void *ptr) {
+    if (!ptr) return;
+    int page_idx = ((uint8_t *)ptr - g_list_base) / g_list_page_size;
+    int order = g_page_desc[page_idx].order;
+
+    while (order < g_list_max_order) {
+        int buddy_idx = page_idx ^ (1 << order);
+        if (!g_page_desc[buddy_idx].is_free || g_page_desc[buddy_idx].order != order) break;
+
+        // 同 buddy.c：线性遍历链表找 buddy
+        FreeNode *curr = g_free_area[order];
+        while (curr && curr->page_idx != buddy_idx) curr = curr->next;
+        if (!curr) break;
+        list_remove(order, curr);
+        free(curr);
+        g_page_desc[buddy_idx].is_free = false;
+
+        if (buddy_idx < page_idx) page_idx = buddy_idx;
+        order++;
+    }
+
+    FreeNode *node = malloc(sizeof(FreeNode));
+    node->page_idx = page_idx;
+    g_page_desc[page_idx].is_free = true;
+    g_page_desc[page_idx].order = order;
+    list_add(order, node);
+}
+
+// =================benchmark=================
+
+#define BENCH_OPS   2000000
+
+static double now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static uint64_t xorshift(uint64_t *s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+typedef struct {
+    const char *name;
+    void *(*alloc)(size_t);
+    void (*free)(void *);
+} bench_backend_t;
+
+static buddy_tree_t g_bench_tree;
+static void *bench_tree_alloc(size_t size) { return buddy_tree_alloc(&g_bench_tree, size); }
+static void bench_tree_free(void *ptr) { buddy_tree_free(&g_bench_tree, ptr); }
+
+// 随机选一个槽：空的就分配 (order 0..5，小块居多)，有的就释放
+// 槽数决定稳态占用：live 个槽大约一半有对象，平均每个 2 页
+static void bench_run(const bench_backend_t *b, int live) {
+    void **slots = calloc(live, sizeof(void *));
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    uint64_t fails = 0;
+
+    double t0 = now_ns();
+    for (int op = 0; op < BENCH_OPS; op++) {
+        uint64_t r = xorshift(&seed);
+        int k = r % live;
+        if (slots[k]) {
+            b->free(slots[k]);
+            slots[k] = NULL;
+        } else {
+            int order = __builtin_ctzll((r >> 20) | (1ULL << 5)); // P(order = k) ~ 1/2^(k+1)
+            slots[k] = b->alloc((size_t)BENCH_PAGE_SIZE << order);
+            if (!slots[k]) fails++;
+        }
+    }
+    double dt = now_ns() - t0;
+    for (int k = 0; k < live; k++) b->free(slots[k]);
+    free(slots);
+
+    printf("  %-12s %7.1f ns/op, %llu failed allocs\n", b->name, dt / BENCH_OPS,
+           (unsigned long long)fails);
+}
+
+// 棋盘格：全部按单页分配，先放掉偶数页，再放掉奇数页
+// 放奇数页时 buddy 都在 order 0 链表里，而且越早放的越靠链表尾，链表版每次都要扫很长一段
+static void bench_checkerboard(const bench_backend_t *b, int pages) {
+    void **p = malloc(pages * sizeof(void *));
+    for (int i = 0; i < pages; i++) p[i] = b->alloc(BENCH_PAGE_SIZE);
+    for (int i = 0; i < pages; i += 2) b->free(p[i]);
+
+    double t0 = now_ns();
+    for (int i = 1; i < pages; i += 2) b->free(p[i]);
+    double dt = now_ns() - t0;
+
+    printf("  %-12s %9.1f ns per merging free\n", b->name, dt / (pages / 2));
+    free(p);
+}
+
+// =================测试主程序=================
+
+int main() {
+    // 1. 和 buddy.c 同样的 128MB / 2MB 配置，看树怎么变化
+    uint8_t *heap = malloc(HEAP_SIZE);
+    buddy_tree_t t;
+    buddy_tree_init(&t, heap, MIN_PAGE_SIZE, MAX_ORDER);
+    printf("[Init] Tree buddy: Base %p, %d pages, tree %d bytes\n", heap, 1 << MAX_ORDER, 2 << MAX_ORDER);
+
+    void *p1 = buddy_tree_alloc(&t, 1 * 1024 * 1024);
+    void *p2 = buddy_tree_alloc(&t, 6 * 1024 * 1024);
+    void *p3 = buddy_tree_alloc(&t, 2 * 1024 * 1024);
+    printf("[Alloc] p1=Idx %ld, p2=Idx %ld (8MB), p3=Idx %ld\n",
+           ((uint8_t *)p1 - heap) / MIN_PAGE_SIZE, ((uint8_t *)p2 - heap) / MIN_PAGE_SIZE,
+           ((uint8_t *)p3 - heap) / MIN_PAGE_SIZE);
+    buddy_tree_dump(&t);
+
+    buddy_tree_free(&t, p1);
+    buddy_tree_free(&t, p3);
+    buddy_tree_free(&t, p2);
+    buddy_tree_free(&t, p2); // double free 能被发现
+    printf("[Free] All freed\n");
+    buddy_tree_dump(&t);
+    buddy_tree_destroy(&t);
+    free(heap);
+
+    // 2. benchmark：2^16 个 4KB 页 (256MB)，只用地址不碰内存
+    size_t bench_heap = (size_t)BENCH_PAGE_SIZE << BENCH_ORDER;
+    uint8_t *base = malloc(bench_heap);
+    list_buddy_init(base, BENCH_PAGE_SIZE, BENCH_ORDER);
+    buddy_tree_init(&g_bench_tree, base, BENCH_PAGE_SIZE, BENCH_ORDER);
+    bench_backend_t list = {"list buddy", list_buddy_alloc, list_buddy_free};
+    bench_backend_t tree = {"tree buddy", bench_tree_alloc, bench_tree_free};
+
+    // 低占用时链表很短，高占用时空闲链表变长，链表版合并要线性找 buddy
+    int lives[] = {8192, 32768, 60000};
+    for (int i = 0; i < 3; i++) {
+        printf("\n--- Benchmark: %d pages, %d slots (~%d%% occupied), %d random alloc/free ---\n",
+               1 << BENCH_ORDER, lives[i], lives[i] * 100 / (1 << BENCH_ORDER), BENCH_OPS);
+        bench_run(&list, lives[i]);
+        bench_run(&tree, lives[i]);
+    }
+
+    printf("\n--- Checkerboard: %d single pages, free evens then odds ---\n", 1 << BENCH_ORDER);
+    bench_checkerboard(&list, 1 << BENCH_ORDER);
+    bench_checkerboard(&tree, 1 << BENCH_ORDER);
+
+    printf("\n  tree metadata: %d bytes, list metadata: %zu bytes of page descriptors + a malloc per free block\n",
+           2 << BENCH_ORDER, sizeof(PageDescriptor) << BENCH_ORDER);
+    printf("  tree after all frees: largest free %zuMB (%s)\n", buddy_tree_largest_free(&g_bench_tree) >> 20,
+           buddy_tree_largest_free(&g_bench_tree) == bench_heap ? "fully merged" : "NOT merged");
+
+    buddy_tree_destroy(&g_bench_tree);
+    free(base);
+    return 0;
+}
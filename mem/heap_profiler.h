@@ -0,0 +1,244 @@
+#ifndef HEAP_PROFILER_H
+#define HEAP_PROFILER_H
+
+// 采样堆分析器 (tcmalloc / gperftools 的思路)
+// 平均每分配 sample_period 字节采一个样，采样间隔服从指数分布 (Poisson 过程)，
+// 大对象被采中的概率高，小对象低，pprof 读取时再按 1 - exp(-size/period) 反推真实数量。
+// 被采中的分配记录调用栈，dump 成 pprof 能直接读的 legacy heap profile 文本格式：
+//     pprof --text ./slub heap.prof
+//
+// 没被采中的分配只多一次减法和一个几乎不跳转的分支 (heapprof_should_sample)，
+// 释放时由分配器自己的标记 (slab 页上的 sampled 计数 / TLSF 块头的标志位) 决定要不要查表。
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <execinfo.h>
+
+// ================= 配置区域 =================
+#define HP_MAX_DEPTH    32
+#define HP_MAX_STACKS   4096    // 不同调用栈个数上限 (开放寻址)
+#define HP_MAX_LIVE     65536   // 同时存活的采样对象上限 (开放寻址)
+#define HP_SKIP_FRAMES  1       // 跳过 heapprof_record_alloc 自己，保留分配器那一帧
+
+// ================= 数据结构 =================
+
+typedef struct {
+    int depth;                  // 0 = 空槽
+    void *pcs[HP_MAX_DEPTH];
+    uint64_t alloc_objs;        // 累计采到的次数
+    uint64_t alloc_bytes;
+    uint64_t inuse_objs;        // 仍然存活的
+    uint64_t inuse_bytes;
+} hp_stack_t;
+
+typedef struct {
+    void *ptr;                  // NULL = 空槽, HP_TOMBSTONE = 已删除
+    size_t size;
+    int stack;
+} hp_live_t;
+
+#define HP_TOMBSTONE ((void *)1)
+
+// 距离下一次采样还剩多少字节；未启用时是一个永远减不完的大数
+static int64_t g_hp_bytes_left = INT64_MAX;
+static uint64_t g_hp_period = 0;
+static uint64_t g_hp_rng = 0x2545F4914F6CDD1DULL;
+static hp_stack_t *g_hp_stacks = NULL;
+static hp_live_t *g_hp_live = NULL;
+static uint64_t g_hp_dropped = 0; // 表满了丢掉的样本
+
+// ================= 采样间隔 =================
+
+static inline double hp_uniform(void) {
+    // xorshift64，取高 53 位生成 (0, 1] 之间的均匀分布
+    g_hp_rng ^= g_hp_rng << 13;
+    g_hp_rng ^= g_hp_rng >> 7;
+    g_hp_rng ^= g_hp_rng << 17;
+    return ((g_hp_rng >> 11) + 1) * (1.0 / 9007199254740992.0);
+}
+
+// 指数分布：-ln(U) * period，Poisson 过程相邻两次事件的间隔
+static inline int64_t hp_next_interval(void) {
+    double v = -log(hp_uniform()) * (double)g_hp_period;
+    return v < 1.0 ? 1 : (int64_t)v;
+}
+
+/**
+ * 开启/关闭采样
+ * @param sample_period 平均采样间隔 (字节)，0 表示关闭
+ */
+static void heapprof_enable(uint64_t sample_period) {
+    g_hp_period = sample_period;
+    if (!sample_period) {
+        g_hp_bytes_left = INT64_MAX;
+        return;
+    }
+    if (!g_hp_stacks) {
+        g_hp_stacks = calloc(HP_MAX_STACKS, sizeof(hp_stack_t));
+        g_hp_live = calloc(HP_MAX_LIVE, sizeof(hp_live_t));
+        if (!g_hp_stacks || !g_hp_live) {
+            fprintf(stderr, "Error: heap profiler tables OOM, sampling disabled.\n");
+            g_hp_period = 0;
+            g_hp_bytes_left = INT64_MAX;
+            return;
+        }
+    }
+    g_hp_bytes_left = hp_next_interval();
+}
+
+// 快速路径：每次分配都调用，绝大多数情况只是一次减法
+static inline bool heapprof_should_sample(size_t size) {
+    g_hp_bytes_left -= (int64_t)size;
+    return __builtin_expect(g_hp_bytes_left < 0, 0);
+}
+
+// ================= 慢速路径：记录样本 =================
+
+static inline uint64_t hp_hash(const void *data, size_t len) {
+    // FNV-1a
+    const uint8_t *p = data;
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < len; i++) {
+        h ^= p[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static int hp_find_stack(void **pcs, int depth) {
+    uint64_t h = hp_hash(pcs, depth * sizeof(void *));
+    for (int probe = 0; probe < HP_MAX_STACKS; probe++) {
+        hp_stack_t *st = &g_hp_stacks[(h + probe) % HP_MAX_STACKS];
+        if (st->depth == 0) {
+            st->depth = depth;
+            memcpy(st->pcs, pcs, depth * sizeof(void *));
+            return (int)(st - g_hp_stacks);
+        }
+        if (st->depth == depth && !memcmp(st->pcs, pcs, depth * sizeof(void *))) {
+            return (int)(st - g_hp_stacks);
+        }
+    }
+    return -1;
+}
+
+/**
+ * heapprof_should_sample 返回 true 之后调用：抓调用栈、登记存活样本、重置下一次间隔
+ * @return 是否真的记录了 (表满时返回 false，分配器不要给对象打标记)
+ */
+__attribute__((noinline)) static bool heapprof_record_alloc(void *ptr, size_t size) {
+    g_hp_bytes_left = hp_next_interval();
+    if (!ptr || !g_hp_period) return false;
+
+    void *frames[HP_MAX_DEPTH + HP_SKIP_FRAMES];
+    int n = backtrace(frames, HP_MAX_DEPTH + HP_SKIP_FRAMES);
+    int skip = n > HP_SKIP_FRAMES ? HP_SKIP_FRAMES : 0;
+
+    int si = hp_find_stack(frames + skip, n - skip);
+    if (si < 0) {
+        g_hp_dropped++;
+        return false;
+    }
+
+    uint64_t h = hp_hash(&ptr, sizeof(ptr));
+    for (int probe = 0; probe < HP_MAX_LIVE; probe++) {
+        hp_live_t *e = &g_hp_live[(h + probe) % HP_MAX_LIVE];
+        if (e->ptr == NULL || e->ptr == HP_TOMBSTONE) {
+            e->ptr = ptr;
+            e->size = size;
+            e->stack = si;
+            hp_stack_t *st = &g_hp_stacks[si];
+            st->alloc_objs++;
+            st->alloc_bytes += size;
+            st->inuse_objs++;
+            st->inuse_bytes += size;
+            return true;
+        }
+    }
+    g_hp_dropped++;
+    return false;
+}
+
+/**
+ * 释放一个被采样过的对象 (分配器根据自己的标记判断要不要调)
+ * @return 是否在表里找到
+ */
+static bool heapprof_record_free(void *ptr) {
+    if (!g_hp_live) return false;
+    uint64_t h = hp_hash(&ptr, sizeof(ptr));
+    for (int probe = 0; probe < HP_MAX_LIVE; probe++) {
+        hp_live_t *e = &g_hp_live[(h + probe) % HP_MAX_LIVE];
+        if (e->ptr == NULL) return false;
+        if (e->ptr == ptr) {
+            hp_stack_t *st = &g_hp_stacks[e->stack];
+            st->inuse_objs--;
+            st->inuse_bytes -= e->size;
+            e->ptr = HP_TOMBSTONE;
+            return true;
+        }
+    }
+    return false;
+}
+
+// ================= 输出 =================
+
+/**
+ * 写 gperftools legacy heap profile：
+ *   heap profile: <inuse_objs>: <inuse_bytes> [<alloc_objs>: <alloc_bytes>] @ heap_v2/<period>
+ *   <inuse_objs>: <inuse_bytes> [<alloc_objs>: <alloc_bytes>] @ <pc> <pc> ...
+ *   MAPPED_LIBRARIES:
+ *   <内容同 /proc/self/maps>
+ * 数值是原始采样值，pprof 看到 heap_v2 会自己做反采样
+ */
+static int heapprof_dump(const char *path) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+
+    uint64_t tot[4] = {0, 0, 0, 0};
+    for (int i = 0; g_hp_stacks && i < HP_MAX_STACKS; i++) {
+        hp_stack_t *st = &g_hp_stacks[i];
+        if (!st->depth) continue;
+        tot[0] += st->inuse_objs;
+        tot[1] += st->inuse_bytes;
+        tot[2] += st->alloc_objs;
+        tot[3] += st->alloc_bytes;
+    }
+    fprintf(fp, "heap profile: %llu: %llu [%llu: %llu] @ heap_v2/%llu\n",
+            (unsigned long long)tot[0], (unsigned long long)tot[1],
+            (unsigned long long)tot[2], (unsigned long long)tot[3],
+            (unsigned long long)g_hp_period);
+
+    for (int i = 0; g_hp_stacks && i < HP_MAX_STACKS; i++) {
+        hp_stack_t *st = &g_hp_stacks[i];
+        if (!st->depth) continue;
+        fprintf(fp, "%llu: %llu [%llu: %llu] @",
+                (unsigned long long)st->inuse_objs, (unsigned long long)st->inuse_bytes,
+                (unsigned long long)st->alloc_objs, (unsigned long long)st->alloc_bytes);
+        for (int d = 0; d < st->depth; d++) fprintf(fp, " %p", st->pcs[d]);
+        fprintf(fp, "\n");
+    }
+
+    // pprof 需要映射表把地址换算回二进制里的偏移
+    fprintf(fp, "\nMAPPED_LIBRARIES:\n");
+    FILE *maps = fopen("/proc/self/maps", "r");
+    if (maps) {
+        char buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), maps)) > 0) fwrite(buf, 1, n, fp);
+        fclose(maps);
+    }
+    fclose(fp);
+
+    printf("[HeapProf] %llu live samples (%llu bytes), %llu total, %llu dropped -> %s\n",
+           (unsigned long long)tot[0], (unsigned long long)tot[1],
+           (unsigned long long)tot[2], (unsigned long long)g_hp_dropped, path);
+    return 0;
+}
+
+#endif // HEAP_PROFILER_H
@@ -1,17 +1,47 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "mem_stats.h"
 
 // ================= 1. 基础配置 =================
-#define MEM_SIZE     (128 * 1024 * 1024)
+#define MEM_SIZE     (128 * 1024 * 1024) // 开机时在线的内存
 #define PAGE_SHIFT   12
 #define PAGE_SIZE    (1UL << PAGE_SHIFT)
 #define MAX_ORDER    16
 
-// 模拟物理内存基地址
+// 内存热插拔：物理地址空间预留到 MAX_PHYS_SIZE，按 section (32MB) 加入 / 上线 / 下线
+#define SECTION_SIZE_BITS 25
+#define PAGES_PER_SECTION (1UL << (SECTION_SIZE_BITS - PAGE_SHIFT))
+#define MAX_PHYS_SIZE     (4UL * MEM_SIZE)
+#define NR_MEM_SECTIONS   (MAX_PHYS_SIZE >> SECTION_SIZE_BITS)
+
+// 模拟物理内存基地址：物理内存是一个 memfd，PHYS_MEM_START 是它的线性映射 (相当于内核的 direct map)，
+// vmalloc 再把其中零散的页按任意顺序映射到别的虚拟地址上
+int g_memfd = -1;
 void *PHYS_MEM_START = NULL;
+
+// 主机上用什么页来撑这块"物理内存"：模拟的 2MB 页如果背后是 512 个 4KB 主机页，TLB 表现和真机完全不同。
+//   PHYS_MEMFD：默认，memfd + MADV_HUGEPAGE (要主机 shmem_enabled=advise/always 才真给大页)，vmalloc 可用
+//   PHYS_ANON_THP：匿名内存 + MADV_HUGEPAGE，大多数主机默认就给 THP；没有 memfd，vmalloc 不可用
+//   PHYS_HUGETLB：MAP_HUGETLB，要预留 hugetlbfs 页 (vm.nr_hugepages)；拿不到就退回 PHYS_ANON_THP
+// hugetlb memfd 只能按 2MB 映射，vmalloc 要按 4KB 拼，所以默认的 memfd 不用 MFD_HUGETLB
+enum {
+    PHYS_MEMFD,
+    PHYS_ANON_THP,
+    PHYS_HUGETLB
+};
+static const char *phys_backing_names[] = {"memfd+MADV_HUGEPAGE", "anon+MADV_HUGEPAGE", "MAP_HUGETLB"};
+int phys_backing = PHYS_MEMFD;
 struct page *MEM_MAP = NULL;
 
 // ================= 2. 核心数据结构 (修正版) =================
@@ -19,8 +49,13 @@ struct page *MEM_MAP = NULL;
 #define PG_free      0x01
 #define PG_buddy     0x02
 #define PG_slab      0x04
+#define PG_cma       0x08 // 被 cma_alloc 占着
+#define PG_offline   0x10 // 所在 section 不在线，不归 buddy 管
 
 struct kmem_cache;
+struct mem_cgroup;
+struct movable_operations;
+struct pcpu_chunk;
 
 // [FIX] 修正后的 struct page
 // 我们将 next 指针移出 union，或者精心安排布局。
@@ -31,11 +66,17 @@ struct page {
     // 用于链表管理的通用指针 (Buddy用它连空闲页，Slab用连Partial页)
     // 把它移出 Union，避免覆盖关键数据
     struct page *next;
+    struct page *prev; // 只有 buddy 空闲链表用，O(1) 摘链
 
     union {
         // ---用于 Buddy 系统---
         struct {
             int order;
+            int migratetype;  // 空闲时挂在哪种迁移类型的链表上
+            size_t requested; // kmalloc 走 buddy 时调用者要的字节数 (仅用于统计)
+            struct mem_cgroup *memcg; // kmalloc 走 buddy 时记在谁账上
+            const struct movable_operations *mops; // 非 NULL 表示主人能配合迁移 (CMA 要用)
+            struct pcpu_chunk *pcpu_chunk; // percpu chunk 的每一页都记着自己属于哪个 chunk
         };
 
         // ---用于 Slab 系统---
@@ -43,6 +84,7 @@ struct page {
             struct kmem_cache *slab_cache;
             void *freelist;
             int active_objects;
+            struct mem_cgroup **obj_cgroups; // 每个对象记在谁账上，第一次有对象记账时才分配
         };
     };
 };
@@ -50,19 +92,152 @@ struct page {
 typedef struct kmem_cache {
     uint32_t obj_size;
     struct page *partial;
+    int nr_empty;              // partial 里完全空闲的页数，最多留 SLAB_MIN_PARTIAL 个，多的还给 buddy
+    pthread_mutex_t list_lock; // kswapd 会来 shrink，partial 链表要加锁
 } kmem_cache_t;
 
-struct page *buddy_free_area[MAX_ORDER];
+#define SLAB_MIN_PARTIAL 5
+
+// 迁移类型：slab / 内核结构体是 UNMOVABLE，页缓存 / 用户页是 MOVABLE (能迁移)，
+// dentry / inode 这类可以被 shrinker 回收的是 RECLAIMABLE。
+// 混在一起放，一个 slab 页就能把整个 2MB 区域钉死，回收了再多页缓存也拼不出大块。
+// CMA：预留给大块连续 DMA 缓冲区的区域，平时借给 MOVABLE 分配，cma_alloc 时再把借出去的页迁走；
+// ISOLATE：cma_alloc 正在清空的 pageblock，释放回来的页挂在这里，谁也分不走
+enum migratetype {
+    MIGRATE_UNMOVABLE,
+    MIGRATE_MOVABLE,
+    MIGRATE_RECLAIMABLE,
+    MIGRATE_PCPTYPES,
+    MIGRATE_CMA = MIGRATE_PCPTYPES,
+    MIGRATE_ISOLATE,
+    MIGRATE_TYPES
+};
+
+#define GFP_KERNEL           0x0
+#define __GFP_MOVABLE        0x1
+#define __GFP_RECLAIMABLE    0x2
+#define GFP_HIGHUSER_MOVABLE __GFP_MOVABLE
+
+// 按 pageblock (2^9 页 = 2MB) 给迁移类型，同类分配尽量挤在同一批 pageblock 里
+#define PAGEBLOCK_ORDER    9
+#define PAGEBLOCK_NR_PAGES (1UL << PAGEBLOCK_ORDER)
+#define NR_PAGEBLOCKS      (MAX_PHYS_SIZE / PAGE_SIZE / PAGEBLOCK_NR_PAGES)
+
+struct page *buddy_free_area[MAX_ORDER][MIGRATE_TYPES];
+uint8_t pageblock_flags[NR_PAGEBLOCKS];
+
+// ABSENT：还没加进来，没有 struct page；OFFLINE：有 struct page，页是 PG_offline，主机内存已还回去
+enum { SECTION_ABSENT, SECTION_OFFLINE, SECTION_ONLINE };
+uint8_t mem_section_state[NR_MEM_SECTIONS];
+unsigned long max_pfn; // 已加入的 section 都在它下面 (只往后加)，buddy 合并不能越过它
+
+// 和内核同名：置 1 后所有分配都当 UNMOVABLE，等于没有分组
+int page_group_by_mobility_disabled = 0;
+
+// 统计：走 fallback 的次数、整块 pageblock 被改了类型的次数
+unsigned long g_nr_fallback, g_nr_pageblock_steal;
+
+// 水位线：空闲页跌破 low 叫醒 kswapd 在后台回收到 high；
+// 跌破 min 前台分配只能自己同步回收 (direct reclaim)，这就是延迟毛刺的来源
+enum zone_watermarks {
+    WMARK_MIN,
+    WMARK_LOW,
+    WMARK_HIGH,
+    NR_WMARK
+};
+
+#define SWAP_CLUSTER_MAX     32 // 一轮回收的页数
+#define MAX_RECLAIM_RETRIES  16
+
+struct zone {
+    unsigned long nr_free;             // 空闲页数 (不含 ISOLATE)；只在 lock 里改，水位检查不加锁读 (和内核一样允许读到旧值)
+    unsigned long nr_free_cma;         // 其中 CMA 的部分，非 MOVABLE 分配用不了，水位检查要扣掉
+    unsigned long managed_pages;       // 在线的页数，热插拔时变，水位跟着重算
+    unsigned long watermark[NR_WMARK];
+    pthread_mutex_t lock;              // 保护 buddy_free_area / pageblock_flags / nr_free
+
+    pthread_t kswapd;
+    int kswapd_running, kswapd_stop;
+    atomic_int kswapd_woken;           // 在 kswapd_lock 里改；wakeup_kswapd 不加锁先看一眼
+    pthread_mutex_t kswapd_lock;
+    pthread_cond_t kswapd_wait;
+
+    unsigned long allocstall;          // 前台进直接回收的次数
+    unsigned long kswapd_wakeups;
+    unsigned long pgsteal_kswapd, pgsteal_direct;
+};
+
+struct zone g_zone = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .kswapd_lock = PTHREAD_MUTEX_INITIALIZER,
+    .kswapd_wait = PTHREAD_COND_INITIALIZER,
+};
+
+// 和内核同名：low/high 比 min 高出 managed_pages * factor / 10000
+int watermark_scale_factor = 10;
+
+// 2MB (order-9) 是最热的大尺寸：THP、kmalloc(2MB) 的 DMA 缓冲区。
+// 走 buddy 每次都要从高阶拆 6 层、释放再合 6 层，还要拿 zone lock；
+// 每个 CPU (这里是线程) 留一小串 order-9 页，分配 / 释放大多在本地链表上完成 (内核 5.13 起 pcp 也缓存 THP 阶)
+#define HPAGE_PMD_ORDER PAGEBLOCK_ORDER
+#define HPAGE_SIZE      (PAGE_SIZE << HPAGE_PMD_ORDER)
+#define NR_CPUS         4
+#define PCP_THP_BATCH   2
+
+struct per_cpu_pages {
+    pthread_mutex_t lock;               // 本 CPU 基本不争；drain_all_pages 从别的线程来时才会争
+    int count;
+    struct page *lists[MIGRATE_TYPES];  // 只放 order-9
+};
+
+struct per_cpu_pages g_pcp[NR_CPUS];
+
+// 每个 CPU 最多缓存几个 2MB 页，0 表示不缓存 (所有 order-9 直接走 buddy)
+int pcp_thp_high = 8;
+
+// 线程就是模拟的 CPU：第一次用到时按先来后到领一个编号 (超过 NR_CPUS 就轮回去共用)，
+// 主线程、kswapd、demo 里的线程各是各的；想钉在某个 CPU 上就在线程开头直接给 g_cpu 赋值
+static __thread int g_cpu = -1;
+static atomic_int g_next_cpu;
 
-#define SLAB_INDEX_COUNT 7
-uint32_t slab_sizes[] = {32, 64, 128, 256, 512, 1024, 2048};
-kmem_cache_t slab_caches[SLAB_INDEX_COUNT];
+static inline int smp_processor_id() {
+    if (__builtin_expect(g_cpu < 0, 0)) g_cpu = atomic_fetch_add(&g_next_cpu, 1) % NR_CPUS;
+    return g_cpu;
+}
+
+struct cma {
+    unsigned long base_pfn, count;
+    uint8_t *allocated;      // 每页一个字节：是否被 cma_alloc 占着
+    pthread_mutex_t lock;    // cma_alloc / cma_release 串行
+    unsigned long nr_migrated, nr_busy_ranges; // 统计：迁走的页、因为有钉住的页而放弃的区间
+};
+
+struct cma g_cma = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+// 相当于启动参数 cma=：在 kmalloc_init 之前设置，放在内存末尾，按 pageblock 取整；0 表示不要 CMA
+unsigned long cma_reserve_pages = 0;
+
+// 默认 7 个 class，可以在 kmalloc_init 之前用 slab_sizes_load() 换成 size_class_opt 生成的表
+#define SLAB_INDEX_MAX 32
+int slab_index_count = 7;
+uint32_t slab_sizes[SLAB_INDEX_MAX] = {32, 64, 128, 256, 512, 1024, 2048};
+kmem_cache_t slab_caches[SLAB_INDEX_MAX];
+
+// 占用统计
+// bytes_reserved 是整个物理池，free_blocks / largest_free 看的是 buddy 空闲块；
+// slab 对象没有头部，用一张影子表 (每 8 字节一项) 记下 kmalloc 的请求大小，只用于统计
+#define SHADOW_SHIFT 3
+mem_stats_t g_stats;
+// 分配路径、kswapd、热插拔都会改 g_stats：free_blocks 只在 zone lock 里改，其余字段一律原子加减
+#define stat_add(field, v) __atomic_fetch_add(&g_stats.field, (v), __ATOMIC_RELAXED)
+#define stat_sub(field, v) __atomic_fetch_sub(&g_stats.field, (v), __ATOMIC_RELAXED)
+uint16_t *g_req_shadow = NULL;
 
 // ================= 3. 地址转换 =================
 
 struct page *virt_to_page(void *addr) {
     // [Safety] 检查指针范围
-    if (addr < PHYS_MEM_START || (uint8_t*)addr >= (uint8_t*)PHYS_MEM_START + MEM_SIZE)
+    if (addr < PHYS_MEM_START || (uint8_t*)addr >= (uint8_t*)PHYS_MEM_START + (max_pfn << PAGE_SHIFT))
         return NULL;
 
     unsigned long offset = (unsigned long)((uint8_t *)addr - (uint8_t *)PHYS_MEM_START);
@@ -77,67 +252,273 @@ void *page_address(struct page *page) {
 
 // ================= 4. Buddy System =================
 
-void buddy_init() {
-    for (int i = 0; i < MAX_ORDER; i++) buddy_free_area[i] = NULL;
+static inline int gfp_migratetype(int gfp) {
+    if (page_group_by_mobility_disabled) return MIGRATE_UNMOVABLE;
+    if (gfp & __GFP_MOVABLE) return MIGRATE_MOVABLE;
+    if (gfp & __GFP_RECLAIMABLE) return MIGRATE_RECLAIMABLE;
+    return MIGRATE_UNMOVABLE;
+}
 
-    unsigned long total_pages = MEM_SIZE / PAGE_SIZE;
+static inline int get_pageblock_migratetype(unsigned long pfn) {
+    return pageblock_flags[pfn >> PAGEBLOCK_ORDER];
+}
+
+static inline void set_pageblock_migratetype(unsigned long pfn, int mt) {
+    if (pageblock_flags[pfn >> PAGEBLOCK_ORDER] != mt) g_nr_pageblock_steal++;
+    pageblock_flags[pfn >> PAGEBLOCK_ORDER] = mt;
+}
+
+static void add_to_free_list(struct page *page, int order, int mt) {
+    page->flags = PG_free;
+    page->order = order;
+    page->migratetype = mt;
+    page->prev = NULL;
+    page->next = buddy_free_area[order][mt];
+    if (page->next) page->next->prev = page;
+    buddy_free_area[order][mt] = page;
+    if (mt != MIGRATE_ISOLATE) g_zone.nr_free += 1UL << order;
+    if (mt == MIGRATE_CMA) g_zone.nr_free_cma += 1UL << order;
+    g_stats.free_blocks++;
+}
+
+// 摘下来的页清掉 PG_free：PG_free 只代表"现在挂在空闲链表上的块首"
+static void del_page_from_free_list(struct page *page) {
+    if (page->prev) page->prev->next = page->next;
+    else buddy_free_area[page->order][page->migratetype] = page->next;
+    if (page->next) page->next->prev = page->prev;
+    page->next = page->prev = NULL;
+    page->flags = 0;
+    if (page->migratetype != MIGRATE_ISOLATE) g_zone.nr_free -= 1UL << page->order;
+    if (page->migratetype == MIGRATE_CMA) g_zone.nr_free_cma -= 1UL << page->order;
+    g_stats.free_blocks--;
+}
 
-    struct page *base_page = &MEM_MAP[0];
-    base_page->flags = PG_free;
-    base_page->order = MAX_ORDER - 1;
-    base_page->next = NULL;
+// min 按内核 min_free_kbytes = sqrt(lowmem_kbytes * 16) 算 (128MB -> 约 1.4MB)
+void setup_per_zone_wmarks() {
+    unsigned long managed = g_zone.managed_pages;
+    unsigned long min_free_kbytes = (unsigned long)sqrt((double)(managed * (PAGE_SIZE / 1024)) * 16);
+    unsigned long min = min_free_kbytes / (PAGE_SIZE / 1024);
+    unsigned long gap = managed * watermark_scale_factor / 10000;
+    if (gap < min / 4) gap = min / 4;
+
+    g_zone.watermark[WMARK_MIN] = min;
+    g_zone.watermark[WMARK_LOW] = min + gap;
+    g_zone.watermark[WMARK_HIGH] = min + gap * 2;
+}
+
+static void __free_one_page(struct page *page, int order);
 
-    buddy_free_area[MAX_ORDER - 1] = base_page;
+void buddy_init() {
+    memset(buddy_free_area, 0, sizeof(buddy_free_area));
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+        pthread_mutex_init(&g_pcp[cpu].lock, NULL);
+        g_pcp[cpu].count = 0;
+        memset(g_pcp[cpu].lists, 0, sizeof(g_pcp[cpu].lists));
+    }
+    g_stats.free_blocks = 0;
+    g_nr_fallback = g_nr_pageblock_steal = 0;
+    g_zone.nr_free = g_zone.nr_free_cma = 0;
+    g_zone.allocstall = g_zone.kswapd_wakeups = 0;
+    g_zone.pgsteal_kswapd = g_zone.pgsteal_direct = 0;
 
-    printf("[System] Buddy Init: Managed %lu pages (%d MB)\n", total_pages, MEM_SIZE/1024/1024);
+    unsigned long total_pages = MEM_SIZE / PAGE_SIZE;
+    g_zone.managed_pages = max_pfn = total_pages;
+    memset(mem_section_state, SECTION_ABSENT, sizeof(mem_section_state));
+    memset(mem_section_state, SECTION_ONLINE, total_pages / PAGES_PER_SECTION);
+    setup_per_zone_wmarks();
+
+    // 和内核一样，开机时所有 pageblock 都是 MOVABLE；CMA 区在末尾
+    memset(pageblock_flags, MIGRATE_MOVABLE, sizeof(pageblock_flags));
+    free(g_cma.allocated);
+    g_cma.count = (cma_reserve_pages + PAGEBLOCK_NR_PAGES - 1) & ~(PAGEBLOCK_NR_PAGES - 1);
+    g_cma.base_pfn = total_pages - g_cma.count;
+    g_cma.allocated = calloc(g_cma.count + 1, 1);
+    g_cma.nr_migrated = g_cma.nr_busy_ranges = 0;
+    for (unsigned long pfn = g_cma.base_pfn; pfn < total_pages; pfn += PAGEBLOCK_NR_PAGES)
+        pageblock_flags[pfn >> PAGEBLOCK_ORDER] = MIGRATE_CMA;
+
+    // 按 pageblock 逐块放进 buddy，自己合并上去 (CMA 和普通区不会合到一起)
+    for (unsigned long pfn = 0; pfn < total_pages; pfn += PAGEBLOCK_NR_PAGES)
+        __free_one_page(&MEM_MAP[pfn], PAGEBLOCK_ORDER);
+
+    printf("[System] Buddy Init: Managed %lu pages (%d MB), %lu pageblocks%s, watermarks %lu/%lu/%lu",
+           total_pages, MEM_SIZE/1024/1024, total_pages / PAGEBLOCK_NR_PAGES,
+           page_group_by_mobility_disabled ? " (mobility grouping disabled)" : "",
+           g_zone.watermark[WMARK_MIN], g_zone.watermark[WMARK_LOW], g_zone.watermark[WMARK_HIGH]);
+    if (g_cma.count) printf(", CMA %lu MB at PFN %lu", (g_cma.count * PAGE_SIZE) >> 20, g_cma.base_pfn);
+    printf("\n");
 }
 
-struct page *alloc_pages(int order) {
-    int cur_order = order;
+// 把 [low, high) 阶拆出来的另一半依次挂回 mt 链表
+static void expand(struct page *page, int low, int high, int mt) {
+    unsigned long pfn = page - MEM_MAP;
+    while (high > low) {
+        high--;
+        add_to_free_list(&MEM_MAP[pfn + (1UL << high)], high, mt);
+    }
+}
+
+static struct page *__rmqueue_smallest(int order, int mt) {
+    for (int cur_order = order; cur_order < MAX_ORDER; cur_order++) {
+        struct page *page = buddy_free_area[cur_order][mt];
+        if (!page) continue;
+        del_page_from_free_list(page);
+        expand(page, order, cur_order, mt);
+        return page;
+    }
+    return NULL;
+}
 
-    while (cur_order < MAX_ORDER) {
-        if (buddy_free_area[cur_order]) {
-            struct page *page = buddy_free_area[cur_order];
-            buddy_free_area[cur_order] = page->next;
+// 自己类型没有空闲块时，按这个顺序去别的类型借 (CMA / ISOLATE 永远不会被偷)
+static const int fallbacks[MIGRATE_PCPTYPES][2] = {
+    [MIGRATE_UNMOVABLE]   = {MIGRATE_RECLAIMABLE, MIGRATE_MOVABLE},
+    [MIGRATE_MOVABLE]     = {MIGRATE_RECLAIMABLE, MIGRATE_UNMOVABLE},
+    [MIGRATE_RECLAIMABLE] = {MIGRATE_UNMOVABLE,   MIGRATE_MOVABLE},
+};
 
-            while (cur_order > order) {
-                cur_order--;
-                unsigned long pfn = page - MEM_MAP;
-                unsigned long buddy_pfn = pfn + (1UL << cur_order);
-                struct page *buddy = &MEM_MAP[buddy_pfn];
+// 不可移动的分配一旦落进别人的 pageblock 就赖着不走，干脆把整块抢过来，后续同类分配都挤进去；
+// MOVABLE 借小块无所谓 (以后能迁走)，只有借的块够大时才抢
+static int can_steal_fallback(int order, int start_mt) {
+    return order >= PAGEBLOCK_ORDER / 2 || start_mt != MIGRATE_MOVABLE || page_group_by_mobility_disabled;
+}
 
-                buddy->flags = PG_free;
-                buddy->order = cur_order;
+// 把 pfn 所在 pageblock 里的空闲块全挪到 mt 链表，返回挪了多少页
+static unsigned long move_freepages_block(unsigned long pfn, int mt) {
+    unsigned long start = pfn & ~(PAGEBLOCK_NR_PAGES - 1);
+    unsigned long moved = 0;
+    for (unsigned long p = start; p < start + PAGEBLOCK_NR_PAGES;) {
+        struct page *page = &MEM_MAP[p];
+        if (!(page->flags & PG_free)) {
+            p++;
+            continue;
+        }
+        int order = page->order;
+        del_page_from_free_list(page);
+        add_to_free_list(page, order, mt);
+        moved += 1UL << order;
+        p += 1UL << order;
+    }
+    return moved;
+}
 
-                buddy->next = buddy_free_area[cur_order];
-                buddy_free_area[cur_order] = buddy;
+/**
+ * 从别的迁移类型借页
+ * 先从最大阶往下找能抢的：一次抢一大块，免得以后反复来借、把别人的 pageblock 一点点打散。
+ * 抢的块跨整个 pageblock 就直接改类型；不到一个 pageblock 时把里面的空闲页都挪过来，
+ * 空闲页过半才改 pageblock 的类型 (内核还会把同类的已分配页算进来，这里只数空闲页)。
+ * 都抢不了 (小阶 MOVABLE) 就找最小的块借用，不改归属。
+ */
+static struct page *__rmqueue_fallback(int order, int start_mt) {
+    for (int cur_order = MAX_ORDER - 1; cur_order >= order; cur_order--) {
+        if (!can_steal_fallback(cur_order, start_mt)) break;
+        for (int i = 0; i < 2; i++) {
+            struct page *page = buddy_free_area[cur_order][fallbacks[start_mt][i]];
+            if (!page) continue;
+
+            unsigned long pfn = page - MEM_MAP;
+            if (cur_order >= PAGEBLOCK_ORDER) {
+                for (unsigned long p = pfn; p < pfn + (1UL << cur_order); p += PAGEBLOCK_NR_PAGES)
+                    set_pageblock_migratetype(p, start_mt);
+            } else if (move_freepages_block(pfn, start_mt) >= PAGEBLOCK_NR_PAGES / 2) {
+                set_pageblock_migratetype(pfn, start_mt);
             }
+            g_nr_fallback++;
+            del_page_from_free_list(page);
+            expand(page, order, cur_order, start_mt);
+            return page;
+        }
+    }
 
-            page->flags = PG_buddy;
-            page->order = order;
-            page->next = NULL; // 清空链表指针防止野指针
+    for (int cur_order = order; cur_order < MAX_ORDER; cur_order++) {
+        for (int i = 0; i < 2; i++) {
+            int mt = fallbacks[start_mt][i];
+            struct page *page = buddy_free_area[cur_order][mt];
+            if (!page) continue;
+            g_nr_fallback++;
+            del_page_from_free_list(page);
+            expand(page, order, cur_order, mt);
             return page;
         }
-        cur_order++;
     }
     return NULL;
 }
 
-void __free_pages(struct page *page, int order) {
+// MOVABLE 可以借 CMA 的页。CMA 空闲超过总空闲一半时优先用 CMA，
+// 免得普通区先被 MOVABLE 吃光，UNMOVABLE 明明还有 CMA 空页却分配失败
+static struct page *__rmqueue(int order, int mt) {
+    struct page *page;
+    if (mt == MIGRATE_MOVABLE && g_zone.nr_free_cma > g_zone.nr_free / 2) {
+        page = __rmqueue_smallest(order, MIGRATE_CMA);
+        if (page) return page;
+    }
+    page = __rmqueue_smallest(order, mt);
+    if (!page && mt == MIGRATE_MOVABLE) page = __rmqueue_smallest(order, MIGRATE_CMA);
+    if (!page) page = __rmqueue_fallback(order, mt);
+    return page;
+}
+
+static struct page *rmqueue(int order, int mt) {
+    pthread_mutex_lock(&g_zone.lock);
+    struct page *page = __rmqueue(order, mt);
+    pthread_mutex_unlock(&g_zone.lock);
+    return page;
+}
+
+// 内核还会检查 >= order 的空闲块够不够，这里只看总数；非 MOVABLE 分配不算 CMA 的空闲页
+static inline int zone_watermark_ok(int order, int mark, int mt) {
+    unsigned long free = g_zone.nr_free - (mt == MIGRATE_MOVABLE ? 0 : g_zone.nr_free_cma);
+    return free >= g_zone.watermark[mark] + (1UL << order);
+}
+
+void wakeup_kswapd();
+unsigned long try_to_free_pages(unsigned long nr_to_reclaim);
+
+/**
+ * 慢路径：叫醒 kswapd，允许用到 min；到了 min 还不够就自己回收 (allocstall) 再试
+ * 自己什么都回收不出来时，kswapd 或别的线程可能刚好放了页，最后再看一次水位才放弃 (这里没有 OOM killer)
+ */
+static struct page *__alloc_pages_slowpath(int order, int mt) {
+    wakeup_kswapd();
+    for (int retries = 0; retries < MAX_RECLAIM_RETRIES; retries++) {
+        if (zone_watermark_ok(order, WMARK_MIN, mt)) {
+            struct page *page = rmqueue(order, mt);
+            if (page) return page;
+        }
+        g_zone.allocstall++;
+        unsigned long reclaimed = try_to_free_pages(SWAP_CLUSTER_MAX << order);
+        g_zone.pgsteal_direct += reclaimed;
+        if (!reclaimed) {
+            if (zone_watermark_ok(order, WMARK_MIN, mt)) return rmqueue(order, mt);
+            break;
+        }
+    }
+    return NULL;
+}
+
+static inline int migratetype_is_mergeable(int mt) {
+    return mt < MIGRATE_PCPTYPES;
+}
+
+// 合并一般不看迁移类型，合并完的块挂到它所在 pageblock 的类型上；
+// 但跨 pageblock 合并时 CMA / ISOLATE 不能和别的类型合到一块，否则 CMA 的页会混进普通链表。调用方持有 zone lock
+static void __free_one_page(struct page *page, int order) {
     unsigned long pfn = page - MEM_MAP;
+    page->flags = 0; // 合并后它可能成了尾页，不能留着 PG_buddy 让按 pfn 扫描的人 (CMA) 误认
 
     while (order < MAX_ORDER - 1) {
         unsigned long buddy_pfn = pfn ^ (1UL << order);
+        if (buddy_pfn >= max_pfn) break; // 后面的 section 还没加进来，连 struct page 都没有
         struct page *buddy = &MEM_MAP[buddy_pfn];
 
         if (!(buddy->flags & PG_free) || buddy->order != order) {
             break;
         }
+        if (order >= PAGEBLOCK_ORDER) {
+            int mt = get_pageblock_migratetype(pfn), buddy_mt = get_pageblock_migratetype(buddy_pfn);
+            if (mt != buddy_mt && (!migratetype_is_mergeable(mt) || !migratetype_is_mergeable(buddy_mt))) break;
+        }
 
-        // 从链表移除 buddy
-        struct page **prev = &buddy_free_area[order];
-        while (*prev && *prev != buddy) prev = &(*prev)->next;
-        if (*prev) *prev = buddy->next;
+        del_page_from_free_list(buddy);
 
         // 合并
         unsigned long combined_pfn = pfn & buddy_pfn;
@@ -146,30 +527,166 @@ void __free_pages(struct page *page, int order) {
         order++;
     }
 
-    page->flags = PG_free;
+    add_to_free_list(page, order, get_pageblock_migratetype(pfn));
+}
+
+// 本地链表空了一次从 buddy 搬 PCP_THP_BATCH 个，一次 zone lock 摊给几次分配
+static struct page *rmqueue_pcplist(int mt) {
+    struct per_cpu_pages *pcp = &g_pcp[smp_processor_id()];
+    pthread_mutex_lock(&pcp->lock);
+    if (!pcp->lists[mt]) {
+        pthread_mutex_lock(&g_zone.lock);
+        for (int i = 0; i < PCP_THP_BATCH && zone_watermark_ok(HPAGE_PMD_ORDER, WMARK_LOW, mt); i++) {
+            struct page *page = __rmqueue(HPAGE_PMD_ORDER, mt);
+            if (!page) break;
+            page->next = pcp->lists[mt];
+            pcp->lists[mt] = page;
+            pcp->count++;
+        }
+        pthread_mutex_unlock(&g_zone.lock);
+    }
+    struct page *page = pcp->lists[mt];
+    if (page) {
+        pcp->lists[mt] = page->next;
+        pcp->count--;
+    }
+    pthread_mutex_unlock(&pcp->lock);
+    return page;
+}
+
+// 把 pcp 上的页还 nr 个给 buddy，调用方持有 pcp->lock
+static unsigned long free_pcppages_bulk(struct per_cpu_pages *pcp, int nr) {
+    unsigned long freed = 0;
+    pthread_mutex_lock(&g_zone.lock);
+    for (int mt = 0; mt < MIGRATE_TYPES && nr; mt++) {
+        while (pcp->lists[mt] && nr) {
+            struct page *page = pcp->lists[mt];
+            pcp->lists[mt] = page->next;
+            pcp->count--;
+            nr--;
+            __free_one_page(page, HPAGE_PMD_ORDER);
+            freed += 1UL << HPAGE_PMD_ORDER;
+        }
+    }
+    pthread_mutex_unlock(&g_zone.lock);
+    return freed;
+}
+
+// 放回本 CPU 链表 (按 pageblock 的类型，CMA 的页放 MOVABLE 链表)；攒过 high 就还一个 batch 给 buddy
+// 正在被隔离的 pageblock 的页直接回 buddy，不能在 pcp 上被别人再分走
+static void free_unref_page(struct page *page) {
+    struct per_cpu_pages *pcp = &g_pcp[smp_processor_id()];
+    int mt = get_pageblock_migratetype(page - MEM_MAP);
+    page->flags = 0; // 不是 PG_buddy 了，kfree 一个已经在 pcp 上的页会被当成 double free
+    if (mt == MIGRATE_ISOLATE) {
+        pthread_mutex_lock(&g_zone.lock);
+        __free_one_page(page, HPAGE_PMD_ORDER);
+        pthread_mutex_unlock(&g_zone.lock);
+        return;
+    }
+    if (mt == MIGRATE_CMA) mt = MIGRATE_MOVABLE;
+    pthread_mutex_lock(&pcp->lock);
+    page->next = pcp->lists[mt];
+    pcp->lists[mt] = page;
+    if (++pcp->count > pcp_thp_high) free_pcppages_bulk(pcp, PCP_THP_BATCH);
+    pthread_mutex_unlock(&pcp->lock);
+}
+
+// 所有 CPU 的 pcp 全部还给 buddy (回收路径和需要精确空闲数时用)，返回还了几页
+unsigned long drain_all_pages() {
+    unsigned long freed = 0;
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+        pthread_mutex_lock(&g_pcp[cpu].lock);
+        if (g_pcp[cpu].count) freed += free_pcppages_bulk(&g_pcp[cpu], g_pcp[cpu].count);
+        pthread_mutex_unlock(&g_pcp[cpu].lock);
+    }
+    return freed;
+}
+
+/**
+ * 快路径只在空闲页高于 low 时直接取；low 和 min 之间留给慢路径，min 以下是保留的
+ * order-9 先看本 CPU 的 pcp
+ * 不能在持有任何会被回收路径拿的锁 (slab list_lock、shrinker 的锁) 时调用
+ */
+struct page *alloc_pages(int gfp, int order) {
+    int mt = gfp_migratetype(gfp);
+    struct page *page = NULL;
+    if (order == HPAGE_PMD_ORDER && pcp_thp_high) page = rmqueue_pcplist(mt);
+    if (!page && zone_watermark_ok(order, WMARK_LOW, mt)) page = rmqueue(order, mt);
+    if (!page) page = __alloc_pages_slowpath(order, mt);
+    if (!page) return NULL;
+
+    page->flags = PG_buddy;
     page->order = order;
-    page->next = buddy_free_area[order];
-    buddy_free_area[order] = page;
+    page->mops = NULL;
+    page->next = NULL; // 清空链表指针防止野指针
+    return page;
+}
+
+void __free_pages(struct page *page, int order) {
+    if (order == HPAGE_PMD_ORDER && pcp_thp_high) {
+        free_unref_page(page);
+        return;
+    }
+    pthread_mutex_lock(&g_zone.lock);
+    __free_one_page(page, order);
+    pthread_mutex_unlock(&g_zone.lock);
 }
 
 // ================= 5. Slab Allocator =================
 
+// 从文件加载 size class 表 (每行一个尺寸，'#' 开头为注释)，格式与 size_class_opt -o 的输出一致
+// 必须在 kmalloc_init 之前调用；表不合法时保持默认表不变
+int slab_sizes_load(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        fprintf(stderr, "Error: cannot open size class table %s\n", path);
+        return 0;
+    }
+
+    uint32_t sizes[SLAB_INDEX_MAX];
+    int count = 0;
+    char line[64];
+    while (fgets(line, sizeof(line), fp)) {
+        if (line[0] == '#' || line[0] == '\n') continue;
+        unsigned long v = strtoul(line, NULL, 10);
+        // 对象至少要放得下 freelist 指针，且一页至少放一个
+        if (count == SLAB_INDEX_MAX || v < sizeof(void *) || v % sizeof(void *) || v > PAGE_SIZE ||
+            (count > 0 && v <= sizes[count - 1])) {
+            fprintf(stderr, "Error: invalid size class table %s (entry %d: %lu)\n", path, count, v);
+            fclose(fp);
+            return 0;
+        }
+        sizes[count++] = (uint32_t)v;
+    }
+    fclose(fp);
+    if (count == 0) return 0;
+
+    memcpy(slab_sizes, sizes, count * sizeof(uint32_t));
+    slab_index_count = count;
+    printf("[System] Loaded %d slab size classes from %s\n", count, path);
+    return 1;
+}
+
 void slab_init() {
-    for (int i = 0; i < SLAB_INDEX_COUNT; i++) {
+    for (int i = 0; i < slab_index_count; i++) {
         slab_caches[i].obj_size = slab_sizes[i];
         slab_caches[i].partial = NULL;
+        slab_caches[i].nr_empty = 0;
+        pthread_mutex_init(&slab_caches[i].list_lock, NULL);
     }
     printf("[System] Slab Init.\n");
 }
 
 int cache_grow(kmem_cache_t *cache) {
     // 从buddy找一个最小页
-    struct page *page = alloc_pages(0);
+    struct page *page = alloc_pages(GFP_KERNEL, 0);
     if (!page) return 0;
 
     page->flags = PG_slab;
     page->slab_cache = cache;
     page->active_objects = 0;
+    page->obj_cgroups = NULL;
     // 用页帧计算出真实的内存偏移（PA）
     void *addr = page_address(page);
     void **prev_obj_ptr = NULL;
@@ -186,17 +703,23 @@ int cache_grow(kmem_cache_t *cache) {
     page->freelist = prev_obj_ptr;
 
     // 头插法 newPage->old_page
+    pthread_mutex_lock(&cache->list_lock);
     page->next = cache->partial;
     cache->partial = page;
+    cache->nr_empty++;
+    pthread_mutex_unlock(&cache->list_lock);
 
     return 1;
 }
 
 void *kmem_cache_alloc(kmem_cache_t *cache) {
+    pthread_mutex_lock(&cache->list_lock);
     // 看当前内存池里面有没有
-    if (!cache->partial) {
-        // 没有的话分配
+    while (!cache->partial) {
+        // 没有的话分配；找 buddy 要页时不能拿着 list_lock (直接回收会回来 shrink 这个 cache)
+        pthread_mutex_unlock(&cache->list_lock);
         if (!cache_grow(cache)) return NULL;
+        pthread_mutex_lock(&cache->list_lock);
     }
 
     struct page *page = cache->partial;
@@ -204,19 +727,22 @@ void *kmem_cache_alloc(kmem_cache_t *cache) {
     // 简单的空指针检查
     if (!page->freelist) {
         printf("Error: Page inside partial list has NULL freelist!\n");
+        pthread_mutex_unlock(&cache->list_lock);
         return NULL;
     }
     // obj是要取的PA，更新freelist，指向原来放在obj里面的PA
     void *obj = page->freelist;
     page->freelist = *(void **)obj;
-    page->active_objects++;
+    if (page->active_objects++ == 0) cache->nr_empty--;
 
     if (!page->freelist) {
         cache->partial = page->next;
         page->next = NULL;
     }
+    pthread_mutex_unlock(&cache->list_lock);
 
     memset(obj, 0, 8); // 清除内部链表数据
+    stat_add(bytes_allocated, cache->obj_size);
     return obj;
 }
 
@@ -226,6 +752,12 @@ void kmem_cache_free(void *obj) {
 
     kmem_cache_t *cache = page->slab_cache;
 
+    unsigned long shadow_idx = ((uint8_t *)obj - (uint8_t *)PHYS_MEM_START) >> SHADOW_SHIFT;
+    stat_sub(bytes_requested, g_req_shadow[shadow_idx]);
+    stat_sub(bytes_allocated, cache->obj_size);
+    g_req_shadow[shadow_idx] = 0;
+
+    pthread_mutex_lock(&cache->list_lock);
     // 把释放的位置写上freelist（原来下一个空闲的位置）
     *(void **)obj = page->freelist;
     page->freelist = obj;
@@ -239,8 +771,11 @@ void kmem_cache_free(void *obj) {
         cache->partial = page;
     }
 
-    // 如果本页无活跃还给buddy
-    if (page->active_objects == 0) {
+    // 如果本页无活跃还给buddy；留几个空页在 partial 上，免得对象数在整页边界上抖动时反复进出 buddy，
+    // 这些空页由 kmem_cache_shrink (kswapd) 回收
+    if (page->active_objects == 0 && cache->nr_empty < SLAB_MIN_PARTIAL) {
+        cache->nr_empty++;
+    } else if (page->active_objects == 0) {
         if (cache->partial == page) {
             cache->partial = page->next;
         } else {
@@ -249,40 +784,1028 @@ void kmem_cache_free(void *obj) {
              if (*prev) *prev = page->next;
         }
 
+        free(page->obj_cgroups);
+        page->flags = PG_buddy;
+        __free_pages(page, 0);
+    }
+    pthread_mutex_unlock(&cache->list_lock);
+}
+
+// 把 partial 上的空页全部还给 buddy，返回还了几页
+unsigned long kmem_cache_shrink(kmem_cache_t *cache) {
+    unsigned long freed = 0;
+    pthread_mutex_lock(&cache->list_lock);
+    struct page **prev = &cache->partial;
+    while (*prev) {
+        struct page *page = *prev;
+        if (page->active_objects) {
+            prev = &page->next;
+            continue;
+        }
+        *prev = page->next;
+        free(page->obj_cgroups);
         page->flags = PG_buddy;
         __free_pages(page, 0);
+        freed++;
     }
+    cache->nr_empty = 0;
+    pthread_mutex_unlock(&cache->list_lock);
+    return freed;
+}
+
+// ================= 6. 回收：shrinker 与 kswapd =================
+
+// 能在内存紧张时释放页的子系统 (页缓存、dentry cache...) 注册一个 shrinker
+// count_objects 报告能回收多少页，scan_objects 尝试回收 nr 页并返回实际回收数；两者都必须线程安全
+struct shrinker {
+    unsigned long (*count_objects)(void);
+    unsigned long (*scan_objects)(unsigned long nr);
+    struct shrinker *next;
+};
+
+// 注册 / 注销要在 kswapd 启动前、停止后做，链表本身不加锁
+struct shrinker *g_shrinkers = NULL;
+
+void register_shrinker(struct shrinker *s) {
+    s->next = g_shrinkers;
+    g_shrinkers = s;
 }
 
-// ================= 6. Wrapper & Main =================
+void unregister_shrinker(struct shrinker *s) {
+    struct shrinker **prev = &g_shrinkers;
+    while (*prev && *prev != s) prev = &(*prev)->next;
+    if (*prev) *prev = s->next;
+}
+
+// 一轮回收：先把各 CPU 缓存的 2MB 页和 slab 的空页还回去 (最便宜)，再按顺序问各个 shrinker
+static unsigned long shrink_node(unsigned long nr_to_reclaim) {
+    unsigned long reclaimed = drain_all_pages();
+    for (int i = 0; i < slab_index_count; i++) reclaimed += kmem_cache_shrink(&slab_caches[i]);
+    for (struct shrinker *s = g_shrinkers; s && reclaimed < nr_to_reclaim; s = s->next) {
+        unsigned long count = s->count_objects();
+        unsigned long nr = nr_to_reclaim - reclaimed;
+        if (count) reclaimed += s->scan_objects(nr < count ? nr : count);
+    }
+    return reclaimed;
+}
+
+// 直接回收：前台分配自己掏腰包
+unsigned long try_to_free_pages(unsigned long nr_to_reclaim) {
+    return shrink_node(nr_to_reclaim);
+}
+
+// kswapd 主循环：被叫醒后一直回收到 high 水位，给前台留出 low~high 这段余量
+static void *kswapd(void *arg) {
+    for (;;) {
+        pthread_mutex_lock(&g_zone.kswapd_lock);
+        while (!atomic_load(&g_zone.kswapd_woken) && !g_zone.kswapd_stop)
+            pthread_cond_wait(&g_zone.kswapd_wait, &g_zone.kswapd_lock);
+        int stop = g_zone.kswapd_stop;
+        atomic_store(&g_zone.kswapd_woken, 0);
+        pthread_mutex_unlock(&g_zone.kswapd_lock);
+        if (stop) break;
+
+        g_zone.kswapd_wakeups++;
+        while (g_zone.nr_free < g_zone.watermark[WMARK_HIGH]) {
+            unsigned long reclaimed = shrink_node(SWAP_CLUSTER_MAX);
+            if (!reclaimed) break;
+            g_zone.pgsteal_kswapd += reclaimed;
+        }
+    }
+    return NULL;
+}
+
+// 已经叫过还没开始干活的就不重复叫，省掉慢路径上每次一个 futex
+void wakeup_kswapd() {
+    if (!g_zone.kswapd_running || atomic_load_explicit(&g_zone.kswapd_woken, memory_order_relaxed)) return;
+    pthread_mutex_lock(&g_zone.kswapd_lock);
+    atomic_store(&g_zone.kswapd_woken, 1);
+    pthread_cond_signal(&g_zone.kswapd_wait);
+    pthread_mutex_unlock(&g_zone.kswapd_lock);
+}
+
+int kswapd_run() {
+    g_zone.kswapd_stop = 0;
+    atomic_store(&g_zone.kswapd_woken, 0);
+    if (pthread_create(&g_zone.kswapd, NULL, kswapd, NULL)) return 0;
+    g_zone.kswapd_running = 1;
+    return 1;
+}
+
+void kswapd_stop() {
+    if (!g_zone.kswapd_running) return;
+    pthread_mutex_lock(&g_zone.kswapd_lock);
+    g_zone.kswapd_stop = 1;
+    pthread_cond_signal(&g_zone.kswapd_wait);
+    pthread_mutex_unlock(&g_zone.kswapd_lock);
+    pthread_join(g_zone.kswapd, NULL);
+    g_zone.kswapd_running = 0;
+}
+
+// ================= 7. memcg：按租户记账 =================
+// 每个租户一个 mem_cgroup，组成树：子组的用量同时记到所有祖先上，任何一层超限都拒绝。
+// 记账单位是页；slab 对象按字节记，攒够一页才去动页计数器。
+// 为了不让每次 kmalloc 都去原子加一串祖先，每个 CPU (这里是线程) 有两级预扣缓存：
+//   memcg_stock.nr_pages：一次向计数器批量预扣 MEMCG_CHARGE_BATCH 页，后面的页从这里扣
+//   memcg_stock.nr_bytes：slab 对象的字节零头，free 回来的字节也先放这里
+// 预扣的部分已经算在 usage 里，所以 usage 可能比真实占用多出每个 CPU 一个 batch (和内核一样)。
+
+#define MEMCG_CHARGE_BATCH 64
+
+struct mem_cgroup {
+    const char *name;
+    struct mem_cgroup *parent;
+    atomic_long usage;       // 页，含各 CPU 预扣
+    long max;                // 页
+    atomic_ulong failcnt;    // 在这一层超限的次数
+    atomic_long nr_charged_bytes; // 从各 CPU 字节缓存 drain 出来、凑不满一页的零头 (已经按页记过账)
+};
+
+struct memcg_stock_pcp {
+    struct mem_cgroup *cached;      // nr_pages 是从谁那里预扣的
+    unsigned int nr_pages;
+    struct mem_cgroup *cached_obj;  // nr_bytes 属于谁
+    unsigned int nr_bytes;
+};
+
+static __thread struct memcg_stock_pcp memcg_stock;
+
+// 当前在给哪个租户干活；NULL 表示不记账，kmalloc 只多一次判断
+static __thread struct mem_cgroup *active_memcg;
+
+struct mem_cgroup *mem_cgroup_create(const char *name, struct mem_cgroup *parent, long max_pages) {
+    struct mem_cgroup *memcg = calloc(1, sizeof(struct mem_cgroup));
+    memcg->name = name;
+    memcg->parent = parent;
+    memcg->max = max_pages;
+    return memcg;
+}
+
+// 返回旧的，方便嵌套恢复
+struct mem_cgroup *set_active_memcg(struct mem_cgroup *memcg) {
+    struct mem_cgroup *old = active_memcg;
+    active_memcg = memcg;
+    return old;
+}
+
+// 从 memcg 一路加到根，任何一层超 max 就把已经加上的回滚
+static int page_counter_try_charge(struct mem_cgroup *memcg, long nr_pages) {
+    for (struct mem_cgroup *c = memcg; c; c = c->parent) {
+        long usage = atomic_fetch_add_explicit(&c->usage, nr_pages, memory_order_relaxed) + nr_pages;
+        if (usage > c->max) {
+            atomic_fetch_add_explicit(&c->failcnt, 1, memory_order_relaxed);
+            for (struct mem_cgroup *u = memcg; u != c->parent; u = u->parent)
+                atomic_fetch_sub_explicit(&u->usage, nr_pages, memory_order_relaxed);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void page_counter_uncharge(struct mem_cgroup *memcg, long nr_pages) {
+    for (struct mem_cgroup *c = memcg; c; c = c->parent)
+        atomic_fetch_sub_explicit(&c->usage, nr_pages, memory_order_relaxed);
+}
+
+static void drain_stock(struct memcg_stock_pcp *stock) {
+    if (stock->cached && stock->nr_pages) page_counter_uncharge(stock->cached, stock->nr_pages);
+    stock->cached = NULL;
+    stock->nr_pages = 0;
+}
+
+static void refill_stock(struct mem_cgroup *memcg, unsigned int nr_pages) {
+    struct memcg_stock_pcp *stock = &memcg_stock;
+    if (stock->cached != memcg) {
+        drain_stock(stock);
+        stock->cached = memcg;
+    }
+    stock->nr_pages += nr_pages;
+    if (stock->nr_pages > MEMCG_CHARGE_BATCH) drain_stock(stock);
+}
+
+/**
+ * 给 memcg 记 nr_pages 页
+ * 先从本 CPU 预扣里扣；不够就一次预扣一个 batch，多出来的放进 stock。
+ * batch 超限时退回只记 nr_pages；还不行就把本 CPU 的预扣还回去再试一次
+ * (内核会 drain 所有 CPU 的 stock 并做 memcg 内回收，这里没有)
+ */
+static int try_charge(struct mem_cgroup *memcg, unsigned int nr_pages) {
+    struct memcg_stock_pcp *stock = &memcg_stock;
+    if (stock->cached == memcg && stock->nr_pages >= nr_pages) {
+        stock->nr_pages -= nr_pages;
+        return 1;
+    }
+    unsigned int batch = nr_pages > MEMCG_CHARGE_BATCH ? nr_pages : MEMCG_CHARGE_BATCH;
+    if (page_counter_try_charge(memcg, batch)) {
+        if (batch > nr_pages) refill_stock(memcg, batch - nr_pages);
+        return 1;
+    }
+    if (batch > nr_pages && page_counter_try_charge(memcg, nr_pages)) return 1;
+    drain_stock(stock);
+    return page_counter_try_charge(memcg, nr_pages);
+}
+
+static void uncharge(struct mem_cgroup *memcg, unsigned int nr_pages) {
+    refill_stock(memcg, nr_pages);
+}
+
+static void drain_obj_stock(struct memcg_stock_pcp *stock) {
+    struct mem_cgroup *memcg = stock->cached_obj;
+    if (!memcg) return;
+    // 整页的部分退掉，零头存回 memcg，下次哪个 CPU 换到这个 memcg 时再领走
+    unsigned int nr_pages = stock->nr_bytes >> PAGE_SHIFT;
+    if (nr_pages) uncharge(memcg, nr_pages);
+    if (stock->nr_bytes & (PAGE_SIZE - 1))
+        atomic_fetch_add_explicit(&memcg->nr_charged_bytes, stock->nr_bytes & (PAGE_SIZE - 1), memory_order_relaxed);
+    stock->cached_obj = NULL;
+    stock->nr_bytes = 0;
+}
+
+static void switch_obj_stock(struct memcg_stock_pcp *stock, struct mem_cgroup *memcg) {
+    drain_obj_stock(stock);
+    stock->cached_obj = memcg;
+    stock->nr_bytes = atomic_exchange_explicit(&memcg->nr_charged_bytes, 0, memory_order_relaxed);
+}
+
+// slab 对象按字节记：本 CPU 字节零头够就直接扣，不够就记一整页进来
+static int obj_cgroup_charge(struct mem_cgroup *memcg, unsigned int size) {
+    struct memcg_stock_pcp *stock = &memcg_stock;
+    if (stock->cached_obj != memcg) switch_obj_stock(stock, memcg);
+    if (stock->nr_bytes >= size) {
+        stock->nr_bytes -= size;
+        return 1;
+    }
+    unsigned int nr_pages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    if (!try_charge(memcg, nr_pages)) return 0;
+    stock->nr_bytes += (nr_pages << PAGE_SHIFT) - size;
+    return 1;
+}
+
+static void obj_cgroup_uncharge(struct mem_cgroup *memcg, unsigned int size) {
+    struct memcg_stock_pcp *stock = &memcg_stock;
+    if (stock->cached_obj != memcg) switch_obj_stock(stock, memcg);
+    stock->nr_bytes += size;
+    // 零头攒过一页就把整页退掉，只留零头
+    if (stock->nr_bytes > PAGE_SIZE) {
+        uncharge(memcg, stock->nr_bytes >> PAGE_SHIFT);
+        stock->nr_bytes &= PAGE_SIZE - 1;
+    }
+}
+
+static void memcg_slab_post_alloc_hook(struct mem_cgroup *memcg, void *obj) {
+    struct page *page = virt_to_page(obj);
+    kmem_cache_t *cache = page->slab_cache;
+    struct mem_cgroup **vec = __atomic_load_n(&page->obj_cgroups, __ATOMIC_ACQUIRE);
+    if (!vec) {
+        // 同一页上的对象可能被多个线程同时第一次记账：CAS 装上，输的一方释放自己那份
+        struct mem_cgroup **new_vec = calloc(PAGE_SIZE / cache->obj_size, sizeof(struct mem_cgroup *));
+        if (__atomic_compare_exchange_n(&page->obj_cgroups, &vec, new_vec, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            vec = new_vec;
+        } else {
+            free(new_vec);
+        }
+    }
+    vec[((uint8_t *)obj - (uint8_t *)page_address(page)) / cache->obj_size] = memcg;
+}
+
+static void memcg_slab_free_hook(struct page *page, void *obj) {
+    struct mem_cgroup **vec = __atomic_load_n(&page->obj_cgroups, __ATOMIC_ACQUIRE);
+    if (!vec) return;
+    kmem_cache_t *cache = page->slab_cache;
+    struct mem_cgroup **slot = &vec[((uint8_t *)obj - (uint8_t *)page_address(page)) / cache->obj_size];
+    if (!*slot) return;
+    obj_cgroup_uncharge(*slot, cache->obj_size);
+    *slot = NULL;
+}
+
+// 本线程的预扣全部还回去 (租户切走 / 读 usage 前用)
+void memcg_drain_local_stock() {
+    drain_obj_stock(&memcg_stock);
+    drain_stock(&memcg_stock);
+}
+
+// ================= 8. vmalloc：物理不连续、虚拟连续 =================
+// kmalloc(10MB) 要一个 order-12 的物理连续块，buddy 一碎就失败。
+// vmalloc 逐个要 order-0 页，再把它们映射到一段新预留的连续虚拟地址上：
+// 主机上就是 mmap(PROT_NONE) 占一段地址，然后把 memfd 里对应的页 MAP_FIXED 进去。
+// 物理上相邻的页合成一次 mmap，页越连续系统调用越少。
+// 代价：建映射要系统调用，访问多一层页表 / TLB；所以小对象还是 kmalloc，大缓冲区用 vmalloc 或 kvmalloc。
+
+struct vm_struct {
+    void *addr;              // 虚拟窗口起点，后面还跟一个不映射的 guard page
+    size_t size;             // 映射大小 (页对齐，不含 guard page)
+    struct page **pages;
+    unsigned int nr_pages;
+    unsigned int nr_segments; // 实际做了几次 mmap
+    struct mem_cgroup *memcg;
+    struct vm_struct *next;
+};
+
+static struct vm_struct *vmlist = NULL;
+static pthread_mutex_t vmlist_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void vm_free_pages(struct vm_struct *area, unsigned int nr) {
+    for (unsigned int i = 0; i < nr; i++) __free_pages(area->pages[i], 0);
+    if (area->memcg) uncharge(area->memcg, area->nr_pages);
+    free(area->pages);
+    free(area);
+}
+
+static int cmp_page(const void *a, const void *b) {
+    const struct page *x = *(struct page *const *)a, *y = *(struct page *const *)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * 分配 size 字节的虚拟连续缓冲区，物理页可以完全零散
+ * 和 kmalloc 一样记到 active_memcg 上
+ * @return 虚拟地址；页不够 / 超限 / 映射失败 / 物理池不是 memfd 时返回 NULL
+ */
+void *vmalloc(size_t size) {
+    if (!size || g_memfd < 0) return NULL; // 物理池不是 memfd 时没法给页建第二个映射
+    struct vm_struct *area = calloc(1, sizeof(struct vm_struct));
+    area->nr_pages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    area->size = (size_t)area->nr_pages << PAGE_SHIFT;
+    area->pages = malloc(area->nr_pages * sizeof(struct page *));
+    area->memcg = active_memcg;
+    if (area->memcg && !try_charge(area->memcg, area->nr_pages)) {
+        free(area->pages);
+        free(area);
+        return NULL;
+    }
+
+    // 1. 逐页要物理页 (GFP_KERNEL：vmalloc 的页不可迁移)
+    for (unsigned int i = 0; i < area->nr_pages; i++) {
+        area->pages[i] = alloc_pages(GFP_KERNEL, 0);
+        if (!area->pages[i]) {
+            vm_free_pages(area, i);
+            return NULL;
+        }
+    }
+
+    // 哪个物理页放在窗口的哪个位置无所谓，按 PFN 排一下序，碎片化时 buddy 吐页的顺序是乱的，
+    // 排序后物理相邻的页才能合成一次 mmap
+    qsort(area->pages, area->nr_pages, sizeof(struct page *), cmp_page);
+
+    // 2. 预留虚拟地址 (多一页当 guard page，越界写直接 SIGSEGV)
+    uint8_t *va = mmap(NULL, area->size + PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (va == MAP_FAILED) {
+        vm_free_pages(area, area->nr_pages);
+        return NULL;
+    }
+    area->addr = va;
+
+    // 3. 按物理连续的段映射进去
+    for (unsigned int i = 0; i < area->nr_pages;) {
+        unsigned long pfn = area->pages[i] - MEM_MAP;
+        unsigned int run = 1;
+        while (i + run < area->nr_pages && area->pages[i + run] - MEM_MAP == pfn + run) run++;
+        void *want = va + ((size_t)i << PAGE_SHIFT);
+        void *got = mmap(want, (size_t)run << PAGE_SHIFT, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                         g_memfd, (off_t)pfn << PAGE_SHIFT);
+        if (got != want) {
+            munmap(va, area->size + PAGE_SIZE);
+            vm_free_pages(area, area->nr_pages);
+            return NULL;
+        }
+        area->nr_segments++;
+        i += run;
+    }
+
+    pthread_mutex_lock(&vmlist_lock);
+    area->next = vmlist;
+    vmlist = area;
+    pthread_mutex_unlock(&vmlist_lock);
+    return va;
+}
+
+static struct vm_struct *find_vm_area(const void *addr) {
+    struct vm_struct *area;
+    pthread_mutex_lock(&vmlist_lock);
+    for (area = vmlist; area; area = area->next) {
+        if ((const uint8_t *)addr >= (uint8_t *)area->addr &&
+            (const uint8_t *)addr < (uint8_t *)area->addr + area->size) break;
+    }
+    pthread_mutex_unlock(&vmlist_lock);
+    return area;
+}
+
+void vfree(void *addr) {
+    if (!addr) return;
+    pthread_mutex_lock(&vmlist_lock);
+    struct vm_struct **prev = &vmlist;
+    while (*prev && (*prev)->addr != addr) prev = &(*prev)->next;
+    struct vm_struct *area = *prev;
+    if (area) *prev = area->next;
+    pthread_mutex_unlock(&vmlist_lock);
+
+    if (!area) {
+        printf("Error: vfree of unknown address %p\n", addr);
+        return;
+    }
+    munmap(area->addr, area->size + PAGE_SIZE);
+    vm_free_pages(area, area->nr_pages);
+}
+
+// vmalloc 地址 -> 背后的物理页
+struct page *vmalloc_to_page(const void *addr) {
+    struct vm_struct *area = find_vm_area(addr);
+    if (!area) return NULL;
+    return area->pages[((const uint8_t *)addr - (uint8_t *)area->addr) >> PAGE_SHIFT];
+}
+
+// ================= 9. CMA：借出去的连续预留区 =================
+// 设备 DMA 要大块物理连续内存，开机就专门留出来又太浪费。CMA 的做法：
+// 预留区的 pageblock 标成 MIGRATE_CMA，平时借给 MOVABLE 分配 (页缓存、匿名页)，非 MOVABLE 分配碰不到；
+// cma_alloc 要一段连续页时，先把这段的 pageblock 标成 ISOLATE (空闲页不再分出去)，
+// 再把借出去的页逐个迁走 (另分一页、拷数据、让主人改指针)，腾空后整段交给调用者。
+// 迁不走的页 (主人没提供迁移回调、被 pin 住、slab) 让这段失败，换下一段再试。
+
+struct movable_operations {
+    // 数据已经拷到 dst，主人把自己对 src 的引用换成 dst。返回非 0 表示这页现在迁不了
+    int (*migrate_page)(struct page *dst, struct page *src);
+};
+
+/** 主人声明 alloc_pages(__GFP_MOVABLE) 拿到的页可以迁移；不声明的页会挡住 cma_alloc */
+void set_page_movable(struct page *page, const struct movable_operations *mops) {
+    page->mops = mops;
+}
+
+// 内核迁移前会先解除映射，这里假设迁移期间主人不写这页
+static int migrate_page(struct page *src) {
+    int order = src->order;
+    const struct movable_operations *mops = src->mops;
+    if (!mops) return -1;
+
+    struct page *dst = alloc_pages(GFP_HIGHUSER_MOVABLE, order);
+    if (!dst) return -1;
+    // 分配可能触发回收，src 已经被主人释放了就不用迁了
+    if (!(src->flags & PG_buddy) || src->mops != mops) {
+        __free_pages(dst, order);
+        return 0;
+    }
+    memcpy(page_address(dst), page_address(src), PAGE_SIZE << order);
+    dst->requested = src->requested;
+    dst->memcg = src->memcg;
+    dst->mops = mops;
+    if (mops->migrate_page(dst, src)) {
+        __free_pages(dst, order);
+        return -1;
+    }
+    __free_pages(src, order);
+    g_cma.nr_migrated += 1UL << order;
+    return 0;
+}
+
+// 跨多个 pageblock 的空闲块拆成一个个 pageblock，隔离才能以 pageblock 为单位进行。调用方持有 zone lock
+static void split_free_block_at(unsigned long pfn) {
+    for (int order = PAGEBLOCK_ORDER + 1; order < MAX_ORDER; order++) {
+        unsigned long head = pfn & ~((1UL << order) - 1);
+        struct page *page = &MEM_MAP[head];
+        if ((page->flags & PG_free) && page->order == order) {
+            del_page_from_free_list(page);
+            for (unsigned long p = head; p < head + (1UL << order); p += PAGEBLOCK_NR_PAGES)
+                add_to_free_list(&MEM_MAP[p], PAGEBLOCK_ORDER, get_pageblock_migratetype(p));
+            return;
+        }
+    }
+}
+
+// 隔离失败时恢复原类型，pageblock 大小的空闲块重新合并回去。调用方持有 zone lock
+static void undo_isolate_range(unsigned long pb_start, unsigned long pb_end, const uint8_t *saved) {
+    for (unsigned long pfn = pb_start; pfn < pb_end; pfn += PAGEBLOCK_NR_PAGES) {
+        int mt = saved[(pfn - pb_start) >> PAGEBLOCK_ORDER];
+        pageblock_flags[pfn >> PAGEBLOCK_ORDER] = mt;
+        move_freepages_block(pfn, mt);
+    }
+    for (unsigned long pfn = pb_start; pfn < pb_end; pfn += PAGEBLOCK_NR_PAGES) {
+        struct page *page = &MEM_MAP[pfn];
+        if ((page->flags & PG_free) && page->order == PAGEBLOCK_ORDER) {
+            del_page_from_free_list(page);
+            __free_one_page(page, PAGEBLOCK_ORDER);
+        }
+    }
+}
+
+// [start, end) 里是不是全空了 (空闲块可能从 start 前面开始)。调用方持有 zone lock
+static int test_pages_isolated(unsigned long pb_start, unsigned long start, unsigned long end) {
+    for (unsigned long pfn = pb_start; pfn < end;) {
+        struct page *page = &MEM_MAP[pfn];
+        if (page->flags & PG_free) {
+            pfn += 1UL << page->order;
+            continue;
+        }
+        if (pfn >= start) return 0;
+        pfn++;
+    }
+    return 1;
+}
+
+/**
+ * 腾空并拿下 [start, end) 这些页，成功返回 0，页标成 flags (cma_alloc 用 PG_cma，内存下线用 PG_offline)
+ * 1. 隔离：覆盖这段的 pageblock 改成 ISOLATE，里面的空闲块挪到 ISOLATE 链表，pcp 全部还回来
+ * 2. 迁移：这段里已分配的块逐个迁走，迁完 src 释放时自然落进 ISOLATE 链表
+ * 3. 收取：把 ISOLATE 链表上这几个 pageblock 的空闲块全摘下来，段外的页还给 buddy，恢复 pageblock 原来的类型
+ */
+static int alloc_contig_range(unsigned long start, unsigned long end, uint32_t flags) {
+    unsigned long pb_start = start & ~(PAGEBLOCK_NR_PAGES - 1);
+    unsigned long pb_end = (end + PAGEBLOCK_NR_PAGES - 1) & ~(PAGEBLOCK_NR_PAGES - 1);
+    unsigned long nr_pb = (pb_end - pb_start) >> PAGEBLOCK_ORDER;
+    uint8_t *saved = malloc(nr_pb);
+    if (!saved) return -1;
+
+    pthread_mutex_lock(&g_zone.lock);
+    memcpy(saved, &pageblock_flags[pb_start >> PAGEBLOCK_ORDER], nr_pb);
+    for (unsigned long pfn = pb_start; pfn < pb_end; pfn += PAGEBLOCK_NR_PAGES)
+        split_free_block_at(pfn);
+    for (unsigned long pfn = pb_start; pfn < pb_end; pfn += PAGEBLOCK_NR_PAGES) {
+        pageblock_flags[pfn >> PAGEBLOCK_ORDER] = MIGRATE_ISOLATE;
+        move_freepages_block(pfn, MIGRATE_ISOLATE);
+    }
+    pthread_mutex_unlock(&g_zone.lock);
+    drain_all_pages();
+
+    // 迁移要分配页、可能进回收，不能拿着 zone lock；段外的已分配页不用管。
+    // 迁完的页释放后会和旁边合并，后面可能踩到合并块的尾页 (flags 为 0)，跳过就行，最后统一检查
+    for (unsigned long pfn = pb_start; pfn < end;) {
+        struct page *page = &MEM_MAP[pfn];
+        if (page->flags & PG_free) {
+            pfn += 1UL << page->order;
+        } else if (page->flags & PG_buddy) {
+            unsigned long nr = 1UL << page->order;
+            if (pfn + nr > start && migrate_page(page)) goto busy;
+            pfn += nr;
+        } else {
+            if ((page->flags & PG_slab) && pfn >= start) goto busy;
+            pfn++;
+        }
+    }
+
+    pthread_mutex_lock(&g_zone.lock);
+    if (!test_pages_isolated(pb_start, start, end)) {
+        pthread_mutex_unlock(&g_zone.lock);
+        goto busy;
+    }
+    struct page *leftover = NULL;
+    for (unsigned long pfn = pb_start; pfn < pb_end;) {
+        struct page *page = &MEM_MAP[pfn];
+        if (!(page->flags & PG_free)) {
+            pfn++;
+            continue;
+        }
+        unsigned long nr = 1UL << page->order;
+        del_page_from_free_list(page);
+        for (unsigned long p = pfn; p < pfn + nr; p++) {
+            if (p >= start && p < end) {
+                MEM_MAP[p].flags = flags;
+            } else {
+                MEM_MAP[p].flags = 0;
+                MEM_MAP[p].next = leftover;
+                leftover = &MEM_MAP[p];
+            }
+        }
+        pfn += nr;
+    }
+    memcpy(&pageblock_flags[pb_start >> PAGEBLOCK_ORDER], saved, nr_pb);
+    while (leftover) {
+        struct page *page = leftover;
+        leftover = page->next;
+        __free_one_page(page, 0);
+    }
+    pthread_mutex_unlock(&g_zone.lock);
+    free(saved);
+    return 0;
+
+busy:
+    pthread_mutex_lock(&g_zone.lock);
+    undo_isolate_range(pb_start, pb_end, saved);
+    pthread_mutex_unlock(&g_zone.lock);
+    free(saved);
+    return -1;
+}
+
+/**
+ * 从 CMA 区要 count 个物理连续页，起点按 1 << align_order 页对齐
+ * 从低往高试每个对齐的候选位置，被 pin 住的段跳过；全失败返回 NULL
+ */
+struct page *cma_alloc(unsigned long count, int align_order) {
+    unsigned long step = 1UL << align_order;
+    struct page *page = NULL;
+    if (!count || count > g_cma.count) return NULL;
+
+    pthread_mutex_lock(&g_cma.lock);
+    for (unsigned long off = 0; off + count <= g_cma.count; off += step) {
+        void *used = memchr(g_cma.allocated + off, 1, count);
+        if (used) {
+            // 跳到占用位置之后的下一个对齐点
+            off = (((uint8_t *)used - g_cma.allocated) & ~(step - 1));
+            continue;
+        }
+        if (alloc_contig_range(g_cma.base_pfn + off, g_cma.base_pfn + off + count, PG_cma)) {
+            g_cma.nr_busy_ranges++;
+            continue;
+        }
+        memset(g_cma.allocated + off, 1, count);
+        page = &MEM_MAP[g_cma.base_pfn + off];
+        break;
+    }
+    pthread_mutex_unlock(&g_cma.lock);
+    return page;
+}
+
+/** 还回 cma_alloc 拿的页，还回去后又能借给 MOVABLE */
+void cma_release(struct page *page, unsigned long count) {
+    unsigned long off = (page - MEM_MAP) - g_cma.base_pfn;
+    pthread_mutex_lock(&g_cma.lock);
+    memset(g_cma.allocated + off, 0, count);
+    pthread_mutex_unlock(&g_cma.lock);
+
+    pthread_mutex_lock(&g_zone.lock);
+    for (unsigned long i = 0; i < count; i++) {
+        page[i].flags = 0;
+        __free_one_page(&page[i], 0);
+    }
+    pthread_mutex_unlock(&g_zone.lock);
+}
+
+// ================= 10. 内存热插拔 =================
+// 物理地址空间预留到 MAX_PHYS_SIZE，按 32MB 的 section 管理 (内核 SPARSEMEM 的做法)：
+//   add_memory：在末尾加 section，给它的 struct page 填上 vmemmap；MEM_MAP 的虚拟地址早就按最大预留了，
+//               所以 MEM_MAP + pfn 在别处照用，不用改成查表
+//   online_pages：接上主机内存，逐个 pageblock 放进 buddy，重算水位
+//   offline_pages：用 CMA 那套隔离 + 迁移把整段腾空；有迁不走的页 (slab、没迁移回调) 就拒绝下线。
+//                  成功后页从 buddy 摘掉，主机内存还回去
+// 想保证以后能拔下来就按 movable 上线：只给 MOVABLE 分配用，slab 之类落不进来。
+// 内核是单独放进 ZONE_MOVABLE；这里只有一个 zone，借 MIGRATE_CMA 的 pageblock 类型 (只给 MOVABLE、永不被偷)
+
+enum { MMOP_ONLINE_KERNEL, MMOP_ONLINE_MOVABLE };
+
+static pthread_mutex_t mem_hotplug_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int phys_section_map(unsigned long pfn, unsigned long nr);
+static void phys_section_unmap(unsigned long pfn, unsigned long nr);
+static int vmemmap_populate(unsigned long pfn, unsigned long nr);
+
+// [pfn, pfn + nr) 按 section 对齐且每个 section 都是 state
+static int sections_in_state(unsigned long pfn, unsigned long nr, int state) {
+    if (!nr || (pfn | nr) & (PAGES_PER_SECTION - 1) || pfn + nr > max_pfn) return 0;
+    for (unsigned long sec = pfn / PAGES_PER_SECTION; sec < (pfn + nr) / PAGES_PER_SECTION; sec++)
+        if (mem_section_state[sec] != state) return 0;
+    return 1;
+}
+
+static void set_sections_state(unsigned long pfn, unsigned long nr, int state) {
+    memset(&mem_section_state[pfn / PAGES_PER_SECTION], state, nr / PAGES_PER_SECTION);
+}
+
+/** 在物理地址空间末尾加 nr_sections 个 section，先不上线；返回起始 pfn，地址空间用完返回 -1 */
+long add_memory(int nr_sections) {
+    unsigned long nr = nr_sections * PAGES_PER_SECTION;
+    long start = -1;
+    pthread_mutex_lock(&mem_hotplug_lock);
+    if (nr_sections > 0 && max_pfn + nr <= MAX_PHYS_SIZE / PAGE_SIZE && !vmemmap_populate(max_pfn, nr)) {
+        start = max_pfn;
+        for (unsigned long pfn = start; pfn < start + nr; pfn++) MEM_MAP[pfn].flags = PG_offline;
+        set_sections_state(start, nr, SECTION_OFFLINE);
+        pthread_mutex_lock(&g_zone.lock);
+        max_pfn += nr;
+        pthread_mutex_unlock(&g_zone.lock);
+    }
+    pthread_mutex_unlock(&mem_hotplug_lock);
+    return start;
+}
+
+/**
+ * 上线 [start_pfn, start_pfn + nr_pages)，必须是整 section 且都处于下线状态
+ * online_type 为 MMOP_ONLINE_MOVABLE 时只给 MOVABLE 分配用，保证以后能下线
+ * 主机内存接不上 (比如 hugetlb 池不够) 返回 -1
+ */
+int online_pages(unsigned long start_pfn, unsigned long nr_pages, int online_type) {
+    int ret = -1;
+    pthread_mutex_lock(&mem_hotplug_lock);
+    if (sections_in_state(start_pfn, nr_pages, SECTION_OFFLINE) && !phys_section_map(start_pfn, nr_pages)) {
+        int mt = online_type == MMOP_ONLINE_MOVABLE ? MIGRATE_CMA : MIGRATE_MOVABLE;
+        memset(&MEM_MAP[start_pfn], 0, nr_pages * sizeof(struct page));
+        pthread_mutex_lock(&g_zone.lock);
+        for (unsigned long pfn = start_pfn; pfn < start_pfn + nr_pages; pfn += PAGEBLOCK_NR_PAGES) {
+            pageblock_flags[pfn >> PAGEBLOCK_ORDER] = mt;
+            __free_one_page(&MEM_MAP[pfn], PAGEBLOCK_ORDER);
+        }
+        g_zone.managed_pages += nr_pages;
+        setup_per_zone_wmarks();
+        pthread_mutex_unlock(&g_zone.lock);
+        set_sections_state(start_pfn, nr_pages, SECTION_ONLINE);
+        stat_add(bytes_reserved, nr_pages << PAGE_SHIFT);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&mem_hotplug_lock);
+    return ret;
+}
+
+/**
+ * 下线 [start_pfn, start_pfn + nr_pages)：整 section、都在线、不和 CMA 区重叠
+ * 段里的可迁移页迁到别处，迁不走就整段恢复原状并返回 -1；剩下的内存得装得下迁出来的页
+ */
+int offline_pages(unsigned long start_pfn, unsigned long nr_pages) {
+    unsigned long end_pfn = start_pfn + nr_pages;
+    int ret = -1;
+    pthread_mutex_lock(&mem_hotplug_lock);
+    if (sections_in_state(start_pfn, nr_pages, SECTION_ONLINE) &&
+        (end_pfn <= g_cma.base_pfn || start_pfn >= g_cma.base_pfn + g_cma.count) &&
+        !alloc_contig_range(start_pfn, end_pfn, PG_offline)) {
+        phys_section_unmap(start_pfn, nr_pages);
+        pthread_mutex_lock(&g_zone.lock);
+        g_zone.managed_pages -= nr_pages;
+        setup_per_zone_wmarks();
+        pthread_mutex_unlock(&g_zone.lock);
+        set_sections_state(start_pfn, nr_pages, SECTION_OFFLINE);
+        stat_sub(bytes_reserved, nr_pages << PAGE_SHIFT);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&mem_hotplug_lock);
+    return ret;
+}
+
+// ================= 11. percpu：每个 CPU 一份的变量 =================
+// 统计计数器如果是一个共享的 atomic，每次加都要把 cache line 抢到本 CPU；
+// 各 CPU 的计数器挨着放在一个数组里也好不了多少，同一条 cache line 被几个核轮流改 (false sharing)。
+// 内核的做法：从页分配器要一个 chunk，切成 NR_CPUS 个 unit，每个 CPU 一个；
+// alloc_percpu 在 unit 里找一个偏移，每个 unit 的同一偏移处各有一份。
+// CPU c 的那份 = 指针 + c * PCPU_UNIT_SIZE，各自只改自己的，要总数时再加起来。
+// unit 是整页，不同 CPU 的副本不会落在同一条 cache line 上。
+
+#define PCPU_UNIT_PAGES  8
+#define PCPU_UNIT_SIZE   (PCPU_UNIT_PAGES * PAGE_SIZE)
+#define PCPU_CHUNK_ORDER 5 // NR_CPUS * PCPU_UNIT_PAGES 页
+#define PCPU_MIN_ALLOC   8 // 分配粒度 (字节)
+#define PCPU_UNIT_SLOTS  (PCPU_UNIT_SIZE / PCPU_MIN_ALLOC)
+
+struct pcpu_chunk {
+    uint8_t *base_addr;                      // unit 0 的起点
+    uint64_t alloc_map[PCPU_UNIT_SLOTS / 64]; // 每个 slot 一位：已分配
+    uint16_t alloc_slots[PCPU_UNIT_SLOTS];   // 每次分配的起点记着占了几个 slot，释放时用
+    int free_bytes;
+    struct pcpu_chunk *next;
+};
+
+static struct pcpu_chunk *pcpu_chunks = NULL;
+static int pcpu_nr_chunks = 0;
+static pthread_mutex_t pcpu_lock = PTHREAD_MUTEX_INITIALIZER;
+
+#define per_cpu_ptr(ptr, cpu) ((__typeof__(ptr))((uint8_t *)(ptr) + (size_t)(cpu) * PCPU_UNIT_SIZE))
+#define this_cpu_ptr(ptr)     per_cpu_ptr(ptr, smp_processor_id())
+#define alloc_percpu(type)    ((type *)__alloc_percpu(sizeof(type), __alignof__(type)))
+// 内核是一条带 %gs 前缀的 add，不会被抢占打断；这里每个线程固定一个 g_cpu，普通的读改写就够
+#define this_cpu_add(ptr, val) (*(volatile __typeof__(*(ptr)) *)this_cpu_ptr(ptr) += (val))
+
+static inline int pcpu_slot_used(struct pcpu_chunk *chunk, int i) {
+    return (chunk->alloc_map[i / 64] >> (i % 64)) & 1;
+}
+
+static void pcpu_set_slots(struct pcpu_chunk *chunk, int start, int n, int used) {
+    for (int i = start; i < start + n; i++) {
+        if (used) chunk->alloc_map[i / 64] |= 1ULL << (i % 64);
+        else chunk->alloc_map[i / 64] &= ~(1ULL << (i % 64));
+    }
+}
+
+// 从页分配器要 NR_CPUS 个 unit；调用方持有 pcpu_lock
+static struct pcpu_chunk *pcpu_create_chunk() {
+    struct page *page = alloc_pages(GFP_KERNEL, PCPU_CHUNK_ORDER);
+    if (!page) return NULL;
+    struct pcpu_chunk *chunk = calloc(1, sizeof(*chunk));
+    if (!chunk) {
+        __free_pages(page, PCPU_CHUNK_ORDER);
+        return NULL;
+    }
+    chunk->base_addr = page_address(page);
+    chunk->free_bytes = PCPU_UNIT_SIZE;
+    for (int i = 0; i < 1 << PCPU_CHUNK_ORDER; i++) page[i].pcpu_chunk = chunk;
+    chunk->next = pcpu_chunks;
+    pcpu_chunks = chunk;
+    pcpu_nr_chunks++;
+    return chunk;
+}
+
+static void pcpu_destroy_chunk(struct pcpu_chunk *chunk) {
+    struct pcpu_chunk **pp = &pcpu_chunks;
+    while (*pp != chunk) pp = &(*pp)->next;
+    *pp = chunk->next;
+    pcpu_nr_chunks--;
+    __free_pages(virt_to_page(chunk->base_addr), PCPU_CHUNK_ORDER);
+    free(chunk);
+}
+
+// first fit 找 n 个连续空 slot，起点按 align 个 slot 对齐
+static int pcpu_find_block(struct pcpu_chunk *chunk, int n, int align) {
+    for (int start = 0; start + n <= PCPU_UNIT_SLOTS; start += align) {
+        int i = 0;
+        while (i < n && !pcpu_slot_used(chunk, start + i)) i++;
+        if (i == n) return start;
+        start = (start + i) / align * align; // 跳到占用的 slot 之后的下一个对齐点
+    }
+    return -1;
+}
+
+/**
+ * 给每个 CPU 分配一份 size 字节、按 align 对齐的变量，都清零；返回 CPU 0 那份的地址，
+ * 其它 CPU 的用 per_cpu_ptr 换算。现有 chunk 放不下就再向页分配器要一个
+ */
+void *__alloc_percpu(size_t size, size_t align) {
+    if (!size || size > PCPU_UNIT_SIZE || align > PAGE_SIZE) return NULL;
+    if (align < PCPU_MIN_ALLOC) align = PCPU_MIN_ALLOC;
+    int n = (size + PCPU_MIN_ALLOC - 1) / PCPU_MIN_ALLOC, a = align / PCPU_MIN_ALLOC, off = -1;
+
+    pthread_mutex_lock(&pcpu_lock);
+    struct pcpu_chunk *chunk;
+    for (chunk = pcpu_chunks; chunk; chunk = chunk->next) {
+        if (chunk->free_bytes >= n * PCPU_MIN_ALLOC && (off = pcpu_find_block(chunk, n, a)) >= 0) break;
+    }
+    if (!chunk) {
+        chunk = pcpu_create_chunk();
+        if (chunk) off = pcpu_find_block(chunk, n, a);
+    }
+    if (!chunk) {
+        pthread_mutex_unlock(&pcpu_lock);
+        return NULL;
+    }
+    pcpu_set_slots(chunk, off, n, 1);
+    chunk->alloc_slots[off] = n;
+    chunk->free_bytes -= n * PCPU_MIN_ALLOC;
+    pthread_mutex_unlock(&pcpu_lock);
+
+    void *ptr = chunk->base_addr + (size_t)off * PCPU_MIN_ALLOC;
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) memset(per_cpu_ptr(ptr, cpu), 0, size);
+    return ptr;
+}
+
+/** 释放 alloc_percpu 拿的变量 (所有 CPU 的副本)；chunk 全空了就还给页分配器，但至少留一个 */
+void free_percpu(void *ptr) {
+    if (!ptr) return;
+    struct pcpu_chunk *chunk = virt_to_page(ptr)->pcpu_chunk;
+    int off = ((uint8_t *)ptr - chunk->base_addr) / PCPU_MIN_ALLOC;
+
+    pthread_mutex_lock(&pcpu_lock);
+    int n = chunk->alloc_slots[off];
+    pcpu_set_slots(chunk, off, n, 0);
+    chunk->alloc_slots[off] = 0;
+    chunk->free_bytes += n * PCPU_MIN_ALLOC;
+    if (chunk->free_bytes == PCPU_UNIT_SIZE && pcpu_nr_chunks > 1) pcpu_destroy_chunk(chunk);
+    pthread_mutex_unlock(&pcpu_lock);
+}
+
+// ================= 12. Wrapper & Main =================
+
+// 整个物理地址空间 (MAX_PHYS_SIZE) 先占一段 PROT_NONE 的虚拟地址，section 上线时再逐段接上主机内存。
+// 起点 2MB 对齐，主机才可能用一个 PMD 映射一个模拟的 pageblock
+static void *phys_reserve() {
+    size_t len = MAX_PHYS_SIZE + HPAGE_SIZE;
+    uint8_t *raw = mmap(NULL, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (raw == MAP_FAILED) return NULL;
+    uint8_t *aligned = (uint8_t *)(((uintptr_t)raw + HPAGE_SIZE - 1) & ~(uintptr_t)(HPAGE_SIZE - 1));
+    if (aligned > raw) munmap(raw, aligned - raw);
+    munmap(aligned + MAX_PHYS_SIZE, raw + len - (aligned + MAX_PHYS_SIZE));
+    return aligned;
+}
+
+// 给 [pfn, pfn + nr) 接上主机内存；memfd 是稀疏的，一开始就 ftruncate 到最大，偏移就是物理地址
+static int phys_section_map(unsigned long pfn, unsigned long nr) {
+    uint8_t *addr = (uint8_t *)PHYS_MEM_START + (pfn << PAGE_SHIFT);
+    size_t len = nr << PAGE_SHIFT;
+    void *p;
+    if (phys_backing == PHYS_HUGETLB)
+        p = mmap(addr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_FIXED, -1, 0);
+    else if (phys_backing == PHYS_ANON_THP)
+        p = mmap(addr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    else
+        p = mmap(addr, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, g_memfd, (off_t)pfn << PAGE_SHIFT);
+    if (p == MAP_FAILED) return -1;
+    if (phys_backing != PHYS_HUGETLB) madvise(addr, len, MADV_HUGEPAGE); // 主机不支持就是个 no-op
+    return 0;
+}
+
+// 下线的内存还给主机：换回 PROT_NONE 占位，memfd 里对应的部分打洞
+static void phys_section_unmap(unsigned long pfn, unsigned long nr) {
+    uint8_t *addr = (uint8_t *)PHYS_MEM_START + (pfn << PAGE_SHIFT);
+    size_t len = nr << PAGE_SHIFT;
+    mmap(addr, len, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+    if (g_memfd >= 0) fallocate(g_memfd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, (off_t)pfn << PAGE_SHIFT, len);
+}
+
+static void *phys_mem_map() {
+    g_memfd = -1;
+    PHYS_MEM_START = phys_reserve();
+    if (!PHYS_MEM_START) return NULL;
+    if (phys_backing == PHYS_HUGETLB) {
+        if (!phys_section_map(0, MEM_SIZE / PAGE_SIZE)) return PHYS_MEM_START;
+        printf("[System] MAP_HUGETLB failed (vm.nr_hugepages too small?), falling back to %s\n",
+               phys_backing_names[PHYS_ANON_THP]);
+        phys_backing = PHYS_ANON_THP;
+    }
+    if (phys_backing == PHYS_MEMFD) {
+        g_memfd = memfd_create("phys_mem", 0);
+        if (g_memfd < 0 || ftruncate(g_memfd, MAX_PHYS_SIZE) != 0) return NULL;
+    }
+    return phys_section_map(0, MEM_SIZE / PAGE_SIZE) ? NULL : PHYS_MEM_START;
+}
+
+// vmemmap：struct page 数组按整个物理地址空间预留虚拟地址，section 加进来时才给它那一截接上内存，
+// 所以 pfn 到 struct page 永远是 MEM_MAP + pfn
+static struct page *vmemmap_reserve() {
+    void *p = mmap(NULL, MAX_PHYS_SIZE / PAGE_SIZE * sizeof(struct page), PROT_NONE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static int vmemmap_populate(unsigned long pfn, unsigned long nr) {
+    uintptr_t start = (uintptr_t)&MEM_MAP[pfn] & ~(PAGE_SIZE - 1);
+    uintptr_t end = ((uintptr_t)&MEM_MAP[pfn + nr] + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    return mprotect((void *)start, end - start, PROT_READ | PROT_WRITE);
+}
+
+/**
+ * 主机实际用大页映射了多少 (KB)：从 /proc/self/smaps 里找物理池那一段，
+ * 把 AnonHugePages / ShmemPmdMapped / FilePmdMapped / *_Hugetlb 加起来
+ */
+unsigned long phys_mem_huge_kb() {
+    FILE *fp = fopen("/proc/self/smaps", "r");
+    if (!fp) return 0;
+    char line[256];
+    int in_range = 0;
+    unsigned long total = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        unsigned long start, end, kb;
+        char key[64];
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2 && strchr(line, '-') < strchr(line, ' ')) {
+            in_range = (uintptr_t)PHYS_MEM_START >= start && (uintptr_t)PHYS_MEM_START < end;
+        } else if (in_range && sscanf(line, "%63[^:]: %lu kB", key, &kb) == 2) {
+            if (!strcmp(key, "AnonHugePages") || !strcmp(key, "ShmemPmdMapped") ||
+                !strcmp(key, "FilePmdMapped") || strstr(key, "_Hugetlb")) total += kb;
+        }
+    }
+    fclose(fp);
+    return total;
+}
 
 void kmalloc_init() {
     // [FIX] 增加错误检查
-    PHYS_MEM_START = malloc(MEM_SIZE);
+    PHYS_MEM_START = phys_mem_map();
     if (!PHYS_MEM_START) {
-        fprintf(stderr, "FATAL: Failed to allocate physical memory pool.\n");
+        fprintf(stderr, "FATAL: Failed to map physical memory pool.\n");
         exit(1);
     }
 
-    unsigned long num_pages = MEM_SIZE / PAGE_SIZE;
-    MEM_MAP = (struct page *)malloc(num_pages * sizeof(struct page));
-    if (!MEM_MAP) {
+    MEM_MAP = vmemmap_reserve();
+    if (!MEM_MAP || vmemmap_populate(0, MEM_SIZE / PAGE_SIZE)) {
         fprintf(stderr, "FATAL: Failed to allocate mem_map.\n");
         exit(1);
     }
 
-    memset(MEM_MAP, 0, num_pages * sizeof(struct page));
+    // calloc 的零页是按需分配的，只有真正放了对象的部分才会占物理内存
+    g_req_shadow = (uint16_t *)calloc(MAX_PHYS_SIZE >> SHADOW_SHIFT, sizeof(uint16_t));
+    if (!g_req_shadow) {
+        fprintf(stderr, "FATAL: Failed to allocate stats shadow.\n");
+        exit(1);
+    }
+    memset(&g_stats, 0, sizeof(g_stats));
+    g_stats.bytes_reserved = MEM_SIZE;
 
     buddy_init();
     slab_init();
 }
 
+void kmalloc_exit() {
+    munmap(PHYS_MEM_START, MAX_PHYS_SIZE);
+    if (g_memfd >= 0) close(g_memfd);
+    munmap(MEM_MAP, MAX_PHYS_SIZE / PAGE_SIZE * sizeof(struct page));
+    while (pcpu_chunks) { // chunk 的页跟着物理池一起没了，只剩描述符要释放
+        struct pcpu_chunk *chunk = pcpu_chunks;
+        pcpu_chunks = chunk->next;
+        free(chunk);
+    }
+    pcpu_nr_chunks = 0;
+    free(g_req_shadow);
+}
+
+// 设了 active_memcg 就先记账再分配，超限返回 NULL
 void *kmalloc(size_t size) {
+    struct mem_cgroup *memcg = active_memcg;
+
     // slub
-    for (int i = 0; i < SLAB_INDEX_COUNT; i++) {
+    for (int i = 0; i < slab_index_count; i++) {
         if (size <= slab_sizes[i]) {
+            if (memcg && !obj_cgroup_charge(memcg, slab_sizes[i])) return NULL;
             // 寻找现在的内存池里面有没有空位
-            return kmem_cache_alloc(&slab_caches[i]);
+            void *obj = kmem_cache_alloc(&slab_caches[i]);
+            if (obj) {
+                g_req_shadow[((uint8_t *)obj - (uint8_t *)PHYS_MEM_START) >> SHADOW_SHIFT] = (uint16_t)size;
+                stat_add(bytes_requested, size);
+                if (memcg) memcg_slab_post_alloc_hook(memcg, obj);
+            } else if (memcg) {
+                obj_cgroup_uncharge(memcg, slab_sizes[i]);
+            }
+            return obj;
         }
     }
 
@@ -290,9 +1813,17 @@ void *kmalloc(size_t size) {
     int order = 0;
     while ((PAGE_SIZE << order) < size) order++;
 
-    struct page *page = alloc_pages(order);
-    if (!page) return NULL;
+    if (memcg && !try_charge(memcg, 1U << order)) return NULL;
+    struct page *page = alloc_pages(GFP_KERNEL, order);
+    if (!page) {
+        if (memcg) uncharge(memcg, 1U << order);
+        return NULL;
+    }
 
+    page->memcg = memcg;
+    page->requested = size;
+    stat_add(bytes_requested, size);
+    stat_add(bytes_allocated, PAGE_SIZE << order);
     return page_address(page);
 }
 
@@ -306,15 +1837,723 @@ void kfree(void *ptr) {
     }
 
     if (page->flags & PG_slab) {
+        memcg_slab_free_hook(page, ptr);
         kmem_cache_free(ptr);
     } else if (page->flags & PG_buddy) {
+        if (page->memcg) uncharge(page->memcg, 1U << page->order);
+        stat_sub(bytes_requested, page->requested);
+        stat_sub(bytes_allocated, PAGE_SIZE << page->order);
         __free_pages(page, page->order);
     } else {
         printf("Error: Double free or invalid page state %p (Flags: %x)\n", ptr, page->flags);
     }
 }
 
-int main() {
+// 先试物理连续 (访问最快)，拿不到再退到 vmalloc
+void *kvmalloc(size_t size) {
+    void *p = kmalloc(size);
+    return p ? p : vmalloc(size);
+}
+
+// 在物理内存线性映射里的就是 kmalloc 出来的
+void kvfree(void *ptr) {
+    if (virt_to_page(ptr)) kfree(ptr);
+    else vfree(ptr);
+}
+
+// 统计快照：最大空闲块取 buddy 最高的非空 order
+void kmalloc_stats(mem_stats_t *st) {
+    *st = g_stats;
+    st->largest_free = 0;
+    for (int i = MAX_ORDER - 1; i >= 0 && !st->largest_free; i--) {
+        for (int mt = 0; mt < MIGRATE_TYPES; mt++) {
+            if (buddy_free_area[i][mt]) {
+                st->largest_free = PAGE_SIZE << i;
+                break;
+            }
+        }
+    }
+}
+
+// churn 适配
+static void kfree_sized(void *ptr, size_t size) {
+    kfree(ptr);
+}
+
+// 每个 cache 留着的 SLAB_MIN_PARTIAL 个空 slab 和 pcp 上的页都还给 buddy，最后一次采样才看得到完全合并的状态
+static void kmalloc_drain(void) {
+    for (int i = 0; i < slab_index_count; i++) kmem_cache_shrink(&slab_caches[i]);
+    drain_all_pages();
+}
+
+static unsigned long nr_free_pages() {
+    return g_zone.nr_free;
+}
+
+/**
+ * 长时间混合负载后还能拿到多少个 2MB (order-9) 块
+ * 负载：70% 页缓存 (MOVABLE, order 0~2)、10% dentry 类 (RECLAIMABLE)、20% kmalloc (UNMOVABLE)，
+ * 内存基本占满，随机释放重分配；最后把 MOVABLE/RECLAIMABLE 全部回收 (相当于 drop_caches 加迁移)，
+ * 剩下钉死的只有 kmalloc，看它们散在多少个 pageblock 里
+ */
+static void mobility_test(int disabled) {
+    enum { NSLOTS = 32000, ROUNDS = 2000000 };
+    static struct { void *ptr; int type; int order; } slot[NSLOTS];
+    memset(slot, 0, sizeof(slot));
+
+    page_group_by_mobility_disabled = disabled;
+    kmalloc_init();
+
+    uint64_t seed = 88172645463325252ULL;
+    unsigned long failed = 0;
+    for (int r = 0; r < ROUNDS; r++) {
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        int i = seed % NSLOTS;
+        if (slot[i].ptr) {
+            if (slot[i].type == MIGRATE_UNMOVABLE) kfree(slot[i].ptr);
+            else __free_pages(slot[i].ptr, slot[i].order);
+            slot[i].ptr = NULL;
+            continue;
+        }
+        int dice = (seed >> 20) % 10;
+        if (dice < 7) {
+            slot[i].type = MIGRATE_MOVABLE;
+            slot[i].order = (seed >> 24) % 3;
+            slot[i].ptr = alloc_pages(GFP_HIGHUSER_MOVABLE, slot[i].order);
+        } else if (dice < 8) {
+            slot[i].type = MIGRATE_RECLAIMABLE;
+            slot[i].order = 0;
+            slot[i].ptr = alloc_pages(__GFP_RECLAIMABLE, 0);
+        } else {
+            slot[i].type = MIGRATE_UNMOVABLE;
+            slot[i].ptr = kmalloc(32 + (seed >> 28) % 2000);
+        }
+        if (!slot[i].ptr) failed++;
+    }
+    unsigned long free_after_churn = nr_free_pages();
+
+    for (int i = 0; i < NSLOTS; i++) {
+        if (slot[i].ptr && slot[i].type != MIGRATE_UNMOVABLE) {
+            __free_pages(slot[i].ptr, slot[i].order);
+            slot[i].ptr = NULL;
+        }
+    }
+    unsigned long pinned = MEM_SIZE / PAGE_SIZE - nr_free_pages();
+
+    int huge = 0;
+    while (alloc_pages(GFP_HIGHUSER_MOVABLE, PAGEBLOCK_ORDER)) huge++;
+
+    printf("  grouping %-3s: free after churn %5lu pages, %lu failed allocs, %lu fallbacks, %lu pageblock steals\n"
+           "                unmovable left %4lu pages (fits in %lu pageblocks) -> order-9 allocs: %d / %lu\n",
+           disabled ? "off" : "on", free_after_churn, failed, g_nr_fallback, g_nr_pageblock_steal,
+           pinned, (pinned + PAGEBLOCK_NR_PAGES - 1) / PAGEBLOCK_NR_PAGES, huge, MEM_SIZE / PAGE_SIZE / PAGEBLOCK_NR_PAGES);
+
+    kmalloc_exit();
+}
+
+// 演示用页缓存：读文件分配的页挂在 LRU 上，都是干净页，回收时从最老的直接丢
+static struct {
+    struct page *head, *tail; // head 最新，tail 最老
+    unsigned long nr;
+    pthread_mutex_t lock;
+} g_pagecache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static void pagecache_add(struct page *page) {
+    pthread_mutex_lock(&g_pagecache.lock);
+    page->prev = NULL;
+    page->next = g_pagecache.head;
+    if (page->next) page->next->prev = page;
+    else g_pagecache.tail = page;
+    g_pagecache.head = page;
+    g_pagecache.nr++;
+    pthread_mutex_unlock(&g_pagecache.lock);
+}
+
+static unsigned long pagecache_count(void) {
+    return g_pagecache.nr;
+}
+
+// 先在锁里摘下一串，再出锁还给 buddy
+static unsigned long pagecache_scan(unsigned long nr) {
+    pthread_mutex_lock(&g_pagecache.lock);
+    struct page *victims = NULL;
+    unsigned long freed = 0;
+    while (freed < nr && g_pagecache.tail) {
+        struct page *page = g_pagecache.tail;
+        g_pagecache.tail = page->prev;
+        if (g_pagecache.tail) g_pagecache.tail->next = NULL;
+        else g_pagecache.head = NULL;
+        g_pagecache.nr--;
+        page->mops = NULL; // 摘下来了，CMA 别再来迁它
+        page->next = victims;
+        victims = page;
+        freed++;
+    }
+    pthread_mutex_unlock(&g_pagecache.lock);
+
+    while (victims) {
+        struct page *page = victims;
+        victims = page->next;
+        __free_pages(page, 0);
+    }
+    return freed;
+}
+
+static struct shrinker pagecache_shrinker = {pagecache_count, pagecache_scan, NULL};
+
+// 随机丢掉一部分页缓存，只留大约 keep_permille / 1000，制造零散的空洞
+static void pagecache_evict(int keep_permille) {
+    uint64_t seed = 0x9e3779b97f4a7c15ULL;
+    struct page *victims = NULL;
+    pthread_mutex_lock(&g_pagecache.lock);
+    for (struct page *page = g_pagecache.head, *next; page; page = next) {
+        next = page->next;
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        if ((int)(seed % 1000) < keep_permille) continue;
+        if (page->prev) page->prev->next = page->next;
+        else g_pagecache.head = page->next;
+        if (page->next) page->next->prev = page->prev;
+        else g_pagecache.tail = page->prev;
+        g_pagecache.nr--;
+        page->mops = NULL;
+        page->next = victims;
+        victims = page;
+    }
+    pthread_mutex_unlock(&g_pagecache.lock);
+    while (victims) {
+        struct page *page = victims;
+        victims = page->next;
+        __free_pages(page, 0);
+    }
+}
+
+// CMA 迁移回调：在 LRU 里用 dst 顶替 src 的位置
+static int pagecache_migrate(struct page *dst, struct page *src) {
+    pthread_mutex_lock(&g_pagecache.lock);
+    if (!src->mops) { // 正在被回收
+        pthread_mutex_unlock(&g_pagecache.lock);
+        return -1;
+    }
+    dst->prev = src->prev;
+    dst->next = src->next;
+    if (dst->prev) dst->prev->next = dst;
+    else g_pagecache.head = dst;
+    if (dst->next) dst->next->prev = dst;
+    else g_pagecache.tail = dst;
+    src->mops = NULL;
+    pthread_mutex_unlock(&g_pagecache.lock);
+    return 0;
+}
+
+static const struct movable_operations pagecache_mops = {pagecache_migrate};
+
+// 用可迁移的页缓存把内存填到 high 水位
+static void pagecache_fill() {
+    while (zone_watermark_ok(0, WMARK_HIGH, MIGRATE_MOVABLE)) {
+        struct page *page = alloc_pages(GFP_HIGHUSER_MOVABLE, 0);
+        if (!page) break;
+        set_page_movable(page, &pagecache_mops);
+        pagecache_add(page);
+    }
+}
+
+static int cmp_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * 顺序读 800MB 文件穿过 128MB 内存：每个页都要分配，内存满了以后全靠回收页缓存
+ * 每读一批页等一次"磁盘"，kswapd 就在这个空档里回收；量前台 alloc_pages 的延迟分布
+ */
+static void reclaim_test(int use_kswapd) {
+    enum { NR_READS = 200000, READ_BATCH = 32 };
+    static uint64_t lat[NR_READS];
+
+    kmalloc_init();
+    register_shrinker(&pagecache_shrinker);
+    if (use_kswapd) kswapd_run();
+
+    unsigned long failed = 0;
+    for (int i = 0; i < NR_READS; i++) {
+        uint64_t t0 = mem_now_ns();
+        struct page *page = alloc_pages(GFP_HIGHUSER_MOVABLE, 0);
+        lat[i] = mem_now_ns() - t0;
+        if (!page) failed++;
+        else pagecache_add(page);
+
+        if (i % READ_BATCH == READ_BATCH - 1) {
+            struct timespec io = {0, 20000};
+            nanosleep(&io, NULL);
+        }
+    }
+    kswapd_stop();
+
+    qsort(lat, NR_READS, sizeof(uint64_t), cmp_u64);
+    printf("  kswapd %-3s: p50 %4llu ns  p99 %5llu ns  p99.9 %6llu ns  max %7llu ns | "
+           "allocstall %5lu, reclaimed direct %6lu / kswapd %6lu (%lu wakeups), %lu failed\n",
+           use_kswapd ? "on" : "off",
+           (unsigned long long)lat[NR_READS / 2], (unsigned long long)lat[NR_READS * 99 / 100],
+           (unsigned long long)lat[NR_READS * 999 / 1000], (unsigned long long)lat[NR_READS - 1],
+           g_zone.allocstall, g_zone.pgsteal_direct, g_zone.pgsteal_kswapd, g_zone.kswapd_wakeups, failed);
+
+    pagecache_scan(g_pagecache.nr);
+    unregister_shrinker(&pagecache_shrinker);
+    kmalloc_exit();
+}
+
+static void memcg_show(struct mem_cgroup *memcg) {
+    char label[32], max[24];
+    int depth = 0;
+    for (struct mem_cgroup *c = memcg->parent; c; c = c->parent) depth++;
+    snprintf(label, sizeof(label), "%*s%s", depth * 2, "", memcg->name);
+    if (memcg->max == LONG_MAX) snprintf(max, sizeof(max), "max");
+    else snprintf(max, sizeof(max), "%ld", memcg->max);
+    printf("    %-10s usage %5ld pages  max %5s  failcnt %lu\n", label,
+           atomic_load(&memcg->usage), max, atomic_load(&memcg->failcnt));
+}
+
+/**
+ * 租户记账：
+ * 1. service (8MB) 下挂 A (4MB) 和 B (不限)：A 先撞自己的上限，B 撞父节点的上限；全部释放后 usage 要回到 0
+ * 2. kmalloc(64)/kfree 的记账开销：不记账 / 单租户 (基本都命中本 CPU 预扣) / 两个租户交替 (预扣来回换)
+ */
+static void memcg_test() {
+    kmalloc_init();
+    struct mem_cgroup *service = mem_cgroup_create("service", NULL, 2048);
+    struct mem_cgroup *a = mem_cgroup_create("A", service, 1024);
+    struct mem_cgroup *b = mem_cgroup_create("B", service, LONG_MAX);
+
+    enum { MAX_OBJS = 8192 };
+    static void *objs_a[MAX_OBJS], *objs_b[MAX_OBJS];
+    int na = 0, nb = 0;
+    set_active_memcg(a);
+    while (na < MAX_OBJS && (objs_a[na] = kmalloc(1000))) na++;
+    set_active_memcg(b);
+    while (nb < MAX_OBJS && (objs_b[nb] = kmalloc(64 * 1024))) nb++;
+    set_active_memcg(NULL);
+    void *unaccounted = kmalloc(64 * 1024);
+    printf("  A got %d x kmalloc(1000), B got %d x kmalloc(64K), unaccounted kmalloc(64K) %s\n",
+           na, nb, unaccounted ? "ok" : "failed");
+    memcg_show(service);
+    memcg_show(a);
+    memcg_show(b);
+
+    for (int i = 0; i < na; i++) kfree(objs_a[i]);
+    for (int i = 0; i < nb; i++) kfree(objs_b[i]);
+    kfree(unaccounted);
+    memcg_drain_local_stock();
+    printf("  after freeing everything: service %ld, A %ld, B %ld pages\n",
+           atomic_load(&service->usage), atomic_load(&a->usage), atomic_load(&b->usage));
+
+    // 记账开销：这里去掉上限，只量记账本身
+    service->max = a->max = LONG_MAX;
+    struct mem_cgroup *tenants[2] = {a, b};
+    const char *modes[] = {"no accounting", "one tenant", "two interleaved"};
+    enum { BATCH = 16, ROUNDS = 1 << 16 };
+    for (int mode = 0; mode < 3; mode++) {
+        double best = 1e30;
+        for (int run = 0; run < 5; run++) {
+            void *p[BATCH];
+            uint64_t t0 = mem_now_ns();
+            for (int r = 0; r < ROUNDS; r++) {
+                for (int i = 0; i < BATCH; i++) {
+                    if (mode) set_active_memcg(tenants[mode == 2 ? i & 1 : 0]);
+                    p[i] = kmalloc(64);
+                }
+                for (int i = 0; i < BATCH; i++) kfree(p[i]);
+            }
+            double ns = (double)(mem_now_ns() - t0) / ((double)ROUNDS * BATCH);
+            if (ns < best) best = ns;
+        }
+        set_active_memcg(NULL);
+        printf("  %-16s %5.1f ns per kmalloc(64)+kfree\n", modes[mode], best);
+    }
+    memcg_drain_local_stock();
+
+    free(a);
+    free(b);
+    free(service);
+    kmalloc_exit();
+}
+
+/**
+ * 大缓冲区 vs 碎片：把内存用 order-0 页填满 (停在 min 水位)，再每 16 页留一页钉子，
+ * 最大空闲块只剩水位线下没分出去的那一小段。
+ * 这时 kmalloc(10MB) 必败，vmalloc(10MB) 照样成功；通过 vmalloc 指针写、通过线性映射读，验证映射是对的
+ */
+static void vmalloc_test() {
+    const size_t size = 10 * 1024 * 1024;
+    kmalloc_init();
+
+    for (int frag = 0; frag < 2; frag++) {
+        static struct page *pinned[MEM_SIZE / PAGE_SIZE];
+        int nr_pinned = 0;
+        if (frag) {
+            struct page *page;
+            while ((page = alloc_pages(GFP_KERNEL, 0))) {
+                if ((page - MEM_MAP) % 16 == 0) pinned[nr_pinned++] = page;
+                else page->next = (struct page *)1; // 标记一下，下面还回去
+            }
+            for (unsigned long pfn = 0; pfn < MEM_SIZE / PAGE_SIZE; pfn++) {
+                if (MEM_MAP[pfn].flags == PG_buddy && MEM_MAP[pfn].next == (struct page *)1) {
+                    MEM_MAP[pfn].next = NULL;
+                    __free_pages(&MEM_MAP[pfn], 0);
+                }
+            }
+        }
+        mem_stats_t st;
+        kmalloc_stats(&st);
+
+        void *k = kmalloc(size);
+        uint64_t t0 = mem_now_ns();
+        uint8_t *v = vmalloc(size);
+        uint64_t t1 = mem_now_ns();
+        struct vm_struct *area = find_vm_area(v);
+
+        int ok = v != NULL;
+        for (size_t off = 0; ok && off < size; off += PAGE_SIZE) v[off] = (uint8_t)(off >> PAGE_SHIFT);
+        for (size_t off = 0; ok && off < size; off += PAGE_SIZE)
+            ok = *(uint8_t *)page_address(vmalloc_to_page(v + off)) == (uint8_t)(off >> PAGE_SHIFT);
+
+        printf("  %-10s largest free block %5lu KB | kmalloc(10MB) %-6s | vmalloc(10MB) %s: %u pages in %u mmap segments, %.0f us, data %s\n",
+               frag ? "fragmented" : "clean", (unsigned long)(st.largest_free / 1024), k ? "ok" : "failed",
+               v ? "ok" : "failed", area ? area->nr_pages : 0, area ? area->nr_segments : 0,
+               (t1 - t0) / 1000.0, ok ? "verified" : "MISMATCH");
+
+        void *kv = kvmalloc(size);
+        printf("             kvmalloc(10MB) -> %s\n", !kv ? "failed" : virt_to_page(kv) ? "kmalloc" : "vmalloc");
+        kvfree(kv);
+        kfree(k);
+        vfree(v);
+        for (int i = 0; i < nr_pinned; i++) __free_pages(pinned[i], 0);
+    }
+    printf("  free pages after vfree: %lu / %lu\n", nr_free_pages(), (unsigned long)(MEM_SIZE / PAGE_SIZE));
+    kmalloc_exit();
+}
+
+/**
+ * 2MB 页：
+ * 1. 分配器开销：一批 4 个 order-9 分配再释放，pcp 缓存 vs 每次都拆 / 合 buddy
+ * 2. 主机 TLB：在 32 个 2MB 页 (64MB) 上做依赖链随机读，看主机背后是不是真大页
+ */
+static void *pcp_thread(void *arg) {
+    struct page *page = alloc_pages(GFP_HIGHUSER_MOVABLE, HPAGE_PMD_ORDER);
+    if (page) __free_pages(page, HPAGE_PMD_ORDER);
+    *(int *)arg = smp_processor_id();
+    return NULL;
+}
+
+static void hugepage_test() {
+    printf("  order-9 alloc+free (4 in flight):\n");
+    kmalloc_init();
+    enum { BATCH = 4, ROUNDS = 1 << 17 };
+    int highs[2] = {0, 8};
+    for (int h = 0; h < 2; h++) {
+        pcp_thp_high = highs[h];
+        double best = 1e30;
+        for (int run = 0; run < 5; run++) {
+            struct page *p[BATCH];
+            uint64_t t0 = mem_now_ns();
+            for (int r = 0; r < ROUNDS; r++) {
+                for (int i = 0; i < BATCH; i++) p[i] = alloc_pages(GFP_HIGHUSER_MOVABLE, HPAGE_PMD_ORDER);
+                for (int i = 0; i < BATCH; i++) __free_pages(p[i], HPAGE_PMD_ORDER);
+            }
+            double ns = (double)(mem_now_ns() - t0) / ((double)ROUNDS * BATCH);
+            if (ns < best) best = ns;
+        }
+        drain_all_pages();
+        printf("    pcp_thp_high %d: %5.1f ns per 2MB page\n", highs[h], best);
+    }
+    pcp_thp_high = 8;
+
+    // 两个线程各分配、释放一个 2MB 页：各自领到不同的 CPU 编号，页该留在各自的 pcp 上
+    int cpu[2];
+    for (int t = 0; t < 2; t++) {
+        pthread_t tid;
+        pthread_create(&tid, NULL, pcp_thread, &cpu[t]);
+        pthread_join(tid, NULL);
+    }
+    printf("  two threads: cpu %d pcp holds %d, cpu %d pcp holds %d -> %s\n",
+           cpu[0], g_pcp[cpu[0]].count, cpu[1], g_pcp[cpu[1]].count,
+           cpu[0] != cpu[1] && g_pcp[cpu[0]].count && g_pcp[cpu[1]].count ? "separate per-CPU lists" : "SHARED LIST");
+    drain_all_pages();
+    kmalloc_exit();
+
+    printf("  random reads, one cache line per 4KB page across 64MB of 2MB pages:\n");
+    int saved = phys_backing;
+    for (int b = PHYS_MEMFD; b <= PHYS_HUGETLB; b++) {
+        phys_backing = b;
+        kmalloc_init();
+        if (phys_backing != b) { // MAP_HUGETLB 退回了 anon THP，上一行已经量过
+            kmalloc_exit();
+            break;
+        }
+        enum { NR_HPAGES = 32, NR_READS = 1 << 22 };
+        uint8_t *hp[NR_HPAGES];
+        int n = 0;
+        for (; n < NR_HPAGES; n++) {
+            struct page *page = alloc_pages(GFP_HIGHUSER_MOVABLE, HPAGE_PMD_ORDER);
+            if (!page) break;
+            hp[n] = page_address(page);
+            memset(hp[n], 0, HPAGE_SIZE); // 先把主机页都摸一遍，缺页不算进去
+        }
+        // 每个 4KB 页只读同一条 cache line：数据总共 1MB 能进缓存，差别只剩 TLB
+        // (4KB 页要 16K 个表项，2MB 页只要 32 个)；下一次的地址依赖上一次读到的值，miss 没法叠起来
+        uint64_t seed = 88172645463325252ULL, v = 0;
+        uint64_t t0 = mem_now_ns();
+        for (int i = 0; i < NR_READS; i++) {
+            seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+            uint64_t x = seed ^ v;
+            v = *(volatile uint64_t *)(hp[x % n] + ((x >> 32) % (1 << HPAGE_PMD_ORDER)) * PAGE_SIZE);
+        }
+        double ns = (double)(mem_now_ns() - t0) / NR_READS;
+        printf("    %-20s host huge pages %6lu KB / %lu KB: %5.1f ns per read\n",
+               phys_backing_names[phys_backing], phys_mem_huge_kb(), (unsigned long)MEM_SIZE / 1024, ns);
+        kmalloc_exit();
+    }
+    phys_backing = saved;
+}
+
+/**
+ * CMA：32MB 预留区平时被页缓存借走，cma_alloc 4 次 4MB 要把借出去的页迁走
+ * 页缓存先填满内存，再随机丢到不同比例，看连续分配的延迟和迁移量随碎片程度怎么变；
+ * 对照同样 4MB 的 alloc_pages(GFP_KERNEL, 10)：普通区被页缓存打散后只能靠回收，丢掉的缓存远不止 4MB
+ * 最后钉住第一段里的一页，cma_alloc 应该跳过这段
+ */
+static void cma_test() {
+    enum { NR_CHUNKS = 4, CHUNK = 1024 };
+    static const int keep[] = {0, 500, 750, 900, 990};
+    struct page *chunk[NR_CHUNKS];
+
+    cma_reserve_pages = 8192;
+    for (int l = 0; l < (int)(sizeof(keep) / sizeof(keep[0])); l++) {
+        kmalloc_init();
+        register_shrinker(&pagecache_shrinker);
+        pagecache_fill();
+        pagecache_evict(keep[l]);
+        drain_all_pages();
+        unsigned long cache = g_pagecache.nr, lent = g_cma.count - g_zone.nr_free_cma;
+
+        uint64_t total = 0, worst = 0;
+        int ok = 0;
+        for (int i = 0; i < NR_CHUNKS; i++) {
+            uint64_t t0 = mem_now_ns();
+            chunk[i] = cma_alloc(CHUNK, 10);
+            uint64_t dt = mem_now_ns() - t0;
+            total += dt;
+            if (dt > worst) worst = dt;
+            if (chunk[i]) ok++;
+        }
+        unsigned long migrated = g_cma.nr_migrated;
+        for (int i = 0; i < NR_CHUNKS; i++)
+            if (chunk[i]) cma_release(chunk[i], CHUNK);
+
+        unsigned long cached = g_pagecache.nr;
+        uint64_t t0 = mem_now_ns();
+        struct page *page = alloc_pages(GFP_KERNEL, 10);
+        uint64_t buddy_ns = mem_now_ns() - t0;
+        if (page) __free_pages(page, 10);
+
+        printf("  page cache %3lu%% of memory, CMA %3lu%% lent | cma_alloc(4MB) %d/%d avg %5.0f us max %5.0f us, "
+               "%4lu pages migrated | alloc_pages(order-10) %-6s %5.0f us, %5lu cached pages dropped\n",
+               cache * 100 / (MEM_SIZE / PAGE_SIZE), lent * 100 / g_cma.count, ok, NR_CHUNKS,
+               total / 1000.0 / NR_CHUNKS, worst / 1000.0, migrated, page ? "ok" : "failed", buddy_ns / 1000.0,
+               cached - g_pagecache.nr);
+
+        pagecache_scan(g_pagecache.nr);
+        unregister_shrinker(&pagecache_shrinker);
+        kmalloc_exit();
+    }
+
+    kmalloc_init();
+    pagecache_fill();
+    pagecache_evict(500);
+    for (struct page *page = g_pagecache.head; page; page = page->next) {
+        unsigned long pfn = page - MEM_MAP;
+        if (pfn >= g_cma.base_pfn && pfn < g_cma.base_pfn + CHUNK) {
+            page->mops = NULL; // 模拟被 pin 住 (比如正在做 DMA)，主人暂时不让迁
+            break;
+        }
+    }
+    struct page *page = cma_alloc(CHUNK, 10);
+    printf("  one pinned page in the first 4MB: cma_alloc got offset %ld pages, %lu busy ranges skipped\n",
+           page ? (long)(page - MEM_MAP - g_cma.base_pfn) : -1L, g_cma.nr_busy_ranges);
+    if (page) cma_release(page, CHUNK);
+    pagecache_scan(g_pagecache.nr);
+    kmalloc_exit();
+    cma_reserve_pages = 0;
+}
+
+static void hotplug_show(const char *what, int ret, uint64_t ns, unsigned long migrated) {
+    printf("  %-34s %-7s %6.0f us, %5lu pages migrated | online %4lu MB, free %4lu MB, watermarks %lu/%lu/%lu\n",
+           what, ret ? "refused" : "ok", ns / 1000.0, migrated,
+           (g_zone.managed_pages * PAGE_SIZE) >> 20, (nr_free_pages() * PAGE_SIZE) >> 20,
+           g_zone.watermark[WMARK_MIN], g_zone.watermark[WMARK_LOW], g_zone.watermark[WMARK_HIGH]);
+}
+
+/**
+ * 内存热插拔：128MB 开机，再加 64MB 普通上线、64MB movable 上线
+ * 512MB 页缓存流过 256MB、中间混着 kmalloc，回收把空洞打散后 slab 哪儿都可能落；丢掉一半缓存后分别下线两段：
+ * 普通上线的那段有 slab 页迁不走，下线被拒；movable 那段只有页缓存，迁走就能下线。
+ * kmalloc 全部释放、空 slab 缩掉之后普通那段也能下线；最后把 movable 那段重新上线
+ */
+static void hotplug_test() {
+    enum { NR_OBJS = 16384 };
+    static void *objs[NR_OBJS];
+    const unsigned long nr = 2 * PAGES_PER_SECTION;
+
+    kmalloc_init();
+    register_shrinker(&pagecache_shrinker);
+    uint64_t t0 = mem_now_ns();
+    long kern = add_memory(2);
+    int ret = online_pages(kern, nr, MMOP_ONLINE_KERNEL);
+    hotplug_show("add+online 64MB (kernel)", ret, mem_now_ns() - t0, 0);
+    t0 = mem_now_ns();
+    long mov = add_memory(2);
+    ret = online_pages(mov, nr, MMOP_ONLINE_MOVABLE);
+    hotplug_show("add+online 64MB (movable)", ret, mem_now_ns() - t0, 0);
+
+    uint64_t seed = 88172645463325252ULL;
+    for (int i = 0; i < NR_OBJS; i++) {
+        for (int j = 0; j < 8; j++) {
+            struct page *page = alloc_pages(GFP_HIGHUSER_MOVABLE, 0);
+            if (!page) break;
+            set_page_movable(page, &pagecache_mops);
+            pagecache_add(page);
+        }
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        objs[i] = kmalloc(32 + seed % 4000);
+    }
+    pagecache_evict(500);
+    printf("  after streaming %d MB of page cache with %d kmallocs mixed in, half the cache evicted:\n",
+           NR_OBJS * 8 * (int)PAGE_SIZE >> 20, NR_OBJS);
+
+    unsigned long migrated = g_cma.nr_migrated;
+    t0 = mem_now_ns();
+    ret = offline_pages(kern, nr);
+    hotplug_show("offline the kernel 64MB", ret, mem_now_ns() - t0, g_cma.nr_migrated - migrated);
+    migrated = g_cma.nr_migrated;
+    t0 = mem_now_ns();
+    ret = offline_pages(mov, nr);
+    hotplug_show("offline the movable 64MB", ret, mem_now_ns() - t0, g_cma.nr_migrated - migrated);
+
+    for (int i = 0; i < NR_OBJS; i++) kfree(objs[i]);
+    for (int i = 0; i < slab_index_count; i++) kmem_cache_shrink(&slab_caches[i]);
+    migrated = g_cma.nr_migrated;
+    t0 = mem_now_ns();
+    ret = offline_pages(kern, nr);
+    hotplug_show("kfree all, offline the kernel 64MB", ret, mem_now_ns() - t0, g_cma.nr_migrated - migrated);
+
+    t0 = mem_now_ns();
+    ret = online_pages(mov, nr, MMOP_ONLINE_MOVABLE);
+    hotplug_show("online the movable 64MB again", ret, mem_now_ns() - t0, 0);
+
+    pagecache_scan(g_pagecache.nr);
+    unregister_shrinker(&pagecache_shrinker);
+    kmalloc_exit();
+}
+
+enum { COUNTER_SHARED, COUNTER_PACKED, COUNTER_PERCPU };
+static const char *counter_names[] = {"shared atomic", "packed array", "alloc_percpu"};
+
+static struct {
+    int mode;
+    long nr;
+    _Atomic long shared;
+    volatile long packed[NR_CPUS]; // 几个 CPU 的计数器挤在同一条 cache line
+    long *percpu;
+    pthread_barrier_t start;
+} g_counter;
+
+static void *counter_worker(void *arg) {
+    g_cpu = (int)(intptr_t)arg;
+    pthread_barrier_wait(&g_counter.start);
+    for (long i = 0; i < g_counter.nr; i++) {
+        if (g_counter.mode == COUNTER_SHARED) atomic_fetch_add_explicit(&g_counter.shared, 1, memory_order_relaxed);
+        else if (g_counter.mode == COUNTER_PACKED) g_counter.packed[smp_processor_id()]++;
+        else this_cpu_add(g_counter.percpu, 1);
+    }
+    return NULL;
+}
+
+/**
+ * percpu：
+ * 1. 混着分配 / 释放 4~256 字节的 percpu 变量，看 chunk 数、副本间距和清零
+ * 2. 计数器：1/2/4 个线程 (各占一个模拟 CPU) 一起加，共享 atomic vs 挤在一起的数组 vs alloc_percpu
+ */
+static void percpu_test() {
+    enum { NR_VARS = 4096, NR_INCS = 1 << 24 };
+    static void *vars[NR_VARS];
+    kmalloc_init();
+
+    uint64_t seed = 88172645463325252ULL;
+    int dirty = 0;
+    for (int round = 0; round < 2; round++) {
+        for (int i = round; i < NR_VARS; i += 1 + round) { // 第二轮只补回第一轮之后释放掉的奇数位
+            seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+            size_t size = 4 + seed % 253;
+            vars[i] = __alloc_percpu(size, (size_t)1 << (seed >> 40) % 7);
+            for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+                uint8_t *p = per_cpu_ptr((uint8_t *)vars[i], cpu);
+                for (size_t b = 0; b < size; b++) dirty |= p[b];
+                memset(p, 0xa5, size); // 下次有人拿到这块要重新看到 0
+            }
+        }
+        if (round == 0) {
+            printf("  %d percpu vars of 4-256 bytes: %d chunks of %d KB (%lu KB per CPU unit), copies %lu bytes apart",
+                   NR_VARS, pcpu_nr_chunks, (int)(NR_CPUS * PCPU_UNIT_SIZE / 1024), PCPU_UNIT_SIZE / 1024,
+                   (unsigned long)((uint8_t *)per_cpu_ptr((uint8_t *)vars[0], 1) - (uint8_t *)vars[0]));
+            for (int i = 1; i < NR_VARS; i += 2) free_percpu(vars[i]);
+        }
+    }
+    printf(", refilled after freeing half: %d chunks", pcpu_nr_chunks);
+    for (int i = 0; i < NR_VARS; i++) free_percpu(vars[i]);
+    printf(", after freeing all: %d, %s\n", pcpu_nr_chunks, dirty ? "STALE DATA" : "always zeroed");
+
+    printf("  %d increments per thread (host has %ld CPUs online):\n", NR_INCS, sysconf(_SC_NPROCESSORS_ONLN));
+    g_counter.percpu = alloc_percpu(long);
+    for (int mode = COUNTER_SHARED; mode <= COUNTER_PERCPU; mode++) {
+        printf("    %-13s", counter_names[mode]);
+        for (int nr_threads = 1; nr_threads <= NR_CPUS; nr_threads *= 2) {
+            pthread_t tids[NR_CPUS];
+            g_counter.mode = mode;
+            g_counter.nr = NR_INCS;
+            atomic_store(&g_counter.shared, 0);
+            for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+                g_counter.packed[cpu] = 0;
+                *per_cpu_ptr(g_counter.percpu, cpu) = 0;
+            }
+            pthread_barrier_init(&g_counter.start, NULL, nr_threads + 1);
+            for (int t = 0; t < nr_threads; t++) pthread_create(&tids[t], NULL, counter_worker, (void *)(intptr_t)t);
+            pthread_barrier_wait(&g_counter.start);
+            uint64_t t0 = mem_now_ns();
+            for (int t = 0; t < nr_threads; t++) pthread_join(tids[t], NULL);
+            uint64_t ns = mem_now_ns() - t0;
+            pthread_barrier_destroy(&g_counter.start);
+
+            long sum = atomic_load(&g_counter.shared);
+            for (int cpu = 0; cpu < NR_CPUS; cpu++) sum += g_counter.packed[cpu] + *per_cpu_ptr(g_counter.percpu, cpu);
+            printf(" | %d thr %7.1f Mops/s%s", nr_threads, (double)NR_INCS * nr_threads * 1000.0 / ns,
+                   sum == (long)NR_INCS * nr_threads ? "" : " (WRONG SUM)");
+        }
+        printf("\n");
+    }
+    free_percpu(g_counter.percpu);
+    kmalloc_exit();
+}
+
+int main(int argc, char **argv) {
+    // ./linux_buddy_slub --csv out.csv：跑随机负载并输出占用/碎片时间序列
+    if (argc > 2 && !strcmp(argv[1], "--csv")) {
+        kmalloc_init();
+        mem_backend_t backend = {"linux_buddy_slub", kmalloc, kfree_sized, kmalloc_stats, 16, 256 * 1024,
+                                 kmalloc_drain};
+        return mem_churn_main(&backend, argv[2], 1000000, 4096);
+    }
+
+    // 可选：./linux_buddy_slub <size_class_opt 生成的表>
+    if (argc > 1) slab_sizes_load(argv[1]);
     kmalloc_init();
     printf("\n--- Test kmalloc (Linux Style: struct page & vmemmap) ---\n");
 
@@ -348,6 +2587,33 @@ int main() {
     kfree(mid);
     kfree(large);
     kfree(small);
+    kmalloc_exit();
+
+    printf("\n--- Mobility grouping: high-order allocs after a mixed workload ---\n");
+    mobility_test(1);
+    mobility_test(0);
+
+    printf("\n--- Watermarks: streaming 800MB of page cache through 128MB ---\n");
+    reclaim_test(0);
+    reclaim_test(1);
+
+    printf("\n--- memcg: per-tenant kmalloc accounting ---\n");
+    memcg_test();
+
+    printf("\n--- vmalloc: 10MB buffers on a fragmented buddy ---\n");
+    vmalloc_test();
+
+    printf("\n--- 2MB pages: per-CPU order-9 cache and host backing ---\n");
+    hugepage_test();
+
+    printf("\n--- CMA: contiguous allocations from a region lent to page cache ---\n");
+    cma_test();
+
+    printf("\n--- Memory hotplug: growing and shrinking the pool at runtime ---\n");
+    hotplug_test();
+
+    printf("\n--- percpu: per-CPU variables and counter scaling ---\n");
+    percpu_test();
 
     printf("Done.\n");
     return 0;
@@ -0,0 +1,179 @@
+#ifndef MEM_STATS_H
+#define MEM_STATS_H
+
+// 各个分配器共用的内存占用统计 + CSV 时间序列采样
+// 每个后端 (bitmap.c / buddy.c / TLSF.c / slub.c / linux_buddy_slub.c) 自己维护计数器，
+// 通过 mem_backend_t 把 alloc/free/stats 交给这里的 churn 负载，
+// 负载运行过程中按固定操作间隔采样，输出一条碎片化曲线而不是只看最终状态。
+//
+// 用法：./<backend> --csv out.csv
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+// ================= 统计计数器 =================
+
+typedef struct {
+    uint64_t bytes_requested; // 调用者实际要的字节数 (存活对象)
+    uint64_t bytes_allocated; // 分配器实际交出去的字节数 (向上取整到 class / order / 页之后)
+    uint64_t bytes_reserved;  // 分配器从底层拿到的字节数 (固定池子就是池子大小)
+    uint64_t free_blocks;     // 空闲块个数
+    uint64_t largest_free;    // 最大空闲块字节数 (决定下一个大请求能否成功)
+} mem_stats_t;
+
+// ================= CSV 采样器 =================
+
+typedef struct {
+    FILE *fp;
+    uint64_t every;   // 每隔多少次操作采一个点
+    uint64_t start_ns;
+} mem_sampler_t;
+
+static inline uint64_t mem_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline int mem_sampler_open(mem_sampler_t *s, const char *path, uint64_t every) {
+    s->fp = fopen(path, "w");
+    if (!s->fp) {
+        perror(path);
+        return -1;
+    }
+    s->every = every ? every : 1;
+    s->start_ns = mem_now_ns();
+    fprintf(s->fp, "op,time_us,bytes_requested,bytes_allocated,bytes_reserved,"
+                   "free_blocks,largest_free,internal_frag,external_frag\n");
+    return 0;
+}
+
+static inline void mem_sampler_write(mem_sampler_t *s, uint64_t op, const mem_stats_t *st) {
+    // 内部碎片：交出去但调用者没要的部分
+    double internal = st->bytes_allocated ?
+        1.0 - (double)st->bytes_requested / st->bytes_allocated : 0.0;
+    // 外部碎片：空闲内存里有多少不在最大的那一块里
+    uint64_t free_bytes = st->bytes_reserved > st->bytes_allocated ?
+        st->bytes_reserved - st->bytes_allocated : 0;
+    double external = free_bytes ? 1.0 - (double)st->largest_free / free_bytes : 0.0;
+    if (external < 0) external = 0;
+
+    fprintf(s->fp, "%llu,%llu,%llu,%llu,%llu,%llu,%llu,%.4f,%.4f\n",
+            (unsigned long long)op,
+            (unsigned long long)((mem_now_ns() - s->start_ns) / 1000),
+            (unsigned long long)st->bytes_requested,
+            (unsigned long long)st->bytes_allocated,
+            (unsigned long long)st->bytes_reserved,
+            (unsigned long long)st->free_blocks,
+            (unsigned long long)st->largest_free,
+            internal, external);
+}
+
+static inline void mem_sampler_close(mem_sampler_t *s) {
+    if (s->fp) fclose(s->fp);
+    s->fp = NULL;
+}
+
+// ================= churn 负载 =================
+
+// 后端适配：free 额外带上 size，因为 bitmap_free 需要调用者记住页数
+typedef struct {
+    const char *name;
+    void *(*alloc)(size_t size);
+    void (*free)(void *ptr, size_t size);
+    void (*stats)(mem_stats_t *st);
+    size_t min_size;
+    size_t max_size;
+    void (*drain)(void); // 可选：全部释放后、最后一次采样前把缓存着的空页还回去 (空 slab、pcp 之类)
+} mem_backend_t;
+
+typedef struct {
+    void *ptr;
+    size_t size;
+} mem_live_t;
+
+static inline uint64_t mem_rand(uint64_t *state) {
+    // xorshift64*
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+// 尺寸按 log 均匀分布：小对象多，大对象少，接近真实负载
+static inline size_t mem_rand_size(uint64_t *state, size_t min, size_t max) {
+    int lo = 63 - __builtin_clzll(min);
+    int hi = 63 - __builtin_clzll(max);
+    int shift = lo + (int)(mem_rand(state) % (hi - lo + 1));
+    size_t base = (size_t)1 << shift;
+    size_t size = base + mem_rand(state) % base;
+    if (size < min) size = min;
+    if (size > max) size = max;
+    return size;
+}
+
+/**
+ * 随机混合 alloc/free，存活对象数在 max_live 附近波动
+ * 分配失败不算错误，记一次失败继续跑 (碎片曲线本身就是要看这个)
+ * @return 分配失败次数
+ */
+static inline uint64_t mem_churn_run(const mem_backend_t *b, uint64_t ops, int max_live,
+                                     mem_sampler_t *sampler) {
+    mem_live_t *live = calloc(max_live, sizeof(mem_live_t));
+    int nlive = 0;
+    uint64_t failures = 0;
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    mem_stats_t st;
+
+    for (uint64_t op = 0; op < ops; op++) {
+        // 存活越多越倾向释放，保持稳态
+        int do_alloc = nlive == 0 || (nlive < max_live && (int)(mem_rand(&seed) % max_live) >= nlive / 2);
+        if (do_alloc) {
+            size_t size = mem_rand_size(&seed, b->min_size, b->max_size);
+            void *p = b->alloc(size);
+            if (p) {
+                live[nlive].ptr = p;
+                live[nlive].size = size;
+                nlive++;
+            } else {
+                failures++;
+            }
+        } else {
+            int victim = (int)(mem_rand(&seed) % nlive);
+            b->free(live[victim].ptr, live[victim].size);
+            live[victim] = live[--nlive];
+        }
+
+        if (sampler && op % sampler->every == 0) {
+            b->stats(&st);
+            mem_sampler_write(sampler, op, &st);
+        }
+    }
+
+    for (int i = 0; i < nlive; i++) b->free(live[i].ptr, live[i].size);
+    if (b->drain) b->drain();
+    if (sampler) {
+        b->stats(&st);
+        mem_sampler_write(sampler, ops, &st);
+    }
+    free(live);
+    return failures;
+}
+
+// 各后端 main 里 "--csv <path>" 的公共处理
+static inline int mem_churn_main(const mem_backend_t *b, const char *path, uint64_t ops, int max_live) {
+    mem_sampler_t sampler;
+    if (mem_sampler_open(&sampler, path, ops / 1000) != 0) return 1;
+    uint64_t failures = mem_churn_run(b, ops, max_live, &sampler);
+    mem_sampler_close(&sampler);
+    printf("[Stats] %s churn: %llu ops, %llu failed allocs, timeline -> %s\n",
+           b->name, (unsigned long long)ops, (unsigned long long)failures, path);
+    return 0;
+}
+
+#endif // MEM_STATS_H
@@ -0,0 +1,399 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// 多进程共享的 bitmap 显存池
+// bitmap.c 的 g_bitmap / g_phys_base 都是进程内全局变量，多个推理进程没法共用一个设备池。
+// 这里把位图和池子本身都放进一块 shm_open 出来的共享内存：
+//   - 位图用原子 CAS 置位 / fetch_and 清位，多个进程直接分配，不需要中间 broker 进程转发
+//   - 每个进程 mmap 到的地址不同，所以对外只给“相对池子起点的偏移” (handle)，用时再换成本地指针
+
+// =================配置区域=================
+#define SHM_PAGE_SIZE   (2 * 1024 * 1024)       // 2MB (Huge Page)，和 bitmap.c 一致
+#define SHM_PAGE_COUNT  256                     // 512MB，4 个 64 位字，演示跨字的连续分配
+#define SHM_WORDS       ((SHM_PAGE_COUNT + 63) / 64)
+#define SHM_MAGIC       0x53484d42u             // "SHMB"
+#define SHM_VERSION     1
+
+// 数据区从第一个 2MB 开始，保证每一页在文件里都是 2MB 对齐的；
+// 头部只占第一页的开头几百字节，tmpfs 是稀疏的，不会真的吃掉 2MB
+#define SHM_DATA_OFFSET SHM_PAGE_SIZE
+#define SHM_MAP_SIZE    (SHM_DATA_OFFSET + (size_t)SHM_PAGE_COUNT * SHM_PAGE_SIZE)
+
+typedef uint64_t shm_handle_t;                  // 相对数据区起点的字节偏移
+#define SHM_HANDLE_NULL UINT64_MAX
+
+// =================共享内存布局=================
+
+// 放在共享内存里的头部：所有字段要么只在创建时写一次，要么是原子变量
+typedef struct {
+    _Atomic uint32_t magic;     // 创建者最后写入，attach 方看到它才认为初始化完成
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t page_count;
+    _Atomic uint64_t alloc_ops;
+    _Atomic uint64_t free_ops;
+    _Atomic uint64_t fail_ops;
+    _Atomic uint64_t cas_retries;  // CAS 冲突次数，反映进程间竞争程度
+    // 0 = 空闲, 1 = 占用，Bit i 对应 Page i
+    _Atomic uint64_t bitmap[SHM_WORDS];
+} shm_header_t;
+
+// 进程本地的句柄：各进程自己的 fd 和映射地址
+typedef struct {
+    int fd;
+    shm_header_t *hdr;
+    uint8_t *base;              // 数据区在本进程里的地址
+    char name[64];
+} shm_pool_t;
+
+_Static_assert(sizeof(shm_header_t) <= SHM_DATA_OFFSET, "header must fit before data");
+
+// =================创建 / 挂载=================
+
+static int shm_map(shm_pool_t *pool, int fd, const char *name) {
+    void *addr = mmap(NULL, SHM_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    pool->fd = fd;
+    pool->hdr = (shm_header_t *)addr;
+    pool->base = (uint8_t *)addr + SHM_DATA_OFFSET;
+    snprintf(pool->name, sizeof(pool->name), "%s", name);
+    return 0;
+}
+
+/**
+ * 创建共享池 (只能有一个创建者，O_EXCL 保证)
+ * @param name shm 名字，形如 "/vram_pool"
+ */
+int shm_pool_create(shm_pool_t *pool, const char *name) {
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        perror("shm_open(create)");
+        return -1;
+    }
+    if (ftruncate(fd, SHM_MAP_SIZE) != 0) {
+        perror("ftruncate");
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+    if (shm_map(pool, fd, name) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return -1;
+    }
+
+    // ftruncate 出来的内容全是 0，位图天然就是全空
+    shm_header_t *hdr = pool->hdr;
+    hdr->version = SHM_VERSION;
+    hdr->page_size = SHM_PAGE_SIZE;
+    hdr->page_count = SHM_PAGE_COUNT;
+    atomic_store_explicit(&hdr->magic, SHM_MAGIC, memory_order_release);
+
+    printf("[System] Created shared pool %s: %d MB, %d x 2MB pages, %d bitmap words\n",
+           name, SHM_PAGE_COUNT * 2, SHM_PAGE_COUNT, SHM_WORDS);
+    return 0;
+}
+
+/**
+ * 挂载已有的共享池 (其他进程调用)
+ */
+int shm_pool_attach(shm_pool_t *pool, const char *name) {
+    int fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) {
+        perror("shm_open(attach)");
+        return -1;
+    }
+    if (shm_map(pool, fd, name) != 0) {
+        close(fd);
+        return -1;
+    }
+
+    // 等创建者完成初始化
+    for (int spin = 0; atomic_load_explicit(&pool->hdr->magic, memory_order_acquire) != SHM_MAGIC; spin++) {
+        if (spin > 1000000) {
+            fprintf(stderr, "Error: shared pool %s never initialized\n", name);
+            return -1;
+        }
+    }
+    if (pool->hdr->version != SHM_VERSION || pool->hdr->page_size != SHM_PAGE_SIZE ||
+        pool->hdr->page_count != SHM_PAGE_COUNT) {
+        fprintf(stderr, "Error: shared pool %s layout mismatch\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+void shm_pool_detach(shm_pool_t *pool) {
+    munmap(pool->hdr, SHM_MAP_SIZE);
+    close(pool->fd);
+}
+
+void shm_pool_destroy(shm_pool_t *pool) {
+    shm_pool_detach(pool);
+    shm_unlink(pool->name);
+}
+
+// =================核心逻辑=================
+
+// 第 [start, start + n) 页落在 word w 里的掩码
+static inline uint64_t range_mask(int w, int start, int n) {
+    int lo = start > w * 64 ? start - w * 64 : 0;
+    int hi = start + n < (w + 1) * 64 ? start + n - w * 64 : 64;
+    uint64_t m = (hi == 64) ? ~0ULL : ((1ULL << hi) - 1);
+    return m & ~((1ULL << lo) - 1);
+}
+
+static inline bool page_busy(const uint64_t *snap, int i) {
+    return (snap[i / 64] >> (i % 64)) & 1;
+}
+
+/**
+ * 原子地占住 [start, start + n)：逐个 word 做 CAS，中途冲突就把已占的 word 退回去
+ * 退回期间别的进程可能短暂看到这几位被占，最多导致它多扫一轮，不会出错
+ */
+static bool try_claim(shm_header_t *hdr, int start, int n) {
+    int first = start / 64, last = (start + n - 1) / 64;
+    for (int w = first; w <= last; w++) {
+        uint64_t mask = range_mask(w, start, n);
+        uint64_t old = atomic_load_explicit(&hdr->bitmap[w], memory_order_relaxed);
+        for (;;) {
+            if (old & mask) {
+                // 被别人抢了：回滚前面已经占住的 word
+                for (int r = first; r < w; r++)
+                    atomic_fetch_and_explicit(&hdr->bitmap[r], ~range_mask(r, start, n), memory_order_release);
+                return false;
+            }
+            if (atomic_compare_exchange_weak_explicit(&hdr->bitmap[w], &old, old | mask,
+                                                      memory_order_acquire, memory_order_relaxed))
+                break;
+            atomic_fetch_add_explicit(&hdr->cas_retries, 1, memory_order_relaxed);
+        }
+    }
+    return true;
+}
+
+/**
+ * 分配 n 个连续的 2MB 页
+ * @return 数据区内的偏移 handle，失败返回 SHM_HANDLE_NULL
+ */
+shm_handle_t shm_alloc(shm_pool_t *pool, int num_pages) {
+    shm_header_t *hdr = pool->hdr;
+    if (num_pages <= 0 || num_pages > SHM_PAGE_COUNT) return SHM_HANDLE_NULL;
+
+    // 冲突时重新拍快照再找，重试次数有上限，防止极端竞争下活锁
+    for (int attempt = 0; attempt < 64; attempt++) {
+        uint64_t snap[SHM_WORDS];
+        for (int w = 0; w < SHM_WORDS; w++)
+            snap[w] = atomic_load_explicit(&hdr->bitmap[w], memory_order_relaxed);
+
+        // 在快照上 first fit
+        int run = 0, start = -1;
+        for (int i = 0; i < SHM_PAGE_COUNT; i++) {
+            if (page_busy(snap, i)) {
+                run = 0;
+                continue;
+            }
+            if (++run == num_pages) {
+                start = i - num_pages + 1;
+                break;
+            }
+        }
+        if (start < 0) break; // 快照里就没有足够的连续空间
+
+        if (try_claim(hdr, start, num_pages)) {
+            atomic_fetch_add_explicit(&hdr->alloc_ops, 1, memory_order_relaxed);
+            return (shm_handle_t)start * SHM_PAGE_SIZE;
+        }
+        atomic_fetch_add_explicit(&hdr->cas_retries, 1, memory_order_relaxed);
+    }
+
+    atomic_fetch_add_explicit(&hdr->fail_ops, 1, memory_order_relaxed);
+    return SHM_HANDLE_NULL;
+}
+
+/**
+ * 释放：任何进程都可以释放别的进程分配的 handle
+ * @param num_pages 必须和分配时一致 (和 bitmap_free 一样由上层记录)
+ */
+void shm_free(shm_pool_t *pool, shm_handle_t handle, int num_pages) {
+    shm_header_t *hdr = pool->hdr;
+    if (handle == SHM_HANDLE_NULL || num_pages <= 0) return;
+
+    int start = (int)(handle / SHM_PAGE_SIZE);
+    if (handle % SHM_PAGE_SIZE || start + num_pages > SHM_PAGE_COUNT) {
+        printf("[Free] Error: Invalid handle 0x%llx or size.\n", (unsigned long long)handle);
+        return;
+    }
+
+    for (int w = start / 64; w <= (start + num_pages - 1) / 64; w++) {
+        uint64_t mask = range_mask(w, start, num_pages);
+        uint64_t old = atomic_fetch_and_explicit(&hdr->bitmap[w], ~mask, memory_order_release);
+        if ((old & mask) != mask)
+            printf("[Free] Error: Double free in pages [%d, %d)\n", start, start + num_pages);
+    }
+    atomic_fetch_add_explicit(&hdr->free_ops, 1, memory_order_relaxed);
+}
+
+// handle -> 本进程地址
+static inline void *shm_ptr(shm_pool_t *pool, shm_handle_t handle) {
+    return handle == SHM_HANDLE_NULL ? NULL : pool->base + handle;
+}
+
+// 本进程地址 -> handle (用于把指针交给别的进程)
+static inline shm_handle_t shm_handle(shm_pool_t *pool, void *ptr) {
+    return ptr ? (shm_handle_t)((uint8_t *)ptr - pool->base) : SHM_HANDLE_NULL;
+}
+
+// 调试工具：打印位图状态
+void shm_dump(shm_pool_t *pool) {
+    printf("Map: ");
+    for (int i = 0; i < SHM_PAGE_COUNT; i++) {
+        uint64_t w = atomic_load_explicit(&pool->hdr->bitmap[i / 64], memory_order_relaxed);
+        printf("%lu", (w >> (i % 64)) & 1);
+        if (i % 64 == 63 && i != SHM_PAGE_COUNT - 1) printf("\n     ");
+    }
+    printf("\n");
+}
+
+// =================多进程测试=================
+
+#define NUM_WORKERS     4
+#define WORKER_ITERS    200000
+#define WORKER_LIVE     12      // 每个进程同时持有的分配数
+
+typedef struct {
+    shm_handle_t h;
+    int pages;
+    uint64_t stamp;
+} live_alloc_t;
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// 子进程：独立 attach (映射地址和父进程不同)，反复分配/写入/校验/释放
+// 每一页开头写入 (pid, 序号)，释放前检查没被别的进程改写，以此验证不会重复分配
+static int worker(const char *name, int id) {
+    shm_pool_t pool;
+    if (shm_pool_attach(&pool, name) != 0) return 2;
+
+    live_alloc_t live[WORKER_LIVE];
+    int nlive = 0, errors = 0;
+    uint64_t seed = 0x9E3779B97F4A7C15ULL * (id + 1);
+
+    for (int it = 0; it < WORKER_ITERS; it++) {
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+
+        if (nlive < WORKER_LIVE && (seed & 1)) {
+            int pages = 1 + (int)((seed >> 8) % 8);
+            shm_handle_t h = shm_alloc(&pool, pages);
+            if (h == SHM_HANDLE_NULL) continue;
+            uint64_t stamp = ((uint64_t)getpid() << 32) | (uint32_t)it;
+            for (int p = 0; p < pages; p++)
+                *(volatile uint64_t *)shm_ptr(&pool, h + (uint64_t)p * SHM_PAGE_SIZE) = stamp;
+            live[nlive++] = (live_alloc_t){h, pages, stamp};
+        } else if (nlive > 0) {
+            int v = (int)((seed >> 16) % nlive);
+            for (int p = 0; p < live[v].pages; p++) {
+                if (*(volatile uint64_t *)shm_ptr(&pool, live[v].h + (uint64_t)p * SHM_PAGE_SIZE) != live[v].stamp)
+                    errors++;
+            }
+            shm_free(&pool, live[v].h, live[v].pages);
+            live[v] = live[--nlive];
+        }
+    }
+    while (nlive > 0) {
+        nlive--;
+        shm_free(&pool, live[nlive].h, live[nlive].pages);
+    }
+    shm_pool_detach(&pool);
+    return errors ? 1 : 0;
+}
+
+int main() {
+    char name[64];
+    snprintf(name, sizeof(name), "/shm_bitmap_%d", getpid());
+
+    shm_pool_t pool;
+    if (shm_pool_create(&pool, name) != 0) return 1;
+
+    // 1. 跨进程传递 handle：父进程分配并写入，子进程用 handle 读出
+    printf("\n--- Handle passing between processes ---\n");
+    shm_handle_t h = shm_alloc(&pool, 3);
+    strcpy(shm_ptr(&pool, h), "weights from parent");
+    printf("Parent: handle 0x%llx -> local %p\n", (unsigned long long)h, shm_ptr(&pool, h));
+
+    fflush(stdout); // fork 之前清空缓冲，避免子进程重复输出
+    pid_t pid = fork();
+    if (pid == 0) {
+        shm_pool_t child;
+        if (shm_pool_attach(&child, name) != 0) _exit(1);
+        printf("Child:  handle 0x%llx -> local %p, reads \"%s\"\n",
+               (unsigned long long)h, shm_ptr(&child, h), (char *)shm_ptr(&child, h));
+        // 子进程释放父进程的分配
+        shm_free(&child, h, 3);
+        shm_pool_detach(&child);
+        fflush(stdout);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+    shm_dump(&pool);
+
+    // 2. 跨 word 的大块分配 (100 页 = 跨越 word 0/1)
+    printf("\n--- Allocating 100 pages (spans bitmap words) ---\n");
+    shm_handle_t big = shm_alloc(&pool, 100);
+    printf("Got handle 0x%llx (page %llu)\n", (unsigned long long)big,
+           (unsigned long long)(big / SHM_PAGE_SIZE));
+    shm_dump(&pool);
+    shm_free(&pool, big, 100);
+
+    // 3. 多进程并发压力测试
+    printf("\n--- %d worker processes x %d ops ---\n", NUM_WORKERS, WORKER_ITERS);
+    fflush(stdout);
+    uint64_t t0 = now_ns();
+    pid_t pids[NUM_WORKERS];
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        pids[i] = fork();
+        if (pids[i] == 0) _exit(worker(name, i));
+    }
+    int failed = 0;
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        int status;
+        waitpid(pids[i], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) failed++;
+    }
+    uint64_t dt = now_ns() - t0;
+
+    shm_header_t *hdr = pool.hdr;
+    uint64_t allocs = atomic_load(&hdr->alloc_ops);
+    uint64_t frees = atomic_load(&hdr->free_ops);
+    printf("allocs %llu, frees %llu, failed allocs %llu, CAS retries %llu\n",
+           (unsigned long long)allocs, (unsigned long long)frees,
+           (unsigned long long)atomic_load(&hdr->fail_ops),
+           (unsigned long long)atomic_load(&hdr->cas_retries));
+    printf("%.1f ns per alloc+free across all processes\n", (double)dt / (allocs ? allocs : 1));
+    printf("Workers with stamp corruption or attach errors: %d\n", failed);
+
+    bool empty = true;
+    for (int w = 0; w < SHM_WORDS; w++)
+        if (atomic_load(&hdr->bitmap[w])) empty = false;
+    printf("Pool empty after all workers exit: %s\n", empty ? "yes" : "NO");
+
+    shm_pool_destroy(&pool);
+    return (failed || !empty) ? 1 : 0;
+}
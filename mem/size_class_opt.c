@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+
+// 根据实际负载推导 slab 尺寸分级
+// slub.c 的 kmalloc-8..1024 和 linux_buddy_slub.c 的 slab_sizes[] (32..2048) 都是拍脑袋定的。
+// 这个工具读入尺寸直方图或分配 trace，用动态规划求出 N 个 size class，
+// 使内部碎片 (sum(count * (class - size))) 最小，并输出 linux_buddy_slub.c 可以在 init 时加载的表。
+//
+// 用法: size_class_opt [-n 类别数] [-o 输出表文件] [trace 文件]
+// 输入每行一条: "<size>" (trace，一次分配) 或 "<size> <count>" (直方图)，'#' 开头为注释。
+// 不给文件时使用内置的模拟负载演示。
+
+// ================= 配置区域 =================
+#define CLASS_ALIGN     8       // class 必须 8 字节对齐 (freelist 指针放在对象头部)
+#define MAX_CLASSES     32      // 与 linux_buddy_slub.c 的 SLAB_INDEX_MAX 一致
+#define MAX_OBJ_SIZE    4096    // 超过一页的请求走 buddy，不参与 slab 分级
+
+// ================= 数据结构 =================
+
+typedef struct {
+    uint32_t size;   // 已按 CLASS_ALIGN 向上取整
+    uint64_t count;
+} bucket_t;
+
+// 直方图：下标 = size / CLASS_ALIGN
+static uint64_t g_hist[MAX_OBJ_SIZE / CLASS_ALIGN + 1];
+static uint64_t g_ignored = 0; // 超过 MAX_OBJ_SIZE 的请求数
+
+// ================= 输入 =================
+
+static void hist_add(uint64_t size, uint64_t count) {
+    if (size == 0) return;
+    if (size > MAX_OBJ_SIZE) {
+        g_ignored += count;
+        return;
+    }
+    g_hist[(size + CLASS_ALIGN - 1) / CLASS_ALIGN] += count;
+}
+
+static int hist_load(const char *path) {
+    FILE *fp = fopen(path, "r");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+
+    char line[256];
+    int lineno = 0;
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+        char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#' || *p == '\n' || *p == '\0') continue;
+
+        unsigned long long size, count = 1;
+        int n = sscanf(p, "%llu %llu", &size, &count);
+        if (n < 1) {
+            fprintf(stderr, "%s:%d: cannot parse '%s'\n", path, lineno, p);
+            fclose(fp);
+            return -1;
+        }
+        hist_add(size, count);
+    }
+    fclose(fp);
+    return 0;
+}
+
+// 内置演示负载：几种典型的内核对象尺寸 + 少量长尾
+static void hist_demo() {
+    hist_add(24, 50000);    // 小链表节点
+    hist_add(40, 20000);
+    hist_add(72, 30000);    // 某种 hash 表项
+    hist_add(96, 8000);
+    hist_add(200, 12000);   // inode-like
+    hist_add(232, 6000);
+    hist_add(400, 3000);
+    hist_add(700, 2500);
+    hist_add(1536, 4000);   // 连接结构体
+    hist_add(1800, 500);
+    for (int s = 8; s <= 2048; s += 8) hist_add(s, 10); // 长尾
+}
+
+// ================= 动态规划 =================
+
+// 把直方图压成有序的非空桶数组，返回桶数
+static int collect_buckets(bucket_t *out) {
+    int m = 0;
+    for (uint32_t i = 1; i <= MAX_OBJ_SIZE / CLASS_ALIGN; i++) {
+        if (g_hist[i]) {
+            out[m].size = i * CLASS_ALIGN;
+            out[m].count = g_hist[i];
+            m++;
+        }
+    }
+    return m;
+}
+
+/**
+ * 求最优分级
+ * 最优解中每个 class 一定恰好等于某个出现过的尺寸 (否则可以往下收缩而不增加碎片)，
+ * 所以只需在 m 个不同尺寸里选 n 个，最大的那个必须选。
+ *
+ * 前缀和 C[j] = sum(count)，S[j] = sum(count * size)
+ * 把桶 (i, j] 都放进 class = size[j] 的代价：
+ *   cost(i, j) = size[j] * (C[j] - C[i]) - (S[j] - S[i])
+ * dp[k][j] = 用 k 个 class 覆盖前 j 个桶的最小碎片 = min_i dp[k-1][i] + cost(i, j)
+ * 复杂度 O(n * m^2)，m 最多 MAX_OBJ_SIZE / 8 = 512。
+ *
+ * @return 实际选出的 class 数 (可能 < n，当不同尺寸不足 n 个时)
+ */
+static int optimize_classes(const bucket_t *b, int m, int n, uint32_t *classes, uint64_t *waste) {
+    if (n > m) n = m;
+
+    uint64_t *C = calloc(m + 1, sizeof(uint64_t));
+    uint64_t *S = calloc(m + 1, sizeof(uint64_t));
+    for (int j = 1; j <= m; j++) {
+        C[j] = C[j - 1] + b[j - 1].count;
+        S[j] = S[j - 1] + b[j - 1].count * b[j - 1].size;
+    }
+
+    // dp 与回溯表，行 k = 0..n，列 j = 0..m
+    uint64_t *dp = malloc((size_t)(n + 1) * (m + 1) * sizeof(uint64_t));
+    int *from = malloc((size_t)(n + 1) * (m + 1) * sizeof(int));
+#define DP(k, j)   dp[(size_t)(k) * (m + 1) + (j)]
+#define FROM(k, j) from[(size_t)(k) * (m + 1) + (j)]
+
+    for (int j = 0; j <= m; j++) DP(0, j) = (j == 0) ? 0 : UINT64_MAX;
+    for (int k = 1; k <= n; k++) {
+        DP(k, 0) = 0;
+        for (int j = 1; j <= m; j++) {
+            uint64_t best = UINT64_MAX;
+            int arg = 0;
+            for (int i = k - 1; i < j; i++) {
+                if (DP(k - 1, i) == UINT64_MAX) continue;
+                uint64_t cost = (uint64_t)b[j - 1].size * (C[j] - C[i]) - (S[j] - S[i]);
+                uint64_t v = DP(k - 1, i) + cost;
+                if (v < best) {
+                    best = v;
+                    arg = i;
+                }
+            }
+            DP(k, j) = best;
+            FROM(k, j) = arg;
+        }
+    }
+
+    // 回溯：从 (n, m) 往回找每个 class 的右端点
+    int j = m;
+    for (int k = n; k >= 1; k--) {
+        classes[k - 1] = b[j - 1].size;
+        j = FROM(k, j);
+    }
+    *waste = DP(n, m);
+
+#undef DP
+#undef FROM
+    free(C);
+    free(S);
+    free(dp);
+    free(from);
+    return n;
+}
+
+// 给定一组 class，计算这份负载下的内部碎片 (用于和现有固定分级对比)
+static uint64_t eval_classes(const bucket_t *b, int m, const uint32_t *classes, int n, uint64_t *overflow) {
+    uint64_t waste = 0;
+    *overflow = 0;
+    for (int i = 0; i < m; i++) {
+        int c = 0;
+        while (c < n && classes[c] < b[i].size) c++;
+        if (c == n) {
+            *overflow += b[i].count; // 放不进任何 class
+            continue;
+        }
+        waste += b[i].count * (classes[c] - b[i].size);
+    }
+    return waste;
+}
+
+// ================= 输出 =================
+
+static void report(const char *name, const bucket_t *b, int m, const uint32_t *classes, int n, uint64_t total_bytes) {
+    uint64_t overflow;
+    uint64_t waste = eval_classes(b, m, classes, n, &overflow);
+    printf("  %-30s waste %10llu B (%5.2f%%)", name,
+           (unsigned long long)waste, total_bytes ? 100.0 * waste / total_bytes : 0.0);
+    if (overflow) printf("  [%llu allocs exceed largest class]", (unsigned long long)overflow);
+    printf("\n");
+}
+
+// 表文件格式：每行一个 class 尺寸，linux_buddy_slub.c 的 slab_sizes_load() 读这个格式
+static int write_table(const char *path, const uint32_t *classes, int n) {
+    FILE *fp = fopen(path, "w");
+    if (!fp) {
+        perror(path);
+        return -1;
+    }
+    fprintf(fp, "# slab size classes generated by size_class_opt\n");
+    for (int i = 0; i < n; i++) fprintf(fp, "%u\n", classes[i]);
+    fclose(fp);
+    return 0;
+}
+
+// ================= 主函数 =================
+
+int main(int argc, char **argv) {
+    int n = 7; // 和 linux_buddy_slub.c 默认的 slab_index_count 一致
+    const char *out_path = NULL;
+    const char *in_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+            n = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+            out_path = argv[++i];
+        } else if (argv[i][0] == '-') {
+            fprintf(stderr, "Usage: %s [-n classes] [-o table] [trace]\n", argv[0]);
+            return 1;
+        } else {
+            in_path = argv[i];
+        }
+    }
+    if (n < 1 || n > MAX_CLASSES) {
+        fprintf(stderr, "Error: class count must be 1..%d\n", MAX_CLASSES);
+        return 1;
+    }
+
+    if (in_path) {
+        if (hist_load(in_path) != 0) return 1;
+    } else {
+        printf("[Demo] No trace given, using built-in synthetic workload.\n");
+        hist_demo();
+    }
+
+    static bucket_t buckets[MAX_OBJ_SIZE / CLASS_ALIGN];
+    int m = collect_buckets(buckets);
+    if (m == 0) {
+        fprintf(stderr, "Error: no allocations <= %d bytes in input.\n", MAX_OBJ_SIZE);
+        return 1;
+    }
+
+    uint64_t total_allocs = 0, total_bytes = 0;
+    for (int i = 0; i < m; i++) {
+        total_allocs += buckets[i].count;
+        total_bytes += buckets[i].count * buckets[i].size;
+    }
+    printf("[Input] %llu allocs, %d distinct sizes, %llu requested bytes (8B aligned)",
+           (unsigned long long)total_allocs, m, (unsigned long long)total_bytes);
+    if (g_ignored) printf(", %llu allocs > %dB ignored", (unsigned long long)g_ignored, MAX_OBJ_SIZE);
+    printf("\n");
+
+    uint32_t classes[MAX_CLASSES];
+    uint64_t waste;
+    n = optimize_classes(buckets, m, n, classes, &waste);
+
+    printf("\n[Result] %d optimal classes:", n);
+    for (int i = 0; i < n; i++) printf(" %u", classes[i]);
+    printf("\n\n[Compare] Internal fragmentation on this workload:\n");
+
+    // slub.c: kmalloc-8 .. kmalloc-1024
+    uint32_t slub_classes[] = {8, 16, 32, 64, 128, 256, 512, 1024};
+    // linux_buddy_slub.c: slab_sizes[]
+    uint32_t lbs_classes[] = {32, 64, 128, 256, 512, 1024, 2048};
+    report("slub.c (8..1024)", buckets, m, slub_classes, 8, total_bytes);
+    report("linux_buddy_slub.c (32..2048)", buckets, m, lbs_classes, 7, total_bytes);
+    report("optimized", buckets, m, classes, n, total_bytes);
+
+    // 可以直接粘贴进源码的形式
+    printf("\nint slab_index_count = %d;\n", n);
+    printf("uint32_t slab_sizes[SLAB_INDEX_MAX] = {");
+    for (int i = 0; i < n; i++) printf("%s%u", i ? ", " : "", classes[i]);
+    printf("};\n");
+
+    if (out_path) {
+        if (write_table(out_path, classes, n) != 0) return 1;
+        printf("\n[Output] Table written to %s (load with: ./linux_buddy_slub %s)\n", out_path, out_path);
+    }
+    return 0;
+}
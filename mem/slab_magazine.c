@@ -0,0 +1,404 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+// Magazine / Depot 层 (Bonwick & Adams, "Magazines and Vmem", USENIX 2001)
+// slub.c / linux_buddy_slub.c 每次 alloc/free 都直接操作页上的 freelist：
+// 读写对象内部的 next 指针 (指针追逐 + 碰对象所在的 cache line)，多线程时还要为整个 cache 加锁。
+// 这里在 kmem_cache 前面加一层：
+//   - 每个 CPU 两个 magazine (loaded / previous)，magazine 就是一个定长的对象指针数组，
+//     alloc/free 只是数组 pop/push，不碰对象内存，也不加锁
+//   - 两个都空 (alloc) 或都满 (free) 时，才加锁去全局 depot 换一个满的 / 空的 magazine
+//   - depot 也没有满 magazine 时才落到底下的 slab 层
+// 生产者/消费者模式下 (A 线程分配、B 线程释放)，B 攒满的 magazine 经 depot 整个交给 A，
+// 一次加锁搬 MAG_ROUNDS 个对象。
+//
+// 这里用线程模拟 CPU：线程 i 固定用 cpu[i]，没有抢占迁移的问题，所以 per-CPU 部分不加锁。
+
+// ================= 配置 =================
+#define PAGE_SIZE       4096
+#define MEM_SIZE        (64 * 1024 * 1024)
+#define NR_CPUS         4
+#define MAG_ROUNDS      32      // 每个 magazine 能装的对象数
+
+// ================= 底层：slab (同 slub.c 的 freelist 模型，整体一把锁) =================
+
+typedef struct page {
+    void *freelist;         // 页内第一个空闲对象，对象前 8 字节存下一个
+    int inuse;
+    int objects;
+    struct page *next;      // partial 链表
+    bool on_partial;
+} page_t;
+
+static uint8_t *g_phys_mem_base;
+static page_t *g_mem_map;
+static int g_allocated_pages = 0; // 同 slub.c 的 alloc_pages：从堆顶往上切
+
+static page_t *virt_to_page(void *addr) {
+    return &g_mem_map[((uint8_t *)addr - g_phys_mem_base) / PAGE_SIZE];
+}
+
+// ================= magazine / depot =================
+
+typedef struct magazine {
+    struct magazine *next;  // 挂在 depot 链表上时用
+    int rounds;             // 当前装了几个对象
+    void *objs[MAG_ROUNDS];
+} magazine_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    magazine_t *full;
+    magazine_t *empty;
+    int nr_full;
+    int nr_empty;
+} depot_t;
+
+// 每个 CPU 一份，按 cache line 对齐避免 false sharing
+typedef struct {
+    magazine_t *loaded;
+    magazine_t *previous;
+    uint64_t mag_hits;      // 直接在 loaded / previous 上完成
+    uint64_t depot_trips;   // 去 depot 换 magazine
+    uint64_t slab_calls;    // 落到 slab 层
+} __attribute__((aligned(64))) cpu_mag_t;
+
+typedef struct kmem_cache {
+    const char *name;
+    int size;
+    pthread_mutex_t lock;   // 保护 slab 层
+    page_t *cpu_slab;
+    page_t *partial;
+    bool use_magazines;
+    cpu_mag_t cpu[NR_CPUS];
+    depot_t depot;
+} kmem_cache_t;
+
+static __thread int g_cpu = 0; // 当前线程扮演的 CPU
+
+// ================= slab 层 =================
+
+static page_t *new_slab(kmem_cache_t *s) {
+    if ((g_allocated_pages + 1) * PAGE_SIZE > MEM_SIZE) return NULL;
+    uint8_t *start = g_phys_mem_base + (uint64_t)g_allocated_pages * PAGE_SIZE;
+    page_t *page = &g_mem_map[g_allocated_pages++];
+
+    page->objects = PAGE_SIZE / s->size;
+    page->inuse = 0;
+    page->next = NULL;
+    page->on_partial = false;
+    for (int i = 0; i < page->objects - 1; i++) {
+        *(void **)(start + i * s->size) = start + (i + 1) * s->size;
+    }
+    *(void **)(start + (page->objects - 1) * s->size) = NULL;
+    page->freelist = start;
+    return page;
+}
+
+void *slab_alloc(kmem_cache_t *s) {
+    pthread_mutex_lock(&s->lock);
+    page_t *page = s->cpu_slab;
+    if (!page || !page->freelist) {
+        // 先用 partial 上的页，没有再要新页
+        if (s->partial) {
+            page = s->partial;
+            s->partial = page->next;
+            page->on_partial = false;
+        } else {
+            page = new_slab(s);
+            if (!page) {
+                pthread_mutex_unlock(&s->lock);
+                return NULL;
+            }
+        }
+        s->cpu_slab = page;
+    }
+    void *obj = page->freelist;
+    page->freelist = *(void **)obj;
+    page->inuse++;
+    pthread_mutex_unlock(&s->lock);
+    return obj;
+}
+
+void slab_free(kmem_cache_t *s, void *obj) {
+    pthread_mutex_lock(&s->lock);
+    page_t *page = virt_to_page(obj);
+    *(void **)obj = page->freelist;
+    page->freelist = obj;
+    page->inuse--;
+    // 满页重新有了空位，挂回 partial
+    if (page != s->cpu_slab && !page->on_partial) {
+        page->on_partial = true;
+        page->next = s->partial;
+        s->partial = page;
+    }
+    pthread_mutex_unlock(&s->lock);
+}
+
+// ================= depot =================
+
+static magazine_t *depot_get(depot_t *d, bool want_full) {
+    pthread_mutex_lock(&d->lock);
+    magazine_t **list = want_full ? &d->full : &d->empty;
+    magazine_t *m = *list;
+    if (m) {
+        *list = m->next;
+        if (want_full) d->nr_full--;
+        else d->nr_empty--;
+    }
+    pthread_mutex_unlock(&d->lock);
+    return m;
+}
+
+static void depot_put(depot_t *d, magazine_t *m) {
+    pthread_mutex_lock(&d->lock);
+    if (m->rounds == MAG_ROUNDS) {
+        m->next = d->full;
+        d->full = m;
+        d->nr_full++;
+    } else {
+        m->next = d->empty;
+        d->empty = m;
+        d->nr_empty++;
+    }
+    pthread_mutex_unlock(&d->lock);
+}
+
+// ================= 对外接口 =================
+
+kmem_cache_t *kmem_cache_create(const char *name, int size, bool use_magazines) {
+    kmem_cache_t *s = calloc(1, sizeof(kmem_cache_t));
+    s->name = name;
+    s->size = size < (int)sizeof(void *) ? (int)sizeof(void *) : size;
+    s->use_magazines = use_magazines;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_mutex_init(&s->depot.lock, NULL);
+    for (int i = 0; i < NR_CPUS && use_magazines; i++) {
+        s->cpu[i].loaded = calloc(1, sizeof(magazine_t));
+        s->cpu[i].previous = calloc(1, sizeof(magazine_t));
+    }
+    return s;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *s) {
+    if (!s->use_magazines) return slab_alloc(s);
+
+    cpu_mag_t *c = &s->cpu[g_cpu];
+    for (;;) {
+        // 1. loaded 里有就直接 pop
+        if (c->loaded->rounds > 0) {
+            c->mag_hits++;
+            return c->loaded->objs[--c->loaded->rounds];
+        }
+        // 2. previous 里有：交换一下
+        if (c->previous->rounds > 0) {
+            magazine_t *t = c->loaded;
+            c->loaded = c->previous;
+            c->previous = t;
+            continue;
+        }
+        // 3. 两个都空：把 previous 作为空 magazine 还给 depot，换一个满的回来
+        magazine_t *full = depot_get(&s->depot, true);
+        if (!full) break;
+        c->depot_trips++;
+        depot_put(&s->depot, c->previous);
+        c->previous = c->loaded;
+        c->loaded = full;
+    }
+    // 4. depot 也没有：直接找 slab 层要一个
+    c->slab_calls++;
+    return slab_alloc(s);
+}
+
+void kmem_cache_free(kmem_cache_t *s, void *obj) {
+    if (!s->use_magazines) {
+        slab_free(s, obj);
+        return;
+    }
+
+    cpu_mag_t *c = &s->cpu[g_cpu];
+    for (;;) {
+        // 1. loaded 还有空位就直接 push
+        if (c->loaded->rounds < MAG_ROUNDS) {
+            c->mag_hits++;
+            c->loaded->objs[c->loaded->rounds++] = obj;
+            return;
+        }
+        // 2. previous 是空的：交换
+        if (c->previous->rounds == 0) {
+            magazine_t *t = c->loaded;
+            c->loaded = c->previous;
+            c->previous = t;
+            continue;
+        }
+        // 3. 两个都满：满的 previous 交给 depot，拿一个空的 (没有就新建)
+        magazine_t *empty = depot_get(&s->depot, false);
+        if (!empty) empty = calloc(1, sizeof(magazine_t));
+        if (!empty) break;
+        c->depot_trips++;
+        depot_put(&s->depot, c->previous);
+        c->previous = c->loaded;
+        c->loaded = empty;
+    }
+    // 连 magazine 都分不出来：直接还给 slab 层
+    c->slab_calls++;
+    slab_free(s, obj);
+}
+
+// 把所有 magazine 里的对象还给 slab 层 (内存紧张时的回收，也用来检查有没有丢对象)
+void kmem_cache_drain(kmem_cache_t *s) {
+    if (!s->use_magazines) return;
+    for (int i = 0; i < NR_CPUS; i++) {
+        magazine_t *ms[2] = {s->cpu[i].loaded, s->cpu[i].previous};
+        for (int k = 0; k < 2; k++) {
+            while (ms[k]->rounds) slab_free(s, ms[k]->objs[--ms[k]->rounds]);
+        }
+    }
+    magazine_t *m;
+    while ((m = depot_get(&s->depot, true))) {
+        while (m->rounds) slab_free(s, m->objs[--m->rounds]);
+        free(m);
+    }
+    while ((m = depot_get(&s->depot, false))) free(m);
+}
+
+// 统计 slab 层还有多少对象在外面 (drain 之后应该是 0)
+static int slab_inuse() {
+    int n = 0;
+    for (int i = 0; i < g_allocated_pages; i++) n += g_mem_map[i].inuse;
+    return n;
+}
+
+// ================= benchmark =================
+
+#define OPS_PER_THREAD  2000000
+#define BATCH           64
+#define RING_SIZE       1024
+
+// 单生产者单消费者环形队列，把对象从分配线程递给释放线程
+typedef struct {
+    _Atomic uint64_t head __attribute__((aligned(64)));
+    _Atomic uint64_t tail __attribute__((aligned(64)));
+    void *slots[RING_SIZE];
+} ring_t;
+
+typedef struct {
+    kmem_cache_t *cache;
+    int cpu;
+    ring_t *ring;   // NULL = 本地模式 (自己分配自己释放)
+    bool producer;
+} worker_t;
+
+static void ring_push(ring_t *r, void *p) {
+    uint64_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    while (t - atomic_load_explicit(&r->head, memory_order_acquire) == RING_SIZE) sched_yield();
+    r->slots[t % RING_SIZE] = p;
+    atomic_store_explicit(&r->tail, t + 1, memory_order_release);
+}
+
+static void *ring_pop(ring_t *r) {
+    uint64_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    while (atomic_load_explicit(&r->tail, memory_order_acquire) == h) sched_yield();
+    void *p = r->slots[h % RING_SIZE];
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+    return p;
+}
+
+static void *worker(void *arg) {
+    worker_t *w = arg;
+    g_cpu = w->cpu;
+    void *batch[BATCH];
+
+    if (!w->ring) {
+        for (int op = 0; op < OPS_PER_THREAD; op += BATCH) {
+            for (int i = 0; i < BATCH; i++) batch[i] = kmem_cache_alloc(w->cache);
+            for (int i = 0; i < BATCH; i++) kmem_cache_free(w->cache, batch[i]);
+        }
+    } else if (w->producer) {
+        for (int op = 0; op < OPS_PER_THREAD; op++) {
+            uint64_t *obj = kmem_cache_alloc(w->cache);
+            if (!obj) {
+                fprintf(stderr, "OOM\n");
+                exit(1);
+            }
+            obj[1] = op; // 模拟写入
+            ring_push(w->ring, obj);
+        }
+    } else {
+        for (int op = 0; op < OPS_PER_THREAD; op++) kmem_cache_free(w->cache, ring_pop(w->ring));
+    }
+    return NULL;
+}
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// cross = true：cpu 0/2 分配，cpu 1/3 释放；false：每个 cpu 自己分配自己释放
+static void bench(const char *label, bool use_magazines, bool cross) {
+    kmem_cache_t *s = kmem_cache_create("bench-64", 64, use_magazines);
+    pthread_t th[NR_CPUS];
+    worker_t w[NR_CPUS];
+    ring_t *rings = aligned_alloc(64, sizeof(ring_t) * (NR_CPUS / 2));
+    memset(rings, 0, sizeof(ring_t) * (NR_CPUS / 2));
+
+    double t0 = now_sec();
+    for (int i = 0; i < NR_CPUS; i++) {
+        w[i] = (worker_t){s, i, cross ? &rings[i / 2] : NULL, i % 2 == 0};
+        pthread_create(&th[i], NULL, worker, &w[i]);
+    }
+    for (int i = 0; i < NR_CPUS; i++) pthread_join(th[i], NULL);
+    double dt = now_sec() - t0;
+
+    // 本地模式每个线程做 OPS 次 alloc + OPS 次 free；交叉模式每对线程合计 OPS 次 alloc + OPS 次 free
+    double ops = cross ? (double)OPS_PER_THREAD * NR_CPUS : 2.0 * OPS_PER_THREAD * NR_CPUS;
+    uint64_t hits = 0, trips = 0, slab = 0;
+    for (int i = 0; i < NR_CPUS; i++) {
+        hits += s->cpu[i].mag_hits;
+        trips += s->cpu[i].depot_trips;
+        slab += s->cpu[i].slab_calls;
+    }
+    printf("  %-22s %6.1f ns/op", label, dt * 1e9 / ops);
+    if (use_magazines)
+        printf("  (magazine %.2f%%, depot trips %llu, slab calls %llu)", 100.0 * hits / ops,
+               (unsigned long long)trips, (unsigned long long)slab);
+    kmem_cache_drain(s);
+    printf("%s\n", slab_inuse() ? "  LEAK" : "");
+    free(rings);
+}
+
+// ================= 测试主函数 =================
+
+int main() {
+    g_phys_mem_base = aligned_alloc(PAGE_SIZE, MEM_SIZE);
+    g_mem_map = calloc(MEM_SIZE / PAGE_SIZE, sizeof(page_t));
+    printf("[System] %d CPUs (threads), magazine rounds %d, 64-byte objects\n", NR_CPUS, MAG_ROUNDS);
+
+    // 1. 基本行为：magazine 是 LIFO，刚释放的对象马上被拿回来
+    kmem_cache_t *c = kmem_cache_create("demo", 48, true);
+    void *a = kmem_cache_alloc(c);
+    kmem_cache_free(c, a);
+    void *b = kmem_cache_alloc(c);
+    printf("alloc %p, free, alloc again %p (%s)\n", a, b, a == b ? "same object from magazine" : "different");
+    kmem_cache_free(c, b);
+    kmem_cache_drain(c);
+
+    printf("\n--- Local: each thread allocs %d then frees them ---\n", BATCH);
+    bench("slab freelist (locked)", false, false);
+    bench("magazine + depot", true, false);
+
+    printf("\n--- Cross-thread: cpu 0/2 alloc, cpu 1/3 free (producer/consumer) ---\n");
+    bench("slab freelist (locked)", false, true);
+    bench("magazine + depot", true, true);
+    return 0;
+}
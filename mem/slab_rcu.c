@@ -0,0 +1,578 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+// RCU 风格的延迟释放 (epoch-based reclamation) + SLAB_TYPESAFE_BY_RCU
+// slub.c 只有 kmem_cache_free：无锁读者可能还拿着对象指针，立刻释放就是 use-after-free，
+// 不释放就是泄漏。这里补上中间那一档：
+//   1. call_rcu / kmem_cache_free_rcu：对象先挂在当前线程的延迟链表上，记下当时的全局 epoch，
+//      等所有读者都离开那个 epoch (全局 epoch 前进两次) 之后再批量还给 cache
+//   2. SLAB_TYPESAFE_BY_RCU：对象可以立刻被释放和复用 (读者必须自己校验拿到的是不是想要的对象)，
+//      但 slab 页在 grace period 之后才还给页分配器。读者手里的指针永远指向"同一种类型"的对象，
+//      不会变成别的 cache 的数据或者被 poison 的内存 (同内核的语义)
+//
+// epoch 机制 (Fraser 的 EBR)：
+//   - 每个线程注册一个记录，rcu_read_lock 时把当前全局 epoch 写进去，rcu_read_unlock 时清掉
+//   - 所有正在读的线程都已经看到当前 epoch 时，全局 epoch 才能 +1
+//   - 在 epoch e 被摘掉的对象，等全局 epoch >= e + 2 时不可能还有读者拿着它
+
+// ================= 配置 =================
+#define PAGE_SIZE       4096
+#define MEM_SIZE        (64 * 1024 * 1024)
+#define MAX_THREADS     16
+#define RCU_BATCH       128     // 每个线程攒多少个回调尝试一次回收
+#define POISON_FREE     0x6b    // 页还给页分配器时填充 (同内核 POISON_FREE)
+
+// ================= epoch / RCU =================
+
+typedef struct {
+    void *ptr;
+    void (*func)(void *ptr, void *arg);
+    void *arg;
+    uint64_t epoch;
+} rcu_cb_t;
+
+typedef struct {
+    _Atomic uint64_t state;     // 0 = 不在读临界区，否则 (epoch << 1) | 1
+    bool used;
+    int nest;                   // rcu_read_lock 嵌套层数，只有自己访问
+    rcu_cb_t *cbs;              // 延迟回调，按 epoch 递增排列
+    int nr_cbs;
+    int cap_cbs;
+    bool in_reclaim;            // 回调里再 call_rcu 时不能嵌套回收
+    uint64_t invoked;
+} __attribute__((aligned(64))) rcu_thread_t;
+
+static rcu_thread_t g_rcu_threads[MAX_THREADS];
+static pthread_mutex_t g_rcu_register_lock = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic uint64_t g_epoch = 1;
+static __thread rcu_thread_t *t_rcu = NULL;
+
+void rcu_register_thread() {
+    pthread_mutex_lock(&g_rcu_register_lock);
+    for (int i = 0; i < MAX_THREADS; i++) {
+        if (g_rcu_threads[i].used) continue;
+        memset(&g_rcu_threads[i], 0, sizeof(rcu_thread_t));
+        g_rcu_threads[i].used = true;
+        t_rcu = &g_rcu_threads[i];
+        break;
+    }
+    pthread_mutex_unlock(&g_rcu_register_lock);
+    if (!t_rcu) {
+        fprintf(stderr, "Fatal: too many RCU threads\n");
+        exit(1);
+    }
+}
+
+static inline void rcu_read_lock() {
+    if (t_rcu->nest++ == 0) {
+        uint64_t e = atomic_load(&g_epoch);
+        atomic_store(&t_rcu->state, (e << 1) | 1); // seq_cst：之后的读不会被重排到它前面
+    }
+}
+
+static inline void rcu_read_unlock() {
+    if (--t_rcu->nest == 0) atomic_store_explicit(&t_rcu->state, 0, memory_order_release);
+}
+
+// 所有在读的线程都已经看到当前 epoch，才能前进一步
+static bool rcu_try_advance() {
+    uint64_t e = atomic_load(&g_epoch);
+    for (int i = 0; i < MAX_THREADS; i++) {
+        if (!g_rcu_threads[i].used) continue;
+        uint64_t s = atomic_load(&g_rcu_threads[i].state);
+        if ((s & 1) && (s >> 1) != e) return false;
+    }
+    return atomic_compare_exchange_strong(&g_epoch, &e, e + 1);
+}
+
+// 执行当前线程里已经过了 grace period 的回调
+// 回调可能再调 call_rcu (TYPESAFE cache 的 kmem_cache_free_rcu -> kmem_cache_free -> call_rcu(page))：
+// 新回调追加在末尾，epoch 是当前的，不会在这一轮被执行；cbs 可能被 realloc，所以每次都重新取下标
+void rcu_reclaim() {
+    if (t_rcu->in_reclaim) return;
+    t_rcu->in_reclaim = true;
+    rcu_try_advance();
+    uint64_t e = atomic_load(&g_epoch);
+    int i = 0;
+    while (i < t_rcu->nr_cbs && t_rcu->cbs[i].epoch + 2 <= e) {
+        rcu_cb_t cb = t_rcu->cbs[i++];
+        cb.func(cb.ptr, cb.arg);
+    }
+    t_rcu->invoked += i;
+    memmove(t_rcu->cbs, t_rcu->cbs + i, (t_rcu->nr_cbs - i) * sizeof(rcu_cb_t));
+    t_rcu->nr_cbs -= i;
+    t_rcu->in_reclaim = false;
+}
+
+/**
+ * 登记一个 grace period 之后执行的回调
+ * 只追加，攒够 RCU_BATCH 个才尝试回收，不在临界区里调也没问题
+ */
+void call_rcu(void *ptr, void (*func)(void *ptr, void *arg), void *arg) {
+    if (t_rcu->nr_cbs == t_rcu->cap_cbs) {
+        t_rcu->cap_cbs = t_rcu->cap_cbs ? t_rcu->cap_cbs * 2 : RCU_BATCH * 2;
+        t_rcu->cbs = realloc(t_rcu->cbs, t_rcu->cap_cbs * sizeof(rcu_cb_t));
+    }
+    t_rcu->cbs[t_rcu->nr_cbs++] = (rcu_cb_t){ptr, func, arg, atomic_load(&g_epoch)};
+    if (t_rcu->nr_cbs >= RCU_BATCH && t_rcu->nest == 0) rcu_reclaim();
+}
+
+// 阻塞等到现在之前开始的读者全部结束 (不能在读临界区里调)
+void synchronize_rcu() {
+    uint64_t target = atomic_load(&g_epoch) + 2;
+    while (atomic_load(&g_epoch) < target) {
+        if (!rcu_try_advance()) sched_yield();
+    }
+}
+
+// 线程退出前：等 grace period，把自己的回调全部执行完
+void rcu_unregister_thread() {
+    synchronize_rcu();
+    rcu_reclaim();
+    free(t_rcu->cbs);
+    pthread_mutex_lock(&g_rcu_register_lock);
+    t_rcu->used = false;
+    pthread_mutex_unlock(&g_rcu_register_lock);
+    t_rcu = NULL;
+}
+
+// ================= 页分配器 =================
+
+typedef struct page {
+    void *freelist;
+    int inuse;
+    int objects;
+    struct kmem_cache *cache;
+    struct page *next;          // partial 链表 / 空闲页栈
+    struct page *prev;
+    bool on_partial;
+} page_t;
+
+static uint8_t *g_phys_mem_base;
+static page_t *g_mem_map;
+static page_t *g_free_pages;    // 空闲页栈
+static pthread_mutex_t g_page_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline void *page_address(page_t *page) {
+    return g_phys_mem_base + (uint64_t)(page - g_mem_map) * PAGE_SIZE;
+}
+
+static inline page_t *virt_to_page(void *addr) {
+    return &g_mem_map[((uint8_t *)addr - g_phys_mem_base) / PAGE_SIZE];
+}
+
+void page_alloc_init() {
+    g_phys_mem_base = aligned_alloc(PAGE_SIZE, MEM_SIZE);
+    g_mem_map = calloc(MEM_SIZE / PAGE_SIZE, sizeof(page_t));
+    for (int i = MEM_SIZE / PAGE_SIZE - 1; i >= 0; i--) {
+        g_mem_map[i].next = g_free_pages;
+        g_free_pages = &g_mem_map[i];
+    }
+}
+
+static page_t *get_free_page() {
+    pthread_mutex_lock(&g_page_lock);
+    page_t *page = g_free_pages;
+    if (page) g_free_pages = page->next;
+    pthread_mutex_unlock(&g_page_lock);
+    return page;
+}
+
+// 还给页分配器：填 poison，之后谁再读这页都会看到 0x6b
+static void put_free_page(page_t *page) {
+    memset(page_address(page), POISON_FREE, PAGE_SIZE);
+    page->cache = NULL;
+    pthread_mutex_lock(&g_page_lock);
+    page->next = g_free_pages;
+    g_free_pages = page;
+    pthread_mutex_unlock(&g_page_lock);
+}
+
+// ================= slab cache =================
+
+#define SLAB_TYPESAFE_BY_RCU 0x1
+
+typedef struct kmem_cache {
+    const char *name;
+    int object_size;
+    int size;
+    int offset;                 // freelist 指针在对象里的偏移
+    unsigned int flags;
+    pthread_mutex_t lock;
+    page_t *partial;            // 还有空闲对象的页 (含全空的页)
+    uint64_t pages_released;
+    uint64_t pages_deferred;
+} kmem_cache_t;
+
+kmem_cache_t *kmem_cache_create(const char *name, int size, unsigned int flags) {
+    kmem_cache_t *s = calloc(1, sizeof(kmem_cache_t));
+    s->name = name;
+    s->flags = flags;
+    s->object_size = size;
+    size = (size + 7) & ~7;
+    if (flags & SLAB_TYPESAFE_BY_RCU) {
+        // 读者可能在对象被释放后还在读它，freelist 指针不能覆盖对象内容，放到对象后面
+        s->offset = size;
+        s->size = size + sizeof(void *);
+    } else {
+        s->offset = 0;
+        s->size = size < (int)sizeof(void *) ? (int)sizeof(void *) : size;
+    }
+    pthread_mutex_init(&s->lock, NULL);
+    return s;
+}
+
+static inline void *get_freepointer(kmem_cache_t *s, void *obj) {
+    return *(void **)((uint8_t *)obj + s->offset);
+}
+
+static inline void set_freepointer(kmem_cache_t *s, void *obj, void *next) {
+    *(void **)((uint8_t *)obj + s->offset) = next;
+}
+
+static void partial_add(kmem_cache_t *s, page_t *page) {
+    page->prev = NULL;
+    page->next = s->partial;
+    if (s->partial) s->partial->prev = page;
+    s->partial = page;
+    page->on_partial = true;
+}
+
+static void partial_remove(kmem_cache_t *s, page_t *page) {
+    if (page->prev) page->prev->next = page->next;
+    else s->partial = page->next;
+    if (page->next) page->next->prev = page->prev;
+    page->on_partial = false;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *s) {
+    pthread_mutex_lock(&s->lock);
+    page_t *page = s->partial;
+    if (!page) {
+        page = get_free_page();
+        if (!page) {
+            pthread_mutex_unlock(&s->lock);
+            return NULL;
+        }
+        uint8_t *start = page_address(page);
+        page->objects = PAGE_SIZE / s->size;
+        page->inuse = 0;
+        page->cache = s;
+        for (int i = 0; i < page->objects; i++) {
+            set_freepointer(s, start + i * s->size, i + 1 < page->objects ? start + (i + 1) * s->size : NULL);
+        }
+        page->freelist = start;
+        partial_add(s, page);
+    }
+
+    void *obj = page->freelist;
+    page->freelist = get_freepointer(s, obj);
+    page->inuse++;
+    if (!page->freelist) partial_remove(s, page);
+    pthread_mutex_unlock(&s->lock);
+    return obj;
+}
+
+static void rcu_free_page(void *ptr, void *arg) {
+    put_free_page(ptr);
+}
+
+// 立即释放。slab 空了就把页还回去；TYPESAFE_BY_RCU 的 cache 要等一个 grace period
+void kmem_cache_free(kmem_cache_t *s, void *obj) {
+    page_t *page = virt_to_page(obj);
+    page_t *release = NULL;
+
+    pthread_mutex_lock(&s->lock);
+    set_freepointer(s, obj, page->freelist);
+    page->freelist = obj;
+    page->inuse--;
+    if (!page->on_partial) partial_add(s, page);
+    // 空页还回去，但留一个给下次分配，避免单个对象反复申请/释放整页
+    if (page->inuse == 0 && (page->next || page->prev)) {
+        partial_remove(s, page);
+        release = page;
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    if (!release) return;
+    if (s->flags & SLAB_TYPESAFE_BY_RCU) {
+        s->pages_deferred++;
+        call_rcu(release, rcu_free_page, NULL);
+    } else {
+        s->pages_released++;
+        put_free_page(release);
+    }
+}
+
+static void rcu_free_object(void *ptr, void *arg) {
+    kmem_cache_free(arg, ptr);
+}
+
+// 延迟释放：grace period 之后才真正还给 cache，读者在此之前看到的内容不变
+void kmem_cache_free_rcu(kmem_cache_t *s, void *obj) {
+    call_rcu(obj, rcu_free_object, s);
+}
+
+// ================= benchmark：读多写少的并发哈希表 =================
+
+#define NBUCKETS        1024
+#define NKEYS           4096
+#define NR_READERS      3
+#define RUN_MS          400
+#define MAX_CHAIN       64      // 类型安全模式下读者可能被复用的节点带到别的链上，走太远就重来
+
+enum { MODE_RWLOCK, MODE_RCU_DEFER, MODE_TYPESAFE };
+static const char *g_mode_name[] = {"rwlock + free", "RCU + kmem_cache_free_rcu", "TYPESAFE_BY_RCU + free"};
+
+// value = key * 1000000 + version，读者用它校验拿到的节点确实属于这个 key
+typedef struct node {
+    _Atomic uint64_t key;
+    _Atomic uint64_t value;
+    _Atomic(struct node *) next;
+} node_t;
+
+static _Atomic(node_t *) g_buckets[NBUCKETS];
+static pthread_rwlock_t g_rwlock = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t g_writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static kmem_cache_t *g_node_cache;
+static int g_mode;
+static _Atomic bool g_stop;
+
+typedef struct {
+    uint64_t ops;
+    uint64_t retries;   // 类型安全模式下校验失败重来的次数
+    uint64_t errors;    // 读到了不属于这个 key 的值 (除类型安全模式的重试外都应该是 0)
+} __attribute__((aligned(64))) stat_t;
+
+static bool lookup_once(uint64_t key, uint64_t *out) {
+    node_t *n = atomic_load_explicit(&g_buckets[key % NBUCKETS], memory_order_acquire);
+    for (int steps = 0; n && steps < MAX_CHAIN; steps++) {
+        if (atomic_load_explicit(&n->key, memory_order_acquire) == key) {
+            *out = atomic_load_explicit(&n->value, memory_order_acquire);
+            return true;
+        }
+        n = atomic_load_explicit(&n->next, memory_order_acquire);
+    }
+    return false;
+}
+
+static void *reader(void *arg) {
+    stat_t *st = arg;
+    rcu_register_thread();
+    uint64_t seed = (uintptr_t)arg | 1;
+    while (!atomic_load_explicit(&g_stop, memory_order_relaxed)) {
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        uint64_t key = seed % NKEYS, v = 0;
+
+        if (g_mode == MODE_RWLOCK) {
+            pthread_rwlock_rdlock(&g_rwlock);
+            bool found = lookup_once(key, &v);
+            pthread_rwlock_unlock(&g_rwlock);
+            if (!found || v / 1000000 != key) st->errors++;
+        } else {
+            rcu_read_lock();
+            for (;;) {
+                bool found = lookup_once(key, &v);
+                if (found && v / 1000000 == key) break;
+                // 节点被复用 (只有类型安全模式会发生)：内存还是 node_t，只是换了主人，重查一遍
+                if (g_mode == MODE_TYPESAFE) {
+                    st->retries++;
+                    continue;
+                }
+                st->errors++;
+                break;
+            }
+            rcu_read_unlock();
+        }
+        st->ops++;
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+// 把 key 的节点换成一个新版本
+static void update(uint64_t key, uint64_t version) {
+    node_t *n = kmem_cache_alloc(g_node_cache);
+    // 先写 key 再写 value：读者先读 key 再读 value，再用 value 反查 key，能发现写到一半的节点
+    atomic_store_explicit(&n->key, key, memory_order_release);
+    atomic_store_explicit(&n->value, key * 1000000 + version % 1000000, memory_order_release);
+
+    if (g_mode == MODE_RWLOCK) pthread_rwlock_wrlock(&g_rwlock);
+    else pthread_mutex_lock(&g_writer_lock);
+
+    _Atomic(node_t *) *prev = &g_buckets[key % NBUCKETS];
+    node_t *old = atomic_load(prev);
+    while (atomic_load(&old->key) != key) {
+        prev = &old->next;
+        old = atomic_load(prev);
+    }
+    atomic_store_explicit(&n->next, atomic_load(&old->next), memory_order_relaxed);
+    atomic_store_explicit(prev, n, memory_order_release); // 发布
+
+    if (g_mode == MODE_RWLOCK) pthread_rwlock_unlock(&g_rwlock);
+    else pthread_mutex_unlock(&g_writer_lock);
+
+    if (g_mode == MODE_RCU_DEFER) kmem_cache_free_rcu(g_node_cache, old);
+    else kmem_cache_free(g_node_cache, old);
+}
+
+static void *writer(void *arg) {
+    stat_t *st = arg;
+    rcu_register_thread();
+    uint64_t seed = 0x2545F4914F6CDD1DULL;
+    while (!atomic_load_explicit(&g_stop, memory_order_relaxed)) {
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        update(seed % NKEYS, ++st->ops);
+        // 读多写少：写者每次更新之后让一下
+        if (st->ops % 16 == 0) sched_yield();
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void bench(int mode) {
+    g_mode = mode;
+    g_node_cache = kmem_cache_create("hash_node", sizeof(node_t),
+                                     mode == MODE_TYPESAFE ? SLAB_TYPESAFE_BY_RCU : 0);
+    for (uint64_t k = 0; k < NKEYS; k++) {
+        node_t *n = kmem_cache_alloc(g_node_cache);
+        atomic_store(&n->key, k);
+        atomic_store(&n->value, k * 1000000);
+        atomic_store(&n->next, atomic_load(&g_buckets[k % NBUCKETS]));
+        atomic_store(&g_buckets[k % NBUCKETS], n);
+    }
+
+    stat_t st[NR_READERS + 1];
+    memset(st, 0, sizeof(st));
+    pthread_t th[NR_READERS + 1];
+    atomic_store(&g_stop, false);
+    for (int i = 0; i < NR_READERS; i++) pthread_create(&th[i], NULL, reader, &st[i]);
+    pthread_create(&th[NR_READERS], NULL, writer, &st[NR_READERS]);
+
+    struct timespec ts = {0, RUN_MS * 1000000L};
+    nanosleep(&ts, NULL);
+    atomic_store(&g_stop, true);
+    for (int i = 0; i <= NR_READERS; i++) pthread_join(th[i], NULL);
+
+    uint64_t reads = 0, retries = 0, errors = 0;
+    for (int i = 0; i < NR_READERS; i++) {
+        reads += st[i].ops;
+        retries += st[i].retries;
+        errors += st[i].errors;
+    }
+    printf("  %-27s %7.2f M lookups/s, %6.1f K updates/s, retries %llu, errors %llu\n",
+           g_mode_name[mode], reads / (RUN_MS * 1000.0), st[NR_READERS].ops / (double)RUN_MS,
+           (unsigned long long)retries, (unsigned long long)errors);
+
+    // 拆表：单线程，直接释放
+    for (int b = 0; b < NBUCKETS; b++) {
+        node_t *n = atomic_load(&g_buckets[b]);
+        while (n) {
+            node_t *next = atomic_load(&n->next);
+            kmem_cache_free(g_node_cache, n);
+            n = next;
+        }
+        atomic_store(&g_buckets[b], NULL);
+    }
+    synchronize_rcu();
+    rcu_reclaim();
+}
+
+// ================= 测试主函数 =================
+
+typedef struct {
+    uint64_t magic;
+    char payload[56];
+} conn_t;
+
+int main() {
+    page_alloc_init();
+    rcu_register_thread();
+
+    // 1. 普通 cache：slab 空了页立刻还回去并被 poison，还拿着指针的读者读到垃圾
+    printf("--- Plain cache: page released immediately ---\n");
+    kmem_cache_t *plain = kmem_cache_create("conn", sizeof(conn_t), 0);
+    conn_t *keep = kmem_cache_alloc(plain);          // 占住第一页，让下一页可以被还回去
+    static conn_t *fill[PAGE_SIZE / sizeof(conn_t)];
+    int per_page = PAGE_SIZE / plain->size;
+    for (int i = 0; i < per_page; i++) fill[i] = kmem_cache_alloc(plain);
+    conn_t *victim = fill[per_page - 1];             // 第二页上的对象
+    victim->magic = 0xC0FFEE;
+    conn_t *reader_ref = victim;                     // 假装一个无锁读者还拿着它
+    for (int i = 0; i < per_page; i++) kmem_cache_free(plain, fill[i]);
+    printf("reader sees magic 0x%llx after free (%s), pages released %llu\n",
+           (unsigned long long)reader_ref->magic,
+           reader_ref->magic == 0xC0FFEE ? "intact" : "poisoned: use-after-free",
+           (unsigned long long)plain->pages_released);
+
+    // 2. TYPESAFE_BY_RCU：对象立刻回到 freelist，但页要等 grace period
+    printf("\n--- SLAB_TYPESAFE_BY_RCU: page deferred ---\n");
+    kmem_cache_t *safe = kmem_cache_create("conn_rcu", sizeof(conn_t), SLAB_TYPESAFE_BY_RCU);
+    printf("object %d bytes, slab stride %d (free pointer at offset %d, outside the object)\n",
+           safe->object_size, safe->size, safe->offset);
+    per_page = PAGE_SIZE / safe->size;
+    kmem_cache_alloc(safe);
+    for (int i = 0; i < per_page; i++) fill[i] = kmem_cache_alloc(safe);
+    victim = fill[per_page - 1];
+    victim->magic = 0xC0FFEE;
+    reader_ref = victim;
+    for (int i = 0; i < per_page; i++) kmem_cache_free(safe, fill[i]);
+    printf("reader sees magic 0x%llx after free (%s), pages deferred %llu, pending callbacks %d\n",
+           (unsigned long long)reader_ref->magic, reader_ref->magic == 0xC0FFEE ? "still a conn_t" : "poisoned",
+           (unsigned long long)safe->pages_deferred, t_rcu->nr_cbs);
+    synchronize_rcu();
+    rcu_reclaim();
+    printf("after synchronize_rcu: pending callbacks %d, page now %s\n", t_rcu->nr_cbs,
+           reader_ref->magic == 0xC0FFEE ? "intact" : "poisoned (returned to page allocator)");
+
+    // 3. kmem_cache_free_rcu：对象本身等 grace period
+    printf("\n--- kmem_cache_free_rcu ---\n");
+    conn_t *c = kmem_cache_alloc(plain);
+    c->magic = 0xBEEF;
+    kmem_cache_free_rcu(plain, c);
+    conn_t *next = kmem_cache_alloc(plain);
+    printf("free_rcu then alloc: got %s object, old contents 0x%llx\n",
+           next == c ? "the SAME" : "a different", (unsigned long long)c->magic);
+    kmem_cache_free(plain, next);
+    synchronize_rcu();
+    rcu_reclaim();
+    next = kmem_cache_alloc(plain);
+    printf("after grace period: alloc got %s object\n", next == c ? "the same" : "a different");
+    kmem_cache_free(plain, next);
+    kmem_cache_free(plain, keep);
+
+    // 4. TYPESAFE cache 上批量 free_rcu：回调里释放对象会把空页再 call_rcu 一次，不能触发嵌套回收
+    printf("\n--- kmem_cache_free_rcu on a SLAB_TYPESAFE_BY_RCU cache ---\n");
+    enum { NR_BATCH = 300 };
+    static conn_t *batch[NR_BATCH];
+    uint64_t invoked0 = t_rcu->invoked, deferred0 = safe->pages_deferred;
+    for (int i = 0; i < NR_BATCH; i++) batch[i] = kmem_cache_alloc(safe);
+    for (int i = 0; i < NR_BATCH; i++) {
+        kmem_cache_free_rcu(safe, batch[i]);
+        if (i % 64 == 63) synchronize_rcu();     // 让一部分回调在 call_rcu 里就到期
+    }
+    synchronize_rcu();
+    rcu_reclaim();
+    synchronize_rcu();
+    rcu_reclaim();
+    printf("%d objects freed via RCU: callbacks run %llu, pages deferred %llu, pending %d\n", NR_BATCH,
+           (unsigned long long)(t_rcu->invoked - invoked0),
+           (unsigned long long)(safe->pages_deferred - deferred0), t_rcu->nr_cbs);
+
+    // 5. 并发读多写少哈希表
+    printf("\n--- Hash table: %d keys, %d readers + 1 writer, %d ms each ---\n", NKEYS, NR_READERS, RUN_MS);
+    bench(MODE_RWLOCK);
+    bench(MODE_RCU_DEFER);
+    bench(MODE_TYPESAFE);
+
+    rcu_unregister_thread();
+    return 0;
+}
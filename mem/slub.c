@@ -3,6 +3,8 @@
 #include <stdint.h>
 #include <string.h>
 #include <stdbool.h>
+#include "mem_stats.h"
+#include "heap_profiler.h"
 
 // ================= 1. 内核基础设施模拟 =================
 
@@ -29,12 +31,22 @@ typedef struct page {
             short objects;       // 总对象数
             struct page *next;   // Partial 链表指针
             struct kmem_cache *slab_cache; // 指回它所属的 cache
+            short sampled;       // 页内被堆分析器采样的对象数，0 时 kfree 不用查表
+            struct page *first_page; // 多页 slab (order > 0) 的首页，首页指向自己 (compound_head)
         };
     };
 } struct_page;
 
 struct_page *g_mem_map; // 全局页描述符数组
 
+// 占用统计
+// kfree 不知道调用者当初要了多少字节，所以用一张影子表 (每 8 字节一项) 记下 kmalloc 的请求大小，
+// 只用于统计，不参与分配逻辑
+#define SHADOW_SHIFT 3
+mem_stats_t g_stats;
+uint16_t *g_req_shadow;
+bool g_verbose = true;    // churn 负载里关掉逐次打印
+
 // 辅助：虚拟地址转页描述符 (virt_to_page)
 struct_page *virt_to_page(void *addr) {
     unsigned long offset = (uint8_t *)addr - g_phys_mem_base;
@@ -42,35 +54,112 @@ struct_page *virt_to_page(void *addr) {
     return &g_mem_map[pfn];
 }
 
-// 模拟 Buddy：简单分配一页
+// 多页 slab 里的对象可能落在尾页上，free 时要找回首页 (virt_to_head_page)
+struct_page *virt_to_head_page(void *addr) {
+    return virt_to_page(addr)->first_page;
+}
+
+// 模拟 Buddy：分配 2^order 个连续页
 void *alloc_pages(int order) {
-    // 这里偷懒直接从堆顶切一页，模拟物理页分配
+    // 这里偷懒直接从堆顶切，模拟物理页分配
+    // 切到 MEM_SIZE 就是真正的 OOM，返回 NULL 交给调用方处理
     static int allocated_pages = 0;
+    if (allocated_pages + (1 << order) > MEM_SIZE / PAGE_SIZE) return NULL;
     void *addr = g_phys_mem_base + (allocated_pages * PAGE_SIZE);
-    allocated_pages++;
+    allocated_pages += 1 << order;
+    g_stats.bytes_reserved += PAGE_SIZE << order;
     return addr;
 }
 
 // ================= 2. SLUB 核心定义 =================
 
+// kmem_cache_create 的 flags
+#define SLAB_HWCACHE_ALIGN  0x1 // 对象按 cache line 对齐 (避免 false sharing)
+#define SLAB_NO_MERGE       0x2 // 不和别的 cache 合并 (需要单独统计 / 调试的 cache 用)
+
+#define CACHE_LINE_SIZE     64
+#define SLUB_MAX_ORDER      3   // slab 最多 8 页 (32KB)
+#define SLUB_MIN_OBJECTS    8   // 每个 slab 至少希望放下的对象数
+
+// 统计计数器 (同内核 CONFIG_SLUB_STATS 的 enum stat_item)
+enum stat_item {
+    ALLOC_FASTPATH,         // cpu_slab 的 freelist 上直接拿到
+    ALLOC_SLOWPATH,         // cpu_slab 空了，要换 slab
+    ALLOC_FROM_PARTIAL,     // 慢路径里从 partial 链表拿到 slab
+    ALLOC_SLAB,             // 慢路径里向 Buddy 要了新 slab
+    FREE_FASTPATH,          // 释放到 cpu_slab
+    FREE_SLOWPATH,          // 释放到其他 slab
+    FREE_ADD_PARTIAL,       // 满 slab 有了空位，挂上 partial 链表
+    NR_SLUB_STAT_ITEMS
+};
+
+// 计数器按 CPU 分开，各占一条 cache line，加的时候不用原子操作、不会互相弹 cache line；
+// 读的时候 (slabinfo) 再把所有 CPU 加起来
+#define NR_CPUS 4
+int g_current_cpu = 0; // 模拟 smp_processor_id()：这个模拟器是单线程的，由调用者切换
+
+static inline int smp_processor_id() {
+    return g_current_cpu;
+}
+
+typedef struct kmem_cache_cpu {
+    unsigned long stat[NR_SLUB_STAT_ITEMS];
+} __attribute__((aligned(CACHE_LINE_SIZE))) kmem_cache_cpu;
+
 // 定义 kmem_cache (比如 kmalloc-64 就是一个这样的结构体)
 typedef struct kmem_cache {
     const char *name;
-    int size;               // 对象大小 (如 64)
+    int size;               // 对象实际占用的大小 (对齐之后，如 64)
+    int object_size;        // 调用者要求的原始大小
+    int align;
+    unsigned int flags;
+    int order;              // 每个 slab 占 2^order 页
+    int objects;            // 每个 slab 的对象数
     int offset;             // Free pointer 的偏移量 (通常是 0)
     struct page *cpu_slab;  // 【核心】当前 CPU 正在使用的活跃 Slab
     struct page *partial;   // 部分空闲的 Slab 链表
+    int nr_slabs;           // 向 Buddy 要过的 slab 数 (这个模拟器不还页，只增不减)
+    int refcount;           // 被合并进来的 cache 个数 + 1
+    kmem_cache_cpu cpu_stats[NR_CPUS];
+    struct kmem_cache *next; // 全局 cache 链表 (slab_caches)，slabinfo 遍历用
 } kmem_cache;
 
+// 所有 cache 串成一条链表
+kmem_cache *g_slab_caches = NULL;
+
+// 被合并掉的 cache 只留一个名字 -> 实际 cache 的映射 (同内核 sysfs 里的 alias 链接)
+typedef struct slab_alias {
+    const char *name;
+    kmem_cache *target;
+    struct slab_alias *next;
+} slab_alias;
+slab_alias *g_slab_aliases = NULL;
+
+static inline void stat(kmem_cache *s, enum stat_item si) {
+    s->cpu_stats[smp_processor_id()].stat[si]++;
+}
+
+static unsigned long stat_sum(kmem_cache *s, enum stat_item si) {
+    unsigned long sum = 0;
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) sum += s->cpu_stats[cpu].stat[si];
+    return sum;
+}
+
 // ================= 3. SLUB 核心逻辑 =================
 
-// 初始化一个新的 Slab (从 Buddy 拿一页，建立 freelist)
+// 初始化一个新的 Slab (从 Buddy 拿 2^order 页，建立 freelist)
 static void setup_slab(kmem_cache *s, struct page *page) {
     void *start = g_phys_mem_base + ((page - g_mem_map) * PAGE_SIZE);
 
-    page->objects = PAGE_SIZE / s->size;
+    page->objects = s->objects;
     page->inuse = 0;
     page->slab_cache = s;
+    page->sampled = 0;
+
+    // 尾页只需要能找回首页
+    for (int i = 0; i < (1 << s->order); i++) {
+        page[i].first_page = page;
+    }
 
     // 【核心黑科技】构建对象内的单向链表
     // 每一个空闲对象的前 8 字节，存储下一个对象的地址
@@ -83,9 +172,10 @@ static void setup_slab(kmem_cache *s, struct page *page) {
     *(void **)p = NULL; // 最后一个指向 NULL
 
     page->freelist = start; // 页描述符指向第一个对象
+    g_stats.free_blocks += page->objects;
 
-    printf("[SLUB Debug] New Slab for %s: Page PFN %ld, Objs: %d\n",
-           s->name, page - g_mem_map, page->objects);
+    if (g_verbose) printf("[SLUB Debug] New Slab for %s: Page PFN %ld, Order %d, Objs: %d\n",
+           s->name, page - g_mem_map, s->order, page->objects);
 }
 
 // 分配对象
@@ -95,33 +185,43 @@ void *kmem_cache_alloc(kmem_cache *s) {
     // 1. Fast Path: 当前活跃 Slab 还有空间
     // 真实内核汇编里，这段非常短，甚至无锁
     if (page && page->freelist) {
-        void *object = page->freelist;
-
-        // 【核心操作】读取对象内部的指针，更新 freelist
-        void *next_object = *(void **)object;
-        page->freelist = next_object;
-
-        page->inuse++;
-        return object;
+        stat(s, ALLOC_FASTPATH);
+    } else {
+        // 2. Slow Path: 活跃 Slab 满了或为空
+        // 先从 partial 链表拿，没有再找 Buddy 要新页，设为 cpu_slab
+        // (满了的旧 cpu_slab 直接丢开，等它有对象被释放时再挂回 partial)
+        stat(s, ALLOC_SLOWPATH);
+        if (s->partial) {
+            page = s->partial;
+            s->partial = page->next;
+            stat(s, ALLOC_FROM_PARTIAL);
+        } else {
+            void *new_phys = alloc_pages(s->order);
+            if (!new_phys) return NULL; // Buddy 也没页了，不能拿 NULL 当 slab 用
+            page = virt_to_page(new_phys);
+            setup_slab(s, page);
+            s->nr_slabs++;
+            stat(s, ALLOC_SLAB);
+        }
+        s->cpu_slab = page;
     }
 
-    // 2. Slow Path: 活跃 Slab 满了或为空
-    // 尝试从 partial 链表拿，或者找 Buddy 要新页
-    // (为了代码简洁，这里直接要新页，并设为 cpu_slab)
-    void *new_phys = alloc_pages(0);
-    struct page *new_page = virt_to_page(new_phys);
-    setup_slab(s, new_page);
+    void *object = page->freelist;
 
-    s->cpu_slab = new_page;
+    // 【核心操作】读取对象内部的指针，更新 freelist
+    void *next_object = *(void **)object;
+    page->freelist = next_object;
 
-    // 递归调用一次 Fast Path
-    return kmem_cache_alloc(s);
+    page->inuse++;
+    g_stats.bytes_allocated += s->size;
+    g_stats.free_blocks--;
+    return object;
 }
 
 // 释放对象
 void kmem_cache_free(void *obj) {
-    // 1. 通过地址反查 struct page (virt_to_page)
-    struct page *page = virt_to_page(obj);
+    // 1. 通过地址反查 struct page (对象可能在多页 slab 的尾页上，取首页)
+    struct page *page = virt_to_head_page(obj);
     kmem_cache *s = page->slab_cache;
 
     // 2. 头插法放回 freelist
@@ -130,36 +230,157 @@ void kmem_cache_free(void *obj) {
     // 让 head 指向 obj
     page->freelist = obj;
 
+    // 3. 不是 cpu_slab：原来是满的 (不在任何链表上)，现在有空位了，挂回 partial
+    if (page == s->cpu_slab) {
+        stat(s, FREE_FASTPATH);
+    } else {
+        stat(s, FREE_SLOWPATH);
+        if (page->inuse == page->objects) {
+            page->next = s->partial;
+            s->partial = page;
+            stat(s, FREE_ADD_PARTIAL);
+        }
+    }
+
     page->inuse--;
+    g_stats.bytes_allocated -= s->size;
+    g_stats.free_blocks++;
+    g_stats.bytes_requested -= g_req_shadow[((uint8_t *)obj - g_phys_mem_base) >> SHADOW_SHIFT];
+    g_req_shadow[((uint8_t *)obj - g_phys_mem_base) >> SHADOW_SHIFT] = 0;
 
-    printf("[Free] Obj %p returned to %s (Inuse: %d)\n",
+    if (g_verbose) printf("[Free] Obj %p returned to %s (Inuse: %d)\n",
            obj, s->name, page->inuse);
 }
 
-// ================= 4. 模拟 kmalloc 体系 =================
+// ================= 4. 创建 cache =================
+
+/**
+ * 选 slab 的 order (同内核 calculate_order 的思路)
+ * 先要求每个 slab 至少 SLUB_MIN_OBJECTS 个对象，尾部浪费不超过 1/16，
+ * 找不到就把浪费放宽到 1/8、1/4，再不行就减少对象数要求
+ */
+static int calculate_order(int size) {
+    for (int min_objects = SLUB_MIN_OBJECTS; min_objects >= 1; min_objects /= 2) {
+        for (int fraction = 16; fraction >= 4; fraction /= 2) {
+            for (int order = 0; order <= SLUB_MAX_ORDER; order++) {
+                int slab_size = PAGE_SIZE << order;
+                if (slab_size / size < min_objects) continue;
+                if (slab_size % size <= slab_size / fraction) return order;
+            }
+        }
+    }
+    // 浪费怎样都压不下来：能放下一个对象就行
+    for (int order = 0; order <= SLUB_MAX_ORDER; order++) {
+        if ((PAGE_SIZE << order) >= size) return order;
+    }
+    return -1;
+}
+
+// 对齐：至少指针对齐 (freelist 指针存在对象里)；HWCACHE_ALIGN 时小对象不必占满一整条 cache line，
+// 能两个拼一条就按半条对齐 (同内核 calculate_alignment)
+static int calculate_alignment(unsigned int flags, int align, int size) {
+    if (flags & SLAB_HWCACHE_ALIGN) {
+        int ralign = CACHE_LINE_SIZE;
+        while (size <= ralign / 2) ralign /= 2;
+        if (ralign > align) align = ralign;
+    }
+    if (align < (int)sizeof(void *)) align = sizeof(void *);
+    return align;
+}
+
+// 把 cache 结构体填好 (kmalloc 的静态 cache 和 kmem_cache_create 共用)
+static int kmem_cache_open(kmem_cache *s, const char *name, int size, int align, unsigned int flags) {
+    memset(s, 0, sizeof(*s));
+    s->name = name;
+    s->object_size = size;
+    s->flags = flags;
+    s->align = calculate_alignment(flags, align, size);
+    s->size = (size + s->align - 1) & ~(s->align - 1);
+    s->offset = 0;
+    s->order = calculate_order(s->size);
+    if (s->order < 0) return -1;
+    s->objects = (PAGE_SIZE << s->order) / s->size;
+    s->refcount = 1;
+
+    // 挂到全局链表尾部，slabinfo 按创建顺序输出
+    kmem_cache **pp = &g_slab_caches;
+    while (*pp) pp = &(*pp)->next;
+    *pp = s;
+    return 0;
+}
+
+/**
+ * 找一个可以合并的现有 cache (同内核 find_mergeable)
+ * 对齐后的对象大小、对齐、flags 都相同才合并，任一方带 SLAB_NO_MERGE 都不合并
+ */
+static kmem_cache *find_mergeable(int size, int align, unsigned int flags) {
+    if (flags & SLAB_NO_MERGE) return NULL;
+    align = calculate_alignment(flags, align, size);
+    size = (size + align - 1) & ~(align - 1);
+    for (kmem_cache *s = g_slab_caches; s; s = s->next) {
+        if (s->flags & SLAB_NO_MERGE) continue;
+        if (s->size == size && s->align == align && s->flags == flags) return s;
+    }
+    return NULL;
+}
+
+/**
+ * 创建专用 cache
+ * 能和现有 cache 合并时直接返回那个 cache，它们共用 slab，不再各自攒一堆半空的页
+ * @param align 0 表示只要指针对齐，否则必须是 2 的幂
+ * @return 失败 (对象大于最大 slab 或 align 非法) 返回 NULL
+ */
+kmem_cache *kmem_cache_create(const char *name, int size, int align, unsigned int flags) {
+    if (size <= 0 || (align & (align - 1))) return NULL;
+
+    kmem_cache *m = find_mergeable(size, align, flags);
+    if (m) {
+        slab_alias *a = malloc(sizeof(slab_alias));
+        a->name = name;
+        a->target = m;
+        a->next = g_slab_aliases;
+        g_slab_aliases = a;
+        m->refcount++;
+        if (g_verbose) printf("[SLUB] %s (object %d) merged into %s\n", name, size, m->name);
+        return m;
+    }
+
+    kmem_cache *s = malloc(sizeof(kmem_cache));
+    if (kmem_cache_open(s, name, size, align, flags) != 0) {
+        printf("[SLUB] kmem_cache_create(%s): object size %d too large\n", name, size);
+        free(s);
+        return NULL;
+    }
+    if (g_verbose) printf("[SLUB] Created %s: object %d -> size %d (align %d), order %d, %d objs/slab\n",
+                          name, size, s->size, s->align, s->order, s->objects);
+    return s;
+}
+
+// ================= 5. 模拟 kmalloc 体系 =================
 
 // 内核里有一组预定义的 caches
 #define KMALLOC_SHIFT_LOW 3
-#define KMALLOC_SHIFT_HIGH 10 // 支持到 1024 字节
+#define KMALLOC_SHIFT_HIGH 13 // 支持到 8192 字节 (多页 slab)
 kmem_cache kmalloc_caches[KMALLOC_SHIFT_HIGH + 1];
 
-// 初始化 kmalloc-8, kmalloc-16, kmalloc-32 ... kmalloc-1024
+// 初始化 kmalloc-8, kmalloc-16, kmalloc-32 ... kmalloc-8192
 void kmem_cache_init() {
-    // 申请大块内存作为物理内存
-    g_phys_mem_base = malloc(MEM_SIZE);
+    // 申请大块内存作为物理内存 (按页对齐，对象的对齐才有意义)
+    g_phys_mem_base = aligned_alloc(PAGE_SIZE, MEM_SIZE);
     // 申请页描述符数组
     g_mem_map = malloc((MEM_SIZE / PAGE_SIZE) * sizeof(struct_page));
     memset(g_mem_map, 0, (MEM_SIZE / PAGE_SIZE) * sizeof(struct_page));
+    g_req_shadow = calloc(MEM_SIZE >> SHADOW_SHIFT, sizeof(uint16_t));
+    memset(&g_stats, 0, sizeof(g_stats));
 
     // 创建通用缓存
-    for (int i = 3; i <= KMALLOC_SHIFT_HIGH; i++) {
+    for (int i = KMALLOC_SHIFT_LOW; i <= KMALLOC_SHIFT_HIGH; i++) {
         int size = 1 << i; // 8, 16, 32, 64...
-        kmalloc_caches[i].size = size;
-        kmalloc_caches[i].offset = 0;
 
         // 名字 trick (简单处理)
-        kmalloc_caches[i].name = malloc(32);
-        sprintf((char*)kmalloc_caches[i].name, "kmalloc-%d", size);
+        char *name = malloc(32);
+        sprintf(name, "kmalloc-%d", size);
+        kmem_cache_open(&kmalloc_caches[i], name, size, 0, 0);
     }
     printf("SLUB initialized. RAM Base: %p\n", g_phys_mem_base);
 }
@@ -168,28 +389,190 @@ void kmem_cache_init() {
 void *kmalloc(size_t size) {
     // 1. 找到合适的桶 (Index)
     // 简单算法：找到比 size 大的最小的 2^n
-    int index = 0;
-    if (size <= 8) index = 3;
-    else if (size <= 16) index = 4;
-    else if (size <= 32) index = 5;
-    else if (size <= 64) index = 6;
-    else if (size <= 128) index = 7;
-    // ... 省略更大
-    else index = 10; // 默认最大演示到 1024
+    if (size > (1 << KMALLOC_SHIFT_HIGH)) return NULL;
+    int index = KMALLOC_SHIFT_LOW;
+    while ((1UL << index) < size) index++;
 
     // 2. 委托给对应的 SLUB Cache
-    printf("[kmalloc] Request %zu bytes -> using %s\n", size, kmalloc_caches[index].name);
-    return kmem_cache_alloc(&kmalloc_caches[index]);
+    if (g_verbose) printf("[kmalloc] Request %zu bytes -> using %s\n", size, kmalloc_caches[index].name);
+    void *obj = kmem_cache_alloc(&kmalloc_caches[index]);
+    if (!obj) return NULL;
+    g_req_shadow[((uint8_t *)obj - g_phys_mem_base) >> SHADOW_SHIFT] = (uint16_t)size;
+    g_stats.bytes_requested += size;
+
+    // 采样分析：没采中时只是一次减法
+    if (heapprof_should_sample(size) && heapprof_record_alloc(obj, size)) {
+        virt_to_head_page(obj)->sampled++;
+    }
+    return obj;
 }
 
 void kfree(void *obj) {
+    struct page *page = virt_to_head_page(obj);
+    if (page->sampled && heapprof_record_free(obj)) page->sampled--;
     kmem_cache_free(obj);
 }
 
-// ================= 5. 测试主程序 =================
+// 统计快照：free_blocks 是所有 slab 里的空闲对象数，
+// largest_free 是活跃 slab 还有空闲对象的最大 cache 尺寸 (不用新页就能满足的最大请求)
+void slub_stats(mem_stats_t *st) {
+    *st = g_stats;
+    st->largest_free = 0;
+    for (int i = KMALLOC_SHIFT_HIGH; i >= KMALLOC_SHIFT_LOW; i--) {
+        struct page *page = kmalloc_caches[i].cpu_slab;
+        if (page && page->freelist) {
+            st->largest_free = kmalloc_caches[i].size;
+            break;
+        }
+    }
+}
+
+/**
+ * 仿 /proc/slabinfo：每个用过的 cache 一行
+ * active_objs = 累计分配 - 累计释放；fast% 低、new_slab 多说明 cache 在来回抖
+ */
+void slabinfo_show() {
+    printf("# name            <active_objs> <num_objs> <objsize> <objperslab> <pagesperslab>"
+           " : slabdata <num_slabs> <pages> : stats <fast%%> <alloc_slow> <from_partial> <new_slab>"
+           " <free_slow> <add_partial>\n");
+    for (kmem_cache *s = g_slab_caches; s; s = s->next) {
+        if (!s->nr_slabs) continue;
+        unsigned long alloc_fast = stat_sum(s, ALLOC_FASTPATH);
+        unsigned long alloc_slow = stat_sum(s, ALLOC_SLOWPATH);
+        unsigned long frees = stat_sum(s, FREE_FASTPATH) + stat_sum(s, FREE_SLOWPATH);
+        printf("%-17s %13lu %10d %9d %12d %14d : slabdata %11d %7d : stats %5.1f%% %12lu %14lu %10lu %11lu %13lu\n",
+               s->name, alloc_fast + alloc_slow - frees, s->nr_slabs * s->objects, s->size,
+               s->objects, 1 << s->order, s->nr_slabs, s->nr_slabs << s->order,
+               100.0 * alloc_fast / (alloc_fast + alloc_slow), alloc_slow,
+               stat_sum(s, ALLOC_FROM_PARTIAL), stat_sum(s, ALLOC_SLAB),
+               stat_sum(s, FREE_SLOWPATH), stat_sum(s, FREE_ADD_PARTIAL));
+    }
+    for (slab_alias *a = g_slab_aliases; a; a = a->next) {
+        printf("  alias %s -> %s\n", a->name, a->target->name);
+    }
+}
+
+// ================= 6. mempool：保底预留 =================
+// I/O 路径 (比如写回脏页) 本身就是为了腾内存，它自己要是因为 OOM 分配失败就死锁了。
+// mempool 在内存充足时预先从 cache 里拿 min_nr 个对象攒着，平时完全不碰，
+// 只有 kmem_cache_alloc 返回 NULL 时才从预留里取；free 时优先把预留补满。
+// 只要每个请求最终都会释放，在途请求数不超过 min_nr 就一定能往前走。
+
+typedef struct mempool {
+    int min_nr;             // 预留目标个数
+    int curr_nr;            // 当前预留里有几个
+    void **elements;        // 预留对象栈
+    kmem_cache *cache;
+    unsigned long nr_from_reserve; // 统计：走了几次预留
+} mempool_t;
+
+/**
+ * 建池并立刻预分配 min_nr 个对象
+ * 预分配失败说明现在就没内存了，预留没有意义，返回 NULL
+ */
+mempool_t *mempool_create(int min_nr, kmem_cache *cache) {
+    mempool_t *pool = calloc(1, sizeof(mempool_t));
+    pool->elements = malloc(min_nr * sizeof(void *));
+    pool->min_nr = min_nr;
+    pool->cache = cache;
+    while (pool->curr_nr < min_nr) {
+        void *obj = kmem_cache_alloc(cache);
+        if (!obj) {
+            while (pool->curr_nr) kmem_cache_free(pool->elements[--pool->curr_nr]);
+            free(pool->elements);
+            free(pool);
+            return NULL;
+        }
+        pool->elements[pool->curr_nr++] = obj;
+    }
+    return pool;
+}
+
+/**
+ * 先走正常路径，失败才动预留
+ * 内核里预留也空了会睡在 pool->wait 上等 mempool_free 唤醒；这里单线程没法等，直接返回 NULL
+ */
+void *mempool_alloc(mempool_t *pool) {
+    void *obj = kmem_cache_alloc(pool->cache);
+    if (obj) return obj;
+    if (!pool->curr_nr) return NULL;
+    pool->nr_from_reserve++;
+    return pool->elements[--pool->curr_nr];
+}
+
+/**
+ * 预留不满就先补预留，满了才还给 cache
+ * 平时预留一直是满的，这里只多一次比较
+ */
+void mempool_free(void *obj, mempool_t *pool) {
+    if (pool->curr_nr < pool->min_nr) {
+        pool->elements[pool->curr_nr++] = obj;
+        return;
+    }
+    kmem_cache_free(obj);
+}
+
+void mempool_destroy(mempool_t *pool) {
+    while (pool->curr_nr) kmem_cache_free(pool->elements[--pool->curr_nr]);
+    free(pool->elements);
+    free(pool);
+}
+
+// churn 适配
+static void kfree_sized(void *obj, size_t size) {
+    kfree(obj);
+}
+
+// 堆分析演示：几个不同调用点分配不同大小，其中一个"泄漏"
+// 下面的 p[0] = 0 是为了让 kmalloc 不被编成尾调用，否则栈上看不到 demo_alloc_* 这一帧
+__attribute__((noinline)) static void *demo_alloc_session(void) {
+    char *p = kmalloc(200);
+    p[0] = 0;
+    return p;
+}
+__attribute__((noinline)) static void *demo_alloc_packet(void) {
+    char *p = kmalloc(1000);
+    p[0] = 0;
+    return p;
+}
+__attribute__((noinline)) static void *demo_alloc_node(void) {
+    char *p = kmalloc(24);
+    p[0] = 0;
+    return p;
+}
+
+static int heapprof_demo(const char *path) {
+    g_verbose = false;
+    heapprof_enable(64 * 1024); // 平均每 64KB 采一次
+
+    static void *nodes[20000];
+    for (int i = 0; i < 20000; i++) nodes[i] = demo_alloc_node();     // 长期存活
+    for (int i = 0; i < 2000; i++) demo_alloc_session();               // 泄漏
+    for (int i = 0; i < 2000; i++) kfree(demo_alloc_packet());         // 用完就释放
+    for (int i = 0; i < 10000; i++) kfree(nodes[i]);
 
-int main() {
+    return heapprof_dump(path) != 0;
+}
+
+// ================= 7. 测试主程序 =================
+
+int main(int argc, char **argv) {
     kmem_cache_init();
+
+    // ./slub --csv out.csv：跑随机负载并输出占用/碎片时间序列
+    // alloc_pages 只会往上切页，负载规模要控制在 MEM_SIZE 以内
+    if (argc > 2 && !strcmp(argv[1], "--csv")) {
+        g_verbose = false;
+        mem_backend_t backend = {"slub", kmalloc, kfree_sized, slub_stats, 8, 1024};
+        int ret = mem_churn_main(&backend, argv[2], 20000, 256);
+        slabinfo_show();
+        return ret;
+    }
+
+    // ./slub --heapprof heap.prof：采样堆分析，输出可以用 pprof --text ./slub heap.prof 查看
+    if (argc > 2 && !strcmp(argv[1], "--heapprof")) {
+        return heapprof_demo(argv[2]);
+    }
     printf("----------------------------------------\n");
 
     // 场景 1：申请 50 字节
@@ -222,5 +605,118 @@ int main() {
     void *p4 = kmalloc(50);
     printf("Got pointer p4: %p (Should equal p1: %p)\n", p4, p1);
 
+    // 场景 4：专用 cache，order 按尾部浪费挑选
+    // 以前固定一页：1536 字节的连接结构体一页只能放 2 个，浪费 1KB (25%)
+    printf("\n--- kmem_cache_create ---\n");
+    int sizes[] = {1536, 1000, 700, 3000, 12000};
+    for (int i = 0; i < 5; i++) {
+        char *name = malloc(32);
+        sprintf(name, "obj-%d", sizes[i]);
+        kmem_cache *c = kmem_cache_create(name, sizes[i], 0, SLAB_HWCACHE_ALIGN);
+        if (!c) continue;
+        int one_page = PAGE_SIZE / c->size;
+        printf("  %-10s 1 page: %d objs, waste %4.1f%% | order %d: %2d objs, waste %4.1f%%\n",
+               name, one_page, 100.0 * (PAGE_SIZE - one_page * c->size) / PAGE_SIZE,
+               c->order, c->objects,
+               100.0 * ((PAGE_SIZE << c->order) - c->objects * c->size) / (PAGE_SIZE << c->order));
+    }
+
+    kmem_cache *conn_cache = kmem_cache_create("conn", 1536, 0, SLAB_HWCACHE_ALIGN);
+    void *conns[16];
+    for (int i = 0; i < 16; i++) conns[i] = kmem_cache_alloc(conn_cache);
+    printf("conn[0] %p, conn[15] %p (slab head PFN %ld, %s)\n", conns[0], conns[15],
+           virt_to_head_page(conns[15]) - g_mem_map,
+           ((uintptr_t)conns[15] % CACHE_LINE_SIZE) ? "unaligned" : "cache-line aligned");
+    for (int i = 0; i < 16; i++) kmem_cache_free(conns[i]);
+
+    // 场景 5：cache 合并
+    // 很多驱动各自建一个 50~64 字节的 cache，每个只放几个对象：不合并就是每个占一页半空的 slab
+    printf("\n--- Cache merging: 8 caches of 50..64 bytes, 5 objects each ---\n");
+    g_verbose = false;
+    int slabs_before[2];
+    for (int pass = 0; pass < 2; pass++) {
+        unsigned int flags = pass == 0 ? SLAB_NO_MERGE : 0;
+        int before = 0, after = 0;
+        for (kmem_cache *c = g_slab_caches; c; c = c->next) before += c->nr_slabs;
+        for (int i = 0; i < 8; i++) {
+            char *name = malloc(32);
+            sprintf(name, "drv%d%s", i, pass == 0 ? "-nomerge" : "");
+            kmem_cache *c = kmem_cache_create(name, 50 + i * 2, 0, flags);
+            for (int k = 0; k < 5; k++) kmem_cache_alloc(c);
+        }
+        for (kmem_cache *c = g_slab_caches; c; c = c->next) after += c->nr_slabs;
+        slabs_before[pass] = after - before;
+    }
+    printf("SLAB_NO_MERGE: %d new slab pages, merged: %d new slab pages "
+           "(56-byte ones share drv0, 64-byte ones share kmalloc-64)\n", slabs_before[0], slabs_before[1]);
+
+    // 场景 6：在几个 "CPU" 上轮流做分配/释放，然后看 slabinfo
+    printf("\n--- slabinfo after mixed workload on %d CPUs ---\n", NR_CPUS);
+    static void *live[512];
+    uint64_t seed = 88172645463325252ULL;
+    for (int round = 0; round < 64; round++) {
+        g_current_cpu = round % NR_CPUS;
+        for (int i = 0; i < 512; i++) {
+            seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+            if (live[i]) {
+                kfree(live[i]);
+                live[i] = NULL;
+            } else if (seed & 1) {
+                live[i] = (seed & 2) ? kmem_cache_alloc(conn_cache) : kmalloc(16 + seed % 500);
+            }
+        }
+    }
+    slabinfo_show();
+
+    // 场景 7：内存充足时，mempool 的正常路径不应该比直接 kmem_cache_alloc 慢
+    printf("\n--- mempool fast path vs kmem_cache_alloc (memory available) ---\n");
+    kmem_cache *bio_cache = kmem_cache_create("bio", 200, 0, SLAB_NO_MERGE);
+    mempool_t *bio_pool = mempool_create(16, bio_cache);
+    enum { BIO_INFLIGHT = 8, BIO_ROUNDS = 1 << 18 };
+    double best[2] = {1e30, 1e30};
+    for (int run = 0; run < 10; run++) {
+        int mode = run & 1; // 两种交替跑，避免谁先跑谁吃亏
+        void *bios[BIO_INFLIGHT];
+        uint64_t t0 = mem_now_ns();
+        for (int r = 0; r < BIO_ROUNDS; r++) {
+            if (mode == 0) {
+                for (int i = 0; i < BIO_INFLIGHT; i++) bios[i] = kmem_cache_alloc(bio_cache);
+                for (int i = 0; i < BIO_INFLIGHT; i++) kmem_cache_free(bios[i]);
+            } else {
+                for (int i = 0; i < BIO_INFLIGHT; i++) bios[i] = mempool_alloc(bio_pool);
+                for (int i = 0; i < BIO_INFLIGHT; i++) mempool_free(bios[i], bio_pool);
+            }
+        }
+        double ns = (double)(mem_now_ns() - t0) / ((double)BIO_ROUNDS * BIO_INFLIGHT);
+        if (ns < best[mode]) best[mode] = ns;
+    }
+    printf("  kmem_cache_alloc %5.2f ns per alloc+free\n  mempool_alloc    %5.2f ns per alloc+free\n",
+           best[0], best[1]);
+
+    // 场景 8：把物理内存耗光，普通分配返回 NULL，mempool 靠预留继续处理 I/O
+    printf("\n--- mempool under OOM ---\n");
+    kmem_cache *hog_cache = kmem_cache_create("hog", 4096, 0, SLAB_NO_MERGE);
+    int hogged = 0;
+    while (kmem_cache_alloc(hog_cache)) hogged++;
+    int bio_left = 0;
+    while (kmem_cache_alloc(bio_cache)) bio_left++;
+    int kmalloc_left = 0;
+    while (kmalloc(100)) kmalloc_left++;
+    printf("hog took %d objects; bio cache gave %d more objects, kmalloc(100) %d more, then NULL\n",
+           hogged, bio_left, kmalloc_left);
+
+    void *ring[BIO_INFLIGHT] = {0};
+    int done = 0, stalled = 0;
+    for (int req = 0; req < 100000; req++) {
+        void **slot = &ring[req % BIO_INFLIGHT];
+        if (*slot) { mempool_free(*slot, bio_pool); done++; } // 最老的请求完成
+        *slot = mempool_alloc(bio_pool);
+        if (!*slot) stalled++;
+    }
+    printf("100000 requests with %d in flight: %d completed, %d stalled, %lu served from reserve (%d/%d left)\n",
+           BIO_INFLIGHT, done, stalled, bio_pool->nr_from_reserve, bio_pool->curr_nr, bio_pool->min_nr);
+    for (int i = 0; i < BIO_INFLIGHT; i++) if (ring[i]) mempool_free(ring[i], bio_pool);
+    mempool_destroy(bio_pool);
+
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,332 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+// 多线程 SLUB 的 remote free 队列
+// slub.c 是单线程的。放到多核上，每个 CPU 有自己的 cpu_slab，
+// 但对象经常在别的核上被释放 (一个线程分配请求、另一个线程处理完释放)。
+// 如果释放方直接改页上的 freelist，就得和 owner 抢同一个页描述符的 cache line，还得加锁。
+// 这里每个 slab 页多一个无锁的 remote_free 链表 (类似 mimalloc 的 thread_free)：
+//   - owner 自己释放：直接头插本地 freelist，不加锁，不用原子操作
+//   - 别的 CPU 释放：CAS 头插到 remote_free，只碰一次页描述符
+//   - owner 本地 freelist 用完 (slow path) 时，用一次 atomic_exchange 把整条 remote 链表拿过来，批量回收
+//
+// 线程模拟 CPU：线程 i 固定是 cpu i。
+
+// ================= 配置 =================
+#define PAGE_SIZE       4096
+#define MEM_SIZE        (256 * 1024 * 1024)
+#define NR_CPUS         4
+#define OBJ_SIZE        64
+#define SCAN_PAGES      8       // slow path 最多检查几个自己的满页有没有 remote free
+
+// ================= 数据结构 =================
+
+typedef struct page {
+    // owner 独占的部分
+    void *freelist;             // 本地空闲链表，对象前 8 字节存下一个
+    int inuse;                  // owner 视角：已分配且没被 owner 收回的对象数
+    int objects;
+    int owner;                  // 哪个 CPU 的 slab
+    struct page *next;          // owner 的页链表 (环形扫描用)
+
+    // 别的 CPU 写的部分，单独一条 cache line
+    _Atomic(void *) remote_free __attribute__((aligned(64)));
+    pthread_mutex_t lock;       // 对照组 (加锁版) 用
+} page_t;
+
+typedef struct {
+    page_t *cpu_slab;
+    page_t *pages;              // 这个 CPU 拥有的其他页 (环形链表)
+    // 统计
+    uint64_t local_frees;
+    uint64_t remote_frees;
+    uint64_t drains;            // 成功从 remote 链表收回的次数
+    uint64_t drained_objs;
+    uint64_t new_slabs;
+} __attribute__((aligned(64))) cpu_cache_t;
+
+typedef struct {
+    int size;
+    bool use_remote_queue;      // false = 对照组：释放方给页加锁直接改 freelist
+    cpu_cache_t cpu[NR_CPUS];
+} kmem_cache_t;
+
+static uint8_t *g_phys_mem_base;
+static page_t *g_mem_map;
+static _Atomic int g_allocated_pages = 0;
+static __thread int g_cpu = 0;
+
+static page_t *virt_to_page(void *addr) {
+    return &g_mem_map[((uint8_t *)addr - g_phys_mem_base) / PAGE_SIZE];
+}
+
+// ================= slab =================
+
+static page_t *new_slab(kmem_cache_t *s, cpu_cache_t *c) {
+    int pfn = atomic_fetch_add(&g_allocated_pages, 1);
+    if ((uint64_t)(pfn + 1) * PAGE_SIZE > MEM_SIZE) return NULL;
+
+    uint8_t *start = g_phys_mem_base + (uint64_t)pfn * PAGE_SIZE;
+    page_t *page = &g_mem_map[pfn];
+    page->objects = PAGE_SIZE / s->size;
+    page->inuse = 0;
+    page->owner = g_cpu;
+    atomic_store(&page->remote_free, NULL);
+    pthread_mutex_init(&page->lock, NULL);
+    for (int i = 0; i < page->objects - 1; i++) {
+        *(void **)(start + i * s->size) = start + (i + 1) * s->size;
+    }
+    *(void **)(start + (page->objects - 1) * s->size) = NULL;
+    page->freelist = start;
+
+    // 挂进 owner 的环形页链表
+    if (c->pages) {
+        page->next = c->pages->next;
+        c->pages->next = page;
+    } else {
+        page->next = page;
+    }
+    c->pages = page;
+    c->new_slabs++;
+    return page;
+}
+
+// 把 remote 链表整条换成 NULL，接到本地 freelist 前面
+static bool drain_remote(cpu_cache_t *c, page_t *page) {
+    if (!atomic_load_explicit(&page->remote_free, memory_order_relaxed)) return false;
+    void *list = atomic_exchange_explicit(&page->remote_free, NULL, memory_order_acquire);
+    if (!list) return false;
+
+    int n = 1;
+    void *tail = list;
+    while (*(void **)tail) {
+        tail = *(void **)tail;
+        n++;
+    }
+    *(void **)tail = page->freelist;
+    page->freelist = list;
+    page->inuse -= n;
+    c->drains++;
+    c->drained_objs += n;
+    return true;
+}
+
+// ================= alloc / free =================
+
+static void slow_path(kmem_cache_t *s, cpu_cache_t *c) {
+    // 1. 先收当前页的 remote free
+    if (c->cpu_slab && drain_remote(c, c->cpu_slab)) return;
+
+    // 2. 再看看自己的其他页，有 remote free 的就切过去 (只读一下指针，大多数时候不碰别人写的线)
+    //    加锁模式下别的 CPU 持 p->lock 往 freelist 上挂对象，读它也得拿锁
+    page_t *p = c->pages;
+    for (int i = 0; p && i < SCAN_PAGES; i++, p = p->next) {
+        if (p == c->cpu_slab) continue;
+        bool has_free;
+        if (s->use_remote_queue) {
+            has_free = p->freelist || drain_remote(c, p);
+        } else {
+            pthread_mutex_lock(&p->lock);
+            has_free = p->freelist != NULL;
+            pthread_mutex_unlock(&p->lock);
+        }
+        if (has_free) {
+            c->cpu_slab = p;
+            c->pages = p->next;
+            return;
+        }
+    }
+
+    // 3. 新页
+    c->cpu_slab = new_slab(s, c);
+}
+
+void *kmem_cache_alloc(kmem_cache_t *s) {
+    cpu_cache_t *c = &s->cpu[g_cpu];
+    for (;;) {
+        page_t *page = c->cpu_slab;
+        if (!s->use_remote_queue && page) pthread_mutex_lock(&page->lock);
+        if (page && page->freelist) {
+            void *obj = page->freelist;
+            page->freelist = *(void **)obj;
+            page->inuse++;
+            if (!s->use_remote_queue) pthread_mutex_unlock(&page->lock);
+            return obj;
+        }
+        if (!s->use_remote_queue && page) pthread_mutex_unlock(&page->lock);
+
+        slow_path(s, c);
+        if (!c->cpu_slab) return NULL;
+    }
+}
+
+void kmem_cache_free(kmem_cache_t *s, void *obj) {
+    cpu_cache_t *c = &s->cpu[g_cpu];
+    page_t *page = virt_to_page(obj);
+
+    if (!s->use_remote_queue) {
+        // 对照组：不管是不是 owner，都锁页改 freelist
+        pthread_mutex_lock(&page->lock);
+        *(void **)obj = page->freelist;
+        page->freelist = obj;
+        page->inuse--;
+        pthread_mutex_unlock(&page->lock);
+        if (page->owner == g_cpu) c->local_frees++;
+        else c->remote_frees++;
+        return;
+    }
+
+    if (page->owner == g_cpu) {
+        *(void **)obj = page->freelist;
+        page->freelist = obj;
+        page->inuse--;
+        c->local_frees++;
+        return;
+    }
+
+    // remote：无锁头插 (Treiber stack 的 push，只有 owner 会整条取走，没有 ABA 问题)
+    void *head = atomic_load_explicit(&page->remote_free, memory_order_relaxed);
+    do {
+        *(void **)obj = head;
+    } while (!atomic_compare_exchange_weak_explicit(&page->remote_free, &head, obj,
+                                                    memory_order_release, memory_order_relaxed));
+    c->remote_frees++;
+}
+
+// ================= benchmark =================
+
+#define OPS_PER_PAIR    4000000
+#define RING_SIZE       1024
+
+typedef struct {
+    _Atomic uint64_t head __attribute__((aligned(64)));
+    _Atomic uint64_t tail __attribute__((aligned(64)));
+    void *slots[RING_SIZE];
+} ring_t;
+
+static void ring_push(ring_t *r, void *p) {
+    uint64_t t = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    while (t - atomic_load_explicit(&r->head, memory_order_acquire) == RING_SIZE) sched_yield();
+    r->slots[t % RING_SIZE] = p;
+    atomic_store_explicit(&r->tail, t + 1, memory_order_release);
+}
+
+static void *ring_pop(ring_t *r) {
+    uint64_t h = atomic_load_explicit(&r->head, memory_order_relaxed);
+    while (atomic_load_explicit(&r->tail, memory_order_acquire) == h) sched_yield();
+    void *p = r->slots[h % RING_SIZE];
+    atomic_store_explicit(&r->head, h + 1, memory_order_release);
+    return p;
+}
+
+typedef struct {
+    kmem_cache_t *cache;
+    int cpu;
+    ring_t *ring;
+    bool producer;
+} worker_t;
+
+// 生产者分配、写一下、交给消费者；消费者读一下、释放
+static void *worker(void *arg) {
+    worker_t *w = arg;
+    g_cpu = w->cpu;
+    for (int op = 0; op < OPS_PER_PAIR; op++) {
+        if (w->producer) {
+            uint64_t *obj = kmem_cache_alloc(w->cache);
+            if (!obj) {
+                fprintf(stderr, "OOM\n");
+                exit(1);
+            }
+            obj[1] = op;
+            ring_push(w->ring, obj);
+        } else {
+            uint64_t *obj = ring_pop(w->ring);
+            if (obj[1] != (uint64_t)op) fprintf(stderr, "corrupted object\n");
+            kmem_cache_free(w->cache, obj);
+        }
+    }
+    return NULL;
+}
+
+static double now_sec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void bench(const char *label, bool use_remote_queue) {
+    kmem_cache_t *s = calloc(1, sizeof(kmem_cache_t));
+    s->size = OBJ_SIZE;
+    s->use_remote_queue = use_remote_queue;
+    int pages_before = atomic_load(&g_allocated_pages);
+
+    pthread_t th[NR_CPUS];
+    worker_t w[NR_CPUS];
+    ring_t *rings = aligned_alloc(64, sizeof(ring_t) * (NR_CPUS / 2));
+    memset(rings, 0, sizeof(ring_t) * (NR_CPUS / 2));
+
+    double t0 = now_sec();
+    for (int i = 0; i < NR_CPUS; i++) {
+        w[i] = (worker_t){s, i, &rings[i / 2], i % 2 == 0};
+        pthread_create(&th[i], NULL, worker, &w[i]);
+    }
+    for (int i = 0; i < NR_CPUS; i++) pthread_join(th[i], NULL);
+    double dt = now_sec() - t0;
+
+    uint64_t remote = 0, drains = 0, drained = 0;
+    for (int i = 0; i < NR_CPUS; i++) {
+        remote += s->cpu[i].remote_frees;
+        drains += s->cpu[i].drains;
+        drained += s->cpu[i].drained_objs;
+    }
+    printf("  %-24s %6.1f ns per alloc+free, %llu remote frees, %d slab pages",
+           label, dt * 1e9 / (OPS_PER_PAIR * (NR_CPUS / 2)), (unsigned long long)remote,
+           atomic_load(&g_allocated_pages) - pages_before);
+    if (use_remote_queue && drains)
+        printf(", %llu drains (avg batch %.1f)", (unsigned long long)drains, (double)drained / drains);
+    printf("\n");
+    free(rings);
+}
+
+// ================= 测试主函数 =================
+
+int main() {
+    g_phys_mem_base = aligned_alloc(PAGE_SIZE, MEM_SIZE);
+    g_mem_map = calloc(MEM_SIZE / PAGE_SIZE, sizeof(page_t));
+    printf("[System] %d CPUs (threads), %d-byte objects, %d objs per slab\n",
+           NR_CPUS, OBJ_SIZE, PAGE_SIZE / OBJ_SIZE);
+
+    // 1. 基本行为：cpu 1 释放 cpu 0 的对象，cpu 0 在 slow path 批量收回
+    kmem_cache_t *s = calloc(1, sizeof(kmem_cache_t));
+    s->size = OBJ_SIZE;
+    s->use_remote_queue = true;
+    void *objs[PAGE_SIZE / OBJ_SIZE];
+    int n = PAGE_SIZE / OBJ_SIZE;
+    for (int i = 0; i < n; i++) objs[i] = kmem_cache_alloc(s);
+    page_t *page = virt_to_page(objs[0]);
+    printf("cpu 0 filled one slab: inuse %d/%d\n", page->inuse, page->objects);
+
+    g_cpu = 1;
+    for (int i = 0; i < 10; i++) kmem_cache_free(s, objs[i]);
+    printf("cpu 1 freed 10 objects remotely: page inuse still %d (remote list holds them)\n", page->inuse);
+
+    g_cpu = 0;
+    void *again = kmem_cache_alloc(s);
+    printf("cpu 0 slow path drained %llu objects in one exchange, got %p (%s), new slabs %llu\n",
+           (unsigned long long)s->cpu[0].drained_objs, again,
+           virt_to_page(again) == page ? "same slab" : "other slab",
+           (unsigned long long)s->cpu[0].new_slabs);
+
+    printf("\n--- Producer/consumer: cpu 0/2 alloc, cpu 1/3 free, %d objects per pair ---\n", OPS_PER_PAIR);
+    bench("locked page freelist", false);
+    bench("remote free queue", true);
+    return 0;
+}
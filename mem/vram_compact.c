@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+// bitmap 显存池的 handle + 增量整理 (defragmentation)
+// bitmap.c 把裸指针交给调用者，页一旦被占住就不能动，碎片是永久的。
+// 这里加一层可选的 handle API (类似老 Mac OS 的 Handle / 游戏引擎的资源句柄)：
+//   - 调用者只拿一个稳定的 id，用之前 handle_lock 换出当前地址，用完 handle_unlock
+//   - 没被 lock 的 run 可以被整理器搬走，handle 表里的地址跟着更新
+// 整理器是增量的：每次 compact_step 最多搬 budget 个页 (memmove)，
+// 可以塞在每帧的空闲时间里跑，不需要一次 stop-the-world 把整个池子搬完。
+
+// =================配置区域=================
+#define MEM_SIZE        (128 * 1024 * 1024) // 128MB
+#define PAGE_SIZE       (2 * 1024 * 1024)   // 2MB (Huge Page)
+#define PAGE_COUNT      (MEM_SIZE / PAGE_SIZE) // 64 个页
+
+#define MAX_HANDLES     256
+#define HANDLE_NONE     (-1)
+
+// =================底层：bitmap=================
+
+static uint8_t *g_phys_base = NULL;
+static uint64_t g_bitmap = 0; // 0 = 空闲, 1 = 占用
+
+static uint64_t run_mask(int num_pages) {
+    return (num_pages == 64) ? ~0ULL : ((1ULL << num_pages) - 1);
+}
+
+static int bitmap_find(int num_pages) {
+    uint64_t mask = run_mask(num_pages);
+    for (int i = 0; i <= PAGE_COUNT - num_pages; i++) {
+        if (((g_bitmap >> i) & mask) == 0) return i;
+    }
+    return -1;
+}
+
+// 最长连续空闲段，衡量碎片程度
+static int largest_free_run() {
+    int best = 0, cur = 0;
+    for (int i = 0; i < PAGE_COUNT; i++) {
+        if ((g_bitmap >> i) & 1) cur = 0;
+        else if (++cur > best) best = cur;
+    }
+    return best;
+}
+
+// =================handle 表=================
+
+typedef struct {
+    bool used;
+    int page_idx;       // 当前所在的首页
+    int num_pages;
+    int lock_count;     // > 0 时整理器不能搬
+} handle_t;
+
+typedef int vram_handle_t;
+
+static handle_t g_handles[MAX_HANDLES];
+static int g_page_owner[PAGE_COUNT]; // run 首页 -> handle，其余页为 HANDLE_NONE
+
+// 正在进行中的搬迁 (一个 run 可能要跨好几个 step 才搬完)
+static struct {
+    vram_handle_t h;    // HANDLE_NONE = 没有进行中的搬迁
+    int src;
+    int dst;
+    int done;           // 已经搬完的页数
+} g_move = {HANDLE_NONE, 0, 0, 0};
+
+// 统计
+static uint64_t g_pages_moved = 0;
+
+void vram_init() {
+    g_phys_base = (uint8_t *)malloc(MEM_SIZE);
+    if (!g_phys_base) {
+        printf("Fatal: OOM\n");
+        exit(1);
+    }
+    g_bitmap = 0;
+    memset(g_handles, 0, sizeof(g_handles));
+    for (int i = 0; i < PAGE_COUNT; i++) g_page_owner[i] = HANDLE_NONE;
+    g_move.h = HANDLE_NONE;
+    printf("[System] Init: 128MB VRAM, 2MB Page, Total 64 Pages, %d handles.\n", MAX_HANDLES);
+}
+
+/**
+ * 分配 n 个连续页，返回 handle
+ * @return handle，失败返回 HANDLE_NONE
+ */
+vram_handle_t handle_alloc(int num_pages) {
+    if (num_pages <= 0 || num_pages > PAGE_COUNT) return HANDLE_NONE;
+
+    int idx = bitmap_find(num_pages);
+    if (idx < 0) return HANDLE_NONE;
+
+    for (int h = 0; h < MAX_HANDLES; h++) {
+        if (g_handles[h].used) continue;
+        g_handles[h] = (handle_t){true, idx, num_pages, 0};
+        g_bitmap |= run_mask(num_pages) << idx;
+        g_page_owner[idx] = h;
+        return h;
+    }
+    return HANDLE_NONE;
+}
+
+static void move_finish();
+
+void handle_free(vram_handle_t h) {
+    if (h < 0 || h >= MAX_HANDLES || !g_handles[h].used) {
+        printf("[Free] Error: Invalid handle %d\n", h);
+        return;
+    }
+    // 正在搬的 run 被释放：先收尾，保证 bitmap 状态一致
+    if (g_move.h == h) move_finish();
+
+    handle_t *e = &g_handles[h];
+    g_bitmap &= ~(run_mask(e->num_pages) << e->page_idx);
+    g_page_owner[e->page_idx] = HANDLE_NONE;
+    e->used = false;
+}
+
+/**
+ * 取当前地址并钉住，lock 期间整理器不会搬这个 run
+ * 如果它正搬到一半，先同步搬完再返回新地址
+ */
+void *handle_lock(vram_handle_t h) {
+    if (h < 0 || h >= MAX_HANDLES || !g_handles[h].used) return NULL;
+    if (g_move.h == h) move_finish();
+    g_handles[h].lock_count++;
+    return g_phys_base + (uint64_t)g_handles[h].page_idx * PAGE_SIZE;
+}
+
+void handle_unlock(vram_handle_t h) {
+    if (h >= 0 && h < MAX_HANDLES && g_handles[h].lock_count > 0) g_handles[h].lock_count--;
+}
+
+// =================增量整理器=================
+
+// 搬 n 页：dst < src，从低往高逐页 memmove，源和目标重叠也安全
+static void move_pages(int n) {
+    for (int i = 0; i < n; i++) {
+        int k = g_move.done++;
+        memmove(g_phys_base + (uint64_t)(g_move.dst + k) * PAGE_SIZE,
+                g_phys_base + (uint64_t)(g_move.src + k) * PAGE_SIZE, PAGE_SIZE);
+    }
+    g_pages_moved += n;
+
+    handle_t *e = &g_handles[g_move.h];
+    if (g_move.done < e->num_pages) return;
+
+    // 搬完：目标页在开始时已经标成占用，这里只把源里不和目标重叠的部分还回去
+    uint64_t src_mask = run_mask(e->num_pages) << g_move.src;
+    uint64_t dst_mask = run_mask(e->num_pages) << g_move.dst;
+    g_bitmap &= ~(src_mask & ~dst_mask);
+    g_page_owner[g_move.src] = HANDLE_NONE;
+    g_page_owner[g_move.dst] = g_move.h;
+    e->page_idx = g_move.dst;
+    g_move.h = HANDLE_NONE;
+}
+
+static void move_finish() {
+    handle_t *e = &g_handles[g_move.h];
+    move_pages(e->num_pages - g_move.done);
+}
+
+/**
+ * 挑下一个要搬的 run：第一个空闲页之后、最靠前的、没被 lock 的 run
+ * 被 lock 的 run 当成墙，从它后面接着找空闲页
+ */
+static bool move_pick() {
+    int free_idx = 0;
+    while (free_idx < PAGE_COUNT) {
+        while (free_idx < PAGE_COUNT && ((g_bitmap >> free_idx) & 1)) free_idx++;
+        int run = free_idx;
+        while (run < PAGE_COUNT && g_page_owner[run] == HANDLE_NONE) run++;
+        if (run >= PAGE_COUNT) return false;
+
+        handle_t *e = &g_handles[g_page_owner[run]];
+        if (e->lock_count > 0) {
+            free_idx = run + e->num_pages;
+            continue;
+        }
+        g_move.h = g_page_owner[run];
+        g_move.src = run;
+        g_move.dst = free_idx;
+        g_move.done = 0;
+        // 先把目标标成占用，搬迁过程中新的 handle_alloc 不会抢到这里
+        g_bitmap |= run_mask(e->num_pages) << free_idx;
+        return true;
+    }
+    return false;
+}
+
+/**
+ * 跑一个时间片：最多搬 budget 个页
+ * @return 这次实际搬了几页，0 表示已经整理完了 (或只剩被 lock 挡住的 run)
+ */
+int compact_step(int budget) {
+    int moved = 0;
+    while (moved < budget) {
+        if (g_move.h == HANDLE_NONE && !move_pick()) break;
+        int left = g_handles[g_move.h].num_pages - g_move.done;
+        int n = left < budget - moved ? left : budget - moved;
+        move_pages(n);
+        moved += n;
+    }
+    return moved;
+}
+
+// 调试工具：打印每页属于哪个 handle (字母循环)，'#' 表示被 lock 的 run，
+// '>' 表示正在搬入的目标页，'.' 表示空闲
+void vram_dump() {
+    printf("Map: ");
+    int cur = HANDLE_NONE;
+    for (int i = 0; i < PAGE_COUNT; i++) {
+        if (g_page_owner[i] != HANDLE_NONE) cur = g_page_owner[i];
+        bool incoming = g_move.h != HANDLE_NONE && i >= g_move.dst && i < g_move.src &&
+                        i < g_move.dst + g_handles[g_move.h].num_pages;
+        if (!((g_bitmap >> i) & 1)) printf(".");
+        else if (incoming) printf(">");
+        else if (cur != HANDLE_NONE && g_handles[cur].lock_count) printf("#");
+        else printf("%c", cur == HANDLE_NONE ? '?' : 'a' + cur % 26);
+    }
+    printf("  largest free run: %d\n", largest_free_run());
+}
+
+// =================测试主函数=================
+
+static double now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// 往 run 的每一页开头写 (handle, 页号)，搬完再检查
+static void stamp(vram_handle_t h) {
+    uint8_t *p = handle_lock(h);
+    for (int i = 0; i < g_handles[h].num_pages; i++) {
+        uint32_t *w = (uint32_t *)(p + (uint64_t)i * PAGE_SIZE);
+        w[0] = 0xC0DE0000u | h;
+        w[1] = i;
+    }
+    handle_unlock(h);
+}
+
+static bool verify(vram_handle_t h) {
+    uint8_t *p = handle_lock(h);
+    bool ok = true;
+    for (int i = 0; i < g_handles[h].num_pages; i++) {
+        uint32_t *w = (uint32_t *)(p + (uint64_t)i * PAGE_SIZE);
+        if (w[0] != (0xC0DE0000u | h) || w[1] != (uint32_t)i) ok = false;
+    }
+    handle_unlock(h);
+    return ok;
+}
+
+int main() {
+    vram_init();
+    memset(g_phys_base, 0, MEM_SIZE); // 先把页都摸一遍，计时不被缺页中断干扰
+
+    // 1. 制造碎片：交替分配 1~4 页的 run，占满整个池子，然后释放一半
+    printf("\n--- Fill with runs of 1..4 pages, free every other one ---\n");
+    vram_handle_t hs[PAGE_COUNT];
+    int n = 0;
+    for (int i = 0; ; i++) {
+        vram_handle_t h = handle_alloc(1 + i % 4);
+        if (h == HANDLE_NONE) break;
+        stamp(h);
+        hs[n++] = h;
+    }
+    for (int i = 0; i < n; i += 2) handle_free(hs[i]), hs[i] = HANDLE_NONE;
+
+    // 钉住最后一个存活的 run，它必须原地不动
+    vram_handle_t pinned = HANDLE_NONE;
+    for (int i = n - 1; pinned == HANDLE_NONE; i--) pinned = hs[i];
+    int pinned_idx = g_handles[pinned].page_idx;
+    handle_lock(pinned);
+    vram_dump();
+
+    int want = 24;
+    printf("handle_alloc(%d): %s\n", want, handle_alloc(want) == HANDLE_NONE ? "Failed (fragmented)" : "Success");
+
+    // 2. 增量整理：每帧最多搬 4 页
+    printf("\n--- Incremental compaction, budget 4 pages per step ---\n");
+    int steps = 0;
+    double worst = 0, total = 0;
+    for (;;) {
+        double t0 = now_us();
+        int moved = compact_step(4);
+        double dt = now_us() - t0;
+        if (!moved) break;
+        steps++;
+        total += dt;
+        if (dt > worst) worst = dt;
+        if (steps <= 3) vram_dump();
+    }
+    vram_dump();
+    printf("%d steps, %llu pages moved, total %.0f us, worst step %.0f us (full pass would be one %.0f us pause)\n",
+           steps, (unsigned long long)g_pages_moved, total, worst, total);
+
+    // 3. 校验：数据跟着 handle 走，被钉住的 run 没动
+    int bad = 0;
+    for (int i = 0; i < n; i++)
+        if (hs[i] != HANDLE_NONE && !verify(hs[i])) bad++;
+    printf("Data verification: %s, pinned run %s (page %d)\n", bad ? "MISMATCH" : "OK",
+           g_handles[pinned].page_idx == pinned_idx ? "stayed" : "MOVED", g_handles[pinned].page_idx);
+
+    vram_handle_t big = handle_alloc(want);
+    printf("handle_alloc(%d) after compaction: %s\n", want, big == HANDLE_NONE ? "Failed" : "Success");
+    vram_dump();
+
+    // 4. 搬到一半时 lock：先同步搬完再返回地址
+    printf("\n--- Lock during an in-flight move ---\n");
+    handle_unlock(pinned);
+    if (big != HANDLE_NONE) handle_free(big);
+    handle_free(hs[1]);
+    compact_step(1);
+    vram_handle_t inflight = g_move.h;
+    if (inflight != HANDLE_NONE) {
+        printf("Handle %d is %d/%d pages into its move\n", inflight, g_move.done, g_handles[inflight].num_pages);
+        handle_lock(inflight);
+        printf("After handle_lock: at page %d, in-flight move %s, data %s\n", g_handles[inflight].page_idx,
+               g_move.h == HANDLE_NONE ? "finished" : "pending", verify(inflight) ? "OK" : "MISMATCH");
+        handle_unlock(inflight);
+    }
+    while (compact_step(4)) {}
+    vram_dump();
+    return bad ? 1 : 0;
+}
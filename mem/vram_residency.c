@@ -0,0 +1,376 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// 显存驻留管理 (residency manager)
+// bitmap.c 里 bitmap_alloc 失败就直接返回 NULL，调用者只能干等。
+// 这里在 bitmap 分配器之上加一层：每个 buffer 注册成“可驱逐”的，带优先级和 LRU 位置，
+// 分配失败时挑一段连续窗口，把窗口里最久没用、优先级最低的 buffer 通过回调搬回 host 内存，
+// 腾出足够的连续页再分配；之后再访问被驱逐的 buffer 时自动换回显存。
+
+// =================配置区域=================
+#define MEM_SIZE        (128 * 1024 * 1024) // 128MB
+#define PAGE_SIZE       (2 * 1024 * 1024)   // 2MB (Huge Page)
+#define PAGE_COUNT      (MEM_SIZE / PAGE_SIZE) // 64 个页
+#define NO_OWNER        -1
+
+// =================底层：bitmap 分配器 (同 bitmap.c，去掉打印)=================
+
+static uint8_t *g_phys_base = NULL;
+static uint64_t g_bitmap = 0;
+
+static uint64_t run_mask(int num_pages) {
+    return (num_pages == 64) ? ~0ULL : ((1ULL << num_pages) - 1);
+}
+
+static int bitmap_alloc_idx(int num_pages) {
+    uint64_t mask = run_mask(num_pages);
+    for (int i = 0; i <= PAGE_COUNT - num_pages; i++) {
+        if (((g_bitmap >> i) & mask) == 0) {
+            g_bitmap |= (mask << i);
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void bitmap_free_idx(int index, int num_pages) {
+    g_bitmap &= ~(run_mask(num_pages) << index);
+}
+
+// =================驻留层数据结构=================
+
+typedef struct res_buf res_buf_t;
+
+// 驱逐 / 换回回调：vram 是 buffer 当前 (或将要) 所在的显存地址
+typedef void (*res_evict_fn)(res_buf_t *buf, void *vram);
+typedef void (*res_restore_fn)(res_buf_t *buf, void *vram);
+
+struct res_buf {
+    int id;
+    int pages;
+    int priority;           // 越大越不容易被驱逐
+    int page_idx;           // 驻留时所在的起始页，驱逐后为 -1
+    bool pinned;            // 正在被 GPU 使用，不能驱逐
+    bool has_backing;       // host 副本有效 (至少被驱逐过一次)
+    void *host;             // host 内存副本
+    uint64_t last_use;      // LRU 位置：最后一次 res_use 的逻辑时钟
+    res_evict_fn evict;
+    res_restore_fn restore;
+};
+
+typedef struct {
+    int owner[PAGE_COUNT];  // 页 -> buffer id
+    res_buf_t **bufs;
+    int nbufs;
+    uint64_t clock;
+
+    // 统计
+    uint64_t hits, misses, evictions, evicted_pages, failures;
+} res_mgr_t;
+
+static res_mgr_t g_res;
+
+// 基准里用来对比的朴素策略：直接腾空第一个没有 pinned 的窗口，不看 LRU
+static bool g_naive_window = false;
+
+// =================默认回调：整块拷贝到 host=================
+
+static void default_evict(res_buf_t *buf, void *vram) {
+    memcpy(buf->host, vram, (size_t)buf->pages * PAGE_SIZE);
+}
+
+static void default_restore(res_buf_t *buf, void *vram) {
+    memcpy(vram, buf->host, (size_t)buf->pages * PAGE_SIZE);
+}
+
+// =================核心逻辑=================
+
+void res_init() {
+    g_phys_base = (uint8_t *)malloc(MEM_SIZE);
+    if (!g_phys_base) {
+        printf("Fatal: OOM\n");
+        exit(1);
+    }
+    g_bitmap = 0;
+    memset(&g_res, 0, sizeof(g_res));
+    for (int i = 0; i < PAGE_COUNT; i++) g_res.owner[i] = NO_OWNER;
+}
+
+/**
+ * 注册一个可驱逐的 buffer (此时还不占显存，第一次 res_use 时才分配)
+ * @param evict / restore 为 NULL 时使用整块 memcpy 到 host 的默认实现
+ */
+res_buf_t *res_register(int pages, int priority, res_evict_fn evict, res_restore_fn restore) {
+    if (pages <= 0 || pages > PAGE_COUNT) return NULL;
+
+    res_buf_t *b = calloc(1, sizeof(res_buf_t));
+    b->id = g_res.nbufs;
+    b->pages = pages;
+    b->priority = priority;
+    b->page_idx = -1;
+    b->evict = evict ? evict : default_evict;
+    b->restore = restore ? restore : default_restore;
+    if (b->evict == default_evict || b->restore == default_restore) {
+        b->host = malloc((size_t)pages * PAGE_SIZE);
+    }
+
+    g_res.bufs = realloc(g_res.bufs, (g_res.nbufs + 1) * sizeof(res_buf_t *));
+    g_res.bufs[g_res.nbufs++] = b;
+    return b;
+}
+
+static void *buf_addr(res_buf_t *b) {
+    return g_phys_base + (uint64_t)b->page_idx * PAGE_SIZE;
+}
+
+static void evict_buf(res_buf_t *b) {
+    b->evict(b, buf_addr(b));
+    b->has_backing = true;
+    bitmap_free_idx(b->page_idx, b->pages);
+    for (int i = 0; i < b->pages; i++) g_res.owner[b->page_idx + i] = NO_OWNER;
+    b->page_idx = -1;
+    g_res.evictions++;
+    g_res.evicted_pages += b->pages;
+}
+
+/**
+ * 选一个要腾空的窗口 [start, start + pages)
+ * 窗口里有 pinned buffer 的不能选；其余窗口按“窗口里最该保留的那个 victim”打分：
+ *   key = (priority, last_use)，越大越该保留
+ * 取 key 最小的窗口，也就是只牺牲最不重要、最久没用的 buffer；同分时驱逐页数少的优先。
+ * @return 窗口起点，没有可用窗口返回 -1
+ */
+static int pick_window(int pages) {
+    int best = -1;
+    int best_prio = 0, best_evict = 0;
+    uint64_t best_use = 0;
+
+    for (int start = 0; start <= PAGE_COUNT - pages; start++) {
+        int prio = -1 << 30, evict_pages = 0;
+        uint64_t use = 0;
+        bool ok = true;
+
+        for (int i = start; i < start + pages; ) {
+            int id = g_res.owner[i];
+            if (id == NO_OWNER) {
+                i++;
+                continue;
+            }
+            res_buf_t *v = g_res.bufs[id];
+            if (v->pinned) {
+                ok = false;
+                break;
+            }
+            if (v->priority > prio || (v->priority == prio && v->last_use > use)) {
+                prio = v->priority;
+                use = v->last_use;
+            }
+            evict_pages += v->pages;
+            i = v->page_idx + v->pages; // 跳过这个 buffer 剩下的页
+        }
+        if (!ok) continue;
+
+        if (g_naive_window) return start;
+
+        bool better = best < 0 || prio < best_prio ||
+                      (prio == best_prio && (use < best_use || (use == best_use && evict_pages < best_evict)));
+        if (better) {
+            best = start;
+            best_prio = prio;
+            best_use = use;
+            best_evict = evict_pages;
+        }
+    }
+    return best;
+}
+
+/**
+ * 使用一个 buffer：确保它驻留在显存里并更新 LRU 时间戳
+ * 不驻留时先尝试直接分配，失败再按 pick_window 驱逐一段连续窗口
+ * @return 显存地址，所有窗口都被 pinned 占住时返回 NULL
+ */
+void *res_use(res_buf_t *b) {
+    b->last_use = ++g_res.clock;
+
+    if (b->page_idx >= 0) {
+        g_res.hits++;
+        return buf_addr(b);
+    }
+
+    g_res.misses++;
+    int idx = bitmap_alloc_idx(b->pages);
+    if (idx < 0) {
+        // 自己不能被选成 victim (本来就不驻留，不会出现在 owner[] 里)
+        int start = pick_window(b->pages);
+        if (start < 0) {
+            g_res.failures++;
+            return NULL;
+        }
+        for (int i = start; i < start + b->pages; i++) {
+            if (g_res.owner[i] != NO_OWNER) evict_buf(g_res.bufs[g_res.owner[i]]);
+        }
+        idx = bitmap_alloc_idx(b->pages);
+        // 窗口已经腾空，first fit 可能在更前面找到别的空洞，这也没问题
+        if (idx < 0) {
+            g_res.failures++;
+            return NULL;
+        }
+    }
+
+    b->page_idx = idx;
+    for (int i = 0; i < b->pages; i++) g_res.owner[idx + i] = b->id;
+    if (b->has_backing) b->restore(b, buf_addr(b));
+    return buf_addr(b);
+}
+
+/**
+ * 注销一个 buffer：驻留时先把它占的页还回 bitmap (不调 evict，内容直接丢弃)，再释放描述符
+ * bufs[] 按 id 下标，把最后一个 buffer 挪到空出来的位置，同时改写它在 owner[] 里的 id
+ */
+void res_unregister(res_buf_t *b) {
+    if (b->page_idx >= 0) {
+        bitmap_free_idx(b->page_idx, b->pages);
+        for (int i = 0; i < b->pages; i++) g_res.owner[b->page_idx + i] = NO_OWNER;
+    }
+
+    res_buf_t *last = g_res.bufs[--g_res.nbufs];
+    if (last != b) {
+        last->id = b->id;
+        g_res.bufs[b->id] = last;
+        if (last->page_idx >= 0) {
+            for (int i = 0; i < last->pages; i++) g_res.owner[last->page_idx + i] = last->id;
+        }
+    }
+    free(b->host);
+    free(b);
+}
+
+// pin 住的 buffer 不会被驱逐 (例如 kernel 正在读写)
+void res_pin(res_buf_t *b) { b->pinned = true; }
+void res_unpin(res_buf_t *b) { b->pinned = false; }
+
+// 调试工具：打印每页属于哪个 buffer
+void res_dump() {
+    printf("Map: ");
+    for (int i = 0; i < PAGE_COUNT; i++) {
+        int id = g_res.owner[i];
+        if (id == NO_OWNER) printf(".");
+        else printf("%c", 'A' + id % 26);
+    }
+    printf("\n");
+}
+
+void res_reset() {
+    for (int i = 0; i < g_res.nbufs; i++) {
+        free(g_res.bufs[i]->host);
+        free(g_res.bufs[i]);
+    }
+    free(g_res.bufs);
+    free(g_phys_base);
+}
+
+// =================基准测试：超额订阅下的命中率=================
+
+// 只计数不拷贝的回调，测策略本身，不让 memcpy 占满时间
+static uint64_t g_bytes_out, g_bytes_in;
+static void count_evict(res_buf_t *buf, void *vram) { g_bytes_out += (uint64_t)buf->pages * PAGE_SIZE; }
+static void count_restore(res_buf_t *buf, void *vram) { g_bytes_in += (uint64_t)buf->pages * PAGE_SIZE; }
+
+static uint64_t g_seed = 88172645463325252ULL;
+static uint64_t xorshift() {
+    g_seed ^= g_seed << 13;
+    g_seed ^= g_seed >> 7;
+    g_seed ^= g_seed << 17;
+    return g_seed;
+}
+
+/**
+ * 工作集总页数 = oversub * 64，buffer 大小 1..8 页
+ * 访问分布：80% 的访问落在 20% 的热 buffer 上
+ * 每 100 次访问注销一个冷 buffer 再注册一个新的 (模拟临时 tensor 的生灭)，结束时全部注销
+ */
+static void bench(double oversub, int accesses, bool naive) {
+    res_init();
+    g_naive_window = naive;
+    g_seed = 88172645463325252ULL;
+    g_bytes_out = g_bytes_in = 0;
+
+    int target = (int)(oversub * PAGE_COUNT), total = 0;
+    while (total < target) {
+        int pages = 1 + (int)(xorshift() % 8);
+        res_register(pages, 0, count_evict, count_restore);
+        total += pages;
+    }
+    int hot = g_res.nbufs / 5 ? g_res.nbufs / 5 : 1;
+
+    for (int i = 0; i < accesses; i++) {
+        int id = (xorshift() % 100 < 80) ? (int)(xorshift() % hot)
+                                         : hot + (int)(xorshift() % (g_res.nbufs - hot));
+        res_use(g_res.bufs[id]);
+
+        // 冷 buffer 都在 [hot, nbufs) 里，注销时挪过来的是最后一个，热 buffer 的 id 不变
+        if (i % 100 == 99) {
+            res_unregister(g_res.bufs[hot + (int)(xorshift() % (g_res.nbufs - hot))]);
+            res_register(1 + (int)(xorshift() % 8), 0, count_evict, count_restore);
+        }
+    }
+
+    uint64_t total_use = g_res.hits + g_res.misses;
+    printf("  %-5s %.2fx (%3d pages, %3d bufs): hit rate %5.1f%%, %6llu evictions, %7.1f GB moved, %llu failures\n",
+           naive ? "naive" : "LRU", oversub, total, g_res.nbufs, 100.0 * g_res.hits / total_use,
+           (unsigned long long)g_res.evictions,
+           (g_bytes_out + g_bytes_in) / 1e9, (unsigned long long)g_res.failures);
+    while (g_res.nbufs) res_unregister(g_res.bufs[g_res.nbufs - 1]);
+    if (g_bitmap) printf("  leaked VRAM pages: 0x%016llx\n", (unsigned long long)g_bitmap);
+    res_reset();
+}
+
+// =================测试主函数=================
+
+int main() {
+    res_init();
+    printf("[System] Residency manager on 128MB VRAM, 2MB pages.\n");
+
+    // 1. 填满显存：A(20) B(20) C(20)，剩 4 页
+    res_buf_t *a = res_register(20, 0, NULL, NULL);
+    res_buf_t *b = res_register(20, 0, NULL, NULL);
+    res_buf_t *c = res_register(20, 1, NULL, NULL); // 优先级更高
+    strcpy(res_use(a), "tensor A");
+    strcpy(res_use(b), "tensor B");
+    strcpy(res_use(c), "tensor C");
+    res_dump();
+
+    // 2. 再用一次 A，此时 B 是最久没用的
+    res_use(a);
+
+    // 3. D 需要 10 页：bitmap_alloc 会失败，应该驱逐 B 腾出窗口
+    printf("\n--- Use D (10 pages), VRAM full ---\n");
+    res_buf_t *d = res_register(10, 0, NULL, NULL);
+    strcpy(res_use(d), "tensor D");
+    res_dump();
+    printf("B resident: %s\n", b->page_idx >= 0 ? "yes" : "no (evicted to host)");
+
+    // 4. 再用 B：数据应该从 host 副本恢复
+    printf("\n--- Use B again (pin A so it cannot be evicted) ---\n");
+    res_pin(a);
+    char *pb = res_use(b);
+    res_unpin(a);
+    res_dump();
+    printf("B contents after restore: \"%s\"\n", pb);
+    printf("A resident: %s, C resident: %s, D resident: %s\n",
+           a->page_idx >= 0 ? "yes" : "no", c->page_idx >= 0 ? "yes" : "no", d->page_idx >= 0 ? "yes" : "no");
+    res_reset();
+
+    // 5. 超额订阅基准
+    // naive = 驱逐第一个可用窗口，用来对比 LRU 选窗口带来的差别
+    printf("\n--- Benchmark: 200000 accesses, 80/20 skew ---\n");
+    double ratios[] = {1.0, 1.25, 1.5, 2.0, 4.0};
+    for (int i = 0; i < 5; i++) {
+        bench(ratios[i], 200000, false);
+        bench(ratios[i], 200000, true);
+    }
+    return 0;
+}
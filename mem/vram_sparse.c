@@ -0,0 +1,196 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+// 稀疏虚拟地址映射：大块分配不再需要物理连续
+// bitmap.c 的 bitmap_alloc(60) 必须找到 60 个物理上连续的空闲页，池子一碎就失败，只能做 compaction。
+// GPU 的 MMU / 主机的 MMU 都能把一段连续的虚拟地址映射到零散的物理页上，这里分两层模拟：
+//   1. 软件页表：每个虚拟 range 记录 "第 i 个虚拟页 -> 哪个物理页"，va_translate 做地址翻译
+//   2. 主机上真的映射出来：物理池是一个 memfd，先 mmap(PROT_NONE) 预留一段连续虚拟地址，
+//      再把每个零散的物理页用 MAP_FIXED 映射到对应位置，CPU 可以直接按连续指针读写
+
+// =================配置区域=================
+#define MEM_SIZE        (128 * 1024 * 1024) // 128MB
+#define PAGE_SIZE       (2 * 1024 * 1024)   // 2MB (Huge Page)
+#define PAGE_COUNT      (MEM_SIZE / PAGE_SIZE) // 64 个页
+
+// =================物理池 (memfd) + bitmap=================
+
+static int g_memfd = -1;
+static uint8_t *g_phys_base = NULL;  // 整个物理池的一份线性映射，相当于 bitmap.c 的 g_phys_base
+static uint64_t g_bitmap = 0;        // 0 = 空闲, 1 = 占用
+
+void pool_init() {
+    g_memfd = memfd_create("vram_pool", 0);
+    if (g_memfd < 0 || ftruncate(g_memfd, MEM_SIZE) != 0) {
+        perror("memfd");
+        exit(1);
+    }
+    g_phys_base = mmap(NULL, MEM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, g_memfd, 0);
+    if (g_phys_base == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    g_bitmap = 0;
+    printf("[System] Init: 128MB VRAM (memfd), 2MB Page, Total 64 Pages.\n");
+}
+
+// 原版的连续分配 (同 bitmap.c)，用来对比
+int bitmap_alloc_contig(int num_pages) {
+    uint64_t mask = (num_pages == 64) ? ~0ULL : ((1ULL << num_pages) - 1);
+    for (int i = 0; i <= PAGE_COUNT - num_pages; i++) {
+        if (((g_bitmap >> i) & mask) == 0) {
+            g_bitmap |= (mask << i);
+            return i;
+        }
+    }
+    return -1;
+}
+
+// 单页分配：直接取最低的空闲位，不关心连续性
+static int bitmap_alloc_one() {
+    if (g_bitmap == ~0ULL) return -1;
+    int idx = __builtin_ctzll(~g_bitmap);
+    g_bitmap |= 1ULL << idx;
+    return idx;
+}
+
+static void bitmap_free_one(int idx) {
+    g_bitmap &= ~(1ULL << idx);
+}
+
+// =================虚拟 range=================
+
+typedef struct {
+    int num_pages;
+    uint8_t *va;            // 主机上预留的连续虚拟地址
+    int pte[PAGE_COUNT];    // 软件页表：虚拟页号 -> 物理页号
+} va_range_t;
+
+/**
+ * 分配 num_pages 个页，物理上可以完全不连续
+ * 先在 bitmap 里逐页拿空闲页，再把它们依次映射进一段连续的虚拟地址
+ * @return range 描述符，空闲页总数不够时返回 NULL
+ */
+va_range_t *va_alloc(int num_pages) {
+    if (num_pages <= 0 || num_pages > PAGE_COUNT) return NULL;
+    if (__builtin_popcountll(~g_bitmap) < num_pages) {
+        printf("[VA] Failed: only %d free pages, need %d\n", __builtin_popcountll(~g_bitmap), num_pages);
+        return NULL;
+    }
+
+    va_range_t *r = calloc(1, sizeof(va_range_t));
+    r->num_pages = num_pages;
+
+    // 1. 预留虚拟地址，不占物理内存
+    r->va = mmap(NULL, (size_t)num_pages * PAGE_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (r->va == MAP_FAILED) {
+        perror("mmap(reserve)");
+        free(r);
+        return NULL;
+    }
+
+    // 2. 逐页分配物理页并映射到虚拟 range 的对应位置
+    for (int i = 0; i < num_pages; i++) {
+        int phys = bitmap_alloc_one();
+        r->pte[i] = phys;
+        void *want = r->va + (size_t)i * PAGE_SIZE;
+        void *got = mmap(want, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED,
+                         g_memfd, (off_t)phys * PAGE_SIZE);
+        if (got != want) {
+            perror("mmap(fixed)");
+            for (int j = 0; j <= i; j++) bitmap_free_one(r->pte[j]);
+            munmap(r->va, (size_t)num_pages * PAGE_SIZE);
+            free(r);
+            return NULL;
+        }
+    }
+
+    printf("[VA] Mapped %d pages at VA %p, physical pages:", num_pages, r->va);
+    for (int i = 0; i < num_pages && i < 12; i++) printf(" %d", r->pte[i]);
+    printf("%s\n", num_pages > 12 ? " ..." : "");
+    return r;
+}
+
+void va_free(va_range_t *r) {
+    if (!r) return;
+    for (int i = 0; i < r->num_pages; i++) bitmap_free_one(r->pte[i]);
+    munmap(r->va, (size_t)r->num_pages * PAGE_SIZE);
+    free(r);
+}
+
+/**
+ * 软件页表翻译：range 内的字节偏移 -> 物理池内的字节偏移
+ * GPU 侧拿到的就是这个 (相当于 MMU 查一次页表)
+ */
+uint64_t va_translate(const va_range_t *r, uint64_t offset) {
+    return (uint64_t)r->pte[offset / PAGE_SIZE] * PAGE_SIZE + offset % PAGE_SIZE;
+}
+
+// 物理上连续的段数，1 表示恰好连续
+int va_segments(const va_range_t *r) {
+    int segs = 1;
+    for (int i = 1; i < r->num_pages; i++)
+        if (r->pte[i] != r->pte[i - 1] + 1) segs++;
+    return segs;
+}
+
+// 调试工具：打印位图状态
+void bitmap_dump() {
+    printf("Map: ");
+    for (int i = 0; i < 64; i++) printf("%lu", (g_bitmap >> i) & 1);
+    printf("\n");
+}
+
+// =================测试主函数=================
+
+int main() {
+    pool_init();
+
+    // 1. 制造碎片：占满后每隔 16 页留一个钉子，共 4 页，剩 60 页空闲但最长连续段只有 15
+    printf("\n--- Fragment the pool: 4 pinned pages spread across 64 ---\n");
+    for (int i = 0; i < PAGE_COUNT; i++) bitmap_alloc_one();
+    for (int i = 0; i < PAGE_COUNT; i++)
+        if (i % 16 != 8) bitmap_free_one(i);
+    bitmap_dump();
+
+    // 2. 60 页连续分配：原版必然失败
+    printf("\n--- Contiguous bitmap_alloc(60) ---\n");
+    int idx = bitmap_alloc_contig(60);
+    printf("%s\n", idx < 0 ? "Failed: no 60 contiguous pages (would need compaction)" : "Success");
+
+    // 3. 稀疏映射：成功
+    printf("\n--- Sparse va_alloc(60) ---\n");
+    va_range_t *r = va_alloc(60);
+    if (!r) return 1;
+    bitmap_dump();
+    printf("Physical segments: %d, virtual span contiguous: %p - %p\n",
+           va_segments(r), r->va, r->va + (size_t)60 * PAGE_SIZE);
+
+    // 4. 通过连续虚拟指针写一个跨页的数据，再从物理视图读回来验证映射
+    printf("\n--- Write across page boundaries through the virtual span ---\n");
+    uint64_t *words = (uint64_t *)r->va;
+    size_t n = (size_t)60 * PAGE_SIZE / sizeof(uint64_t);
+    for (size_t i = 0; i < n; i++) words[i] = i;
+
+    int bad = 0;
+    for (size_t i = 0; i < n; i += 4099) {
+        uint64_t phys_off = va_translate(r, i * sizeof(uint64_t));
+        if (*(uint64_t *)(g_phys_base + phys_off) != i) bad++;
+    }
+    uint64_t boundary = (uint64_t)8 * PAGE_SIZE - 8; // 虚拟第 7 页最后 8 字节
+    printf("VA offset 0x%llx -> phys 0x%llx, next byte -> phys 0x%llx\n",
+           (unsigned long long)boundary,
+           (unsigned long long)va_translate(r, boundary),
+           (unsigned long long)va_translate(r, boundary + 8));
+    printf("Verification through physical view: %s\n", bad ? "MISMATCH" : "OK");
+
+    va_free(r);
+    bitmap_dump();
+    return bad ? 1 : 0;
+}
@@ -0,0 +1,287 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// 2MB 大页内的小 buffer 子分配器
+// bitmap_alloc 最小粒度是一整个 2MB 页，几千个 4KB~256KB 的 constant buffer 每个都要烧掉一个大页。
+// 这里借用 slub.c 的思路：每个 size class 从 bitmap 拿一个 2MB 页当 "slab"，切成等大的 chunk。
+// 和 slub.c 不同的是显存对 CPU 来说不一定可访问，不能把 freelist 藏在对象里，
+// 所以每个 slab 的空闲状态用 host 侧的位图记录 (out-of-band 元数据)；
+// 一个页里的 chunk 全部释放后，这个页通过 bitmap_free 还给底层。
+
+// =================配置区域=================
+#define MEM_SIZE        (128 * 1024 * 1024) // 128MB
+#define PAGE_SIZE       (2 * 1024 * 1024)   // 2MB (Huge Page)
+#define PAGE_COUNT      (MEM_SIZE / PAGE_SIZE) // 64 个页
+
+#define KB              1024
+#define SUB_MAX_SIZE    (256 * KB)          // 超过这个直接走整页分配
+#define SUB_MAX_CHUNKS  (PAGE_SIZE / (4 * KB)) // 最小 class 4KB -> 512 个 chunk
+#define SUB_WORDS       (SUB_MAX_CHUNKS / 64)
+
+// 1.5 倍步进的 size class，比纯 2 的幂内部碎片小 (最坏 33% 而不是 50%)
+static const uint32_t g_class_size[] = {
+    4 * KB, 6 * KB, 8 * KB, 12 * KB, 16 * KB, 24 * KB, 32 * KB,
+    48 * KB, 64 * KB, 96 * KB, 128 * KB, 192 * KB, 256 * KB,
+};
+#define SUB_CLASS_COUNT (int)(sizeof(g_class_size) / sizeof(g_class_size[0]))
+
+// =================底层：bitmap 分配器 (同 bitmap.c，去掉打印)=================
+
+static uint8_t *g_phys_base = NULL;
+static uint64_t g_bitmap = 0;
+
+static uint64_t run_mask(int num_pages) {
+    return (num_pages == 64) ? ~0ULL : ((1ULL << num_pages) - 1);
+}
+
+void *bitmap_alloc(int num_pages) {
+    if (num_pages <= 0 || num_pages > PAGE_COUNT) return NULL;
+    uint64_t mask = run_mask(num_pages);
+    for (int i = 0; i <= PAGE_COUNT - num_pages; i++) {
+        if (((g_bitmap >> i) & mask) == 0) {
+            g_bitmap |= (mask << i);
+            return g_phys_base + (uint64_t)i * PAGE_SIZE;
+        }
+    }
+    return NULL;
+}
+
+void bitmap_free(void *ptr, int num_pages) {
+    int index = (int)(((uint8_t *)ptr - g_phys_base) / PAGE_SIZE);
+    g_bitmap &= ~(run_mask(num_pages) << index);
+}
+
+// =================子分配器数据结构=================
+
+// 一个被切成 chunk 的 2MB 页 (相当于 slub.c 的 struct page 在做 slab 时的那组字段)
+typedef struct sub_slab {
+    int page_idx;
+    int cls;
+    int objects;                    // 这个页能切出多少个 chunk
+    int inuse;
+    uint64_t free_map[SUB_WORDS];   // 1 = 空闲，host 侧元数据，不碰显存
+    struct sub_slab *next;          // partial 链表
+    struct sub_slab *prev;
+} sub_slab_t;
+
+typedef struct {
+    sub_slab_t *partial;            // 还有空闲 chunk 的页
+    uint64_t nr_slabs;
+} sub_cache_t;
+
+// 页 -> 子分配描述符，整页分配的为 NULL；相当于 virt_to_page
+static sub_slab_t *g_page_slab[PAGE_COUNT];
+static int g_page_run[PAGE_COUNT];  // 整页分配时记录页数，free 时不需要调用者再传
+static sub_cache_t g_caches[SUB_CLASS_COUNT];
+
+// 统计
+static uint64_t g_bytes_requested = 0;
+
+// =================辅助函数=================
+
+// size -> class，class 只有 13 个，线性找即可
+static int size_to_class(size_t size) {
+    for (int i = 0; i < SUB_CLASS_COUNT; i++) {
+        if (size <= g_class_size[i]) return i;
+    }
+    return -1;
+}
+
+static void partial_add(sub_cache_t *c, sub_slab_t *s) {
+    s->prev = NULL;
+    s->next = c->partial;
+    if (c->partial) c->partial->prev = s;
+    c->partial = s;
+}
+
+static void partial_remove(sub_cache_t *c, sub_slab_t *s) {
+    if (s->prev) s->prev->next = s->next;
+    else c->partial = s->next;
+    if (s->next) s->next->prev = s->prev;
+    s->next = s->prev = NULL;
+}
+
+// 从 bitmap 拿一个新页建 slab
+static sub_slab_t *sub_slab_grow(int cls) {
+    void *page = bitmap_alloc(1);
+    if (!page) return NULL;
+
+    sub_slab_t *s = calloc(1, sizeof(sub_slab_t));
+    s->page_idx = (int)(((uint8_t *)page - g_phys_base) / PAGE_SIZE);
+    s->cls = cls;
+    s->objects = PAGE_SIZE / g_class_size[cls];
+    s->inuse = 0;
+    for (int i = 0; i < s->objects; i++) s->free_map[i / 64] |= 1ULL << (i % 64);
+
+    g_page_slab[s->page_idx] = s;
+    g_caches[cls].nr_slabs++;
+    partial_add(&g_caches[cls], s);
+    return s;
+}
+
+// =================核心：分配 / 释放=================
+
+void sub_init() {
+    g_phys_base = (uint8_t *)malloc(MEM_SIZE);
+    if (!g_phys_base) {
+        printf("Fatal: OOM\n");
+        exit(1);
+    }
+    g_bitmap = 0;
+    memset(g_page_slab, 0, sizeof(g_page_slab));
+    memset(g_caches, 0, sizeof(g_caches));
+    g_bytes_requested = 0;
+}
+
+/**
+ * 分配显存 buffer
+ * <= 256KB 走子分配，更大的按整页向 bitmap 要
+ */
+void *vram_alloc(size_t size) {
+    if (size == 0) return NULL;
+
+    int cls = size_to_class(size);
+    if (cls < 0) {
+        int pages = (int)((size + PAGE_SIZE - 1) / PAGE_SIZE);
+        void *p = bitmap_alloc(pages);
+        if (p) {
+            g_page_run[((uint8_t *)p - g_phys_base) / PAGE_SIZE] = pages;
+            g_bytes_requested += size;
+        }
+        return p;
+    }
+
+    sub_cache_t *c = &g_caches[cls];
+    sub_slab_t *s = c->partial;
+    if (!s) {
+        s = sub_slab_grow(cls);
+        if (!s) return NULL;
+    }
+
+    // 找第一个空闲 chunk
+    int w = 0;
+    while (!s->free_map[w]) w++;
+    int bit = __builtin_ctzll(s->free_map[w]);
+    s->free_map[w] &= ~(1ULL << bit);
+    int idx = w * 64 + bit;
+
+    // 满了就移出 partial (和 linux_buddy_slub.c 一样，满页游离在外)
+    if (++s->inuse == s->objects) partial_remove(c, s);
+
+    g_bytes_requested += size;
+    return g_phys_base + (uint64_t)s->page_idx * PAGE_SIZE + (uint64_t)idx * g_class_size[cls];
+}
+
+/**
+ * 释放：靠页号反查 slab 描述符，调用者不需要记住大小
+ * @param size 仅用于统计 requested 字节数
+ */
+void vram_free(void *ptr, size_t size) {
+    if (!ptr) return;
+
+    uint64_t offset = (uint8_t *)ptr - g_phys_base;
+    int page_idx = (int)(offset / PAGE_SIZE);
+    sub_slab_t *s = g_page_slab[page_idx];
+    g_bytes_requested -= size;
+
+    if (!s) {
+        bitmap_free(ptr, g_page_run[page_idx]);
+        return;
+    }
+
+    sub_cache_t *c = &g_caches[s->cls];
+    int idx = (int)((offset % PAGE_SIZE) / g_class_size[s->cls]);
+    if (s->free_map[idx / 64] & (1ULL << (idx % 64))) {
+        printf("[Free] Error: Double free of %p\n", ptr);
+        return;
+    }
+    s->free_map[idx / 64] |= 1ULL << (idx % 64);
+
+    // 从满变成非满，挂回 partial
+    if (s->inuse-- == s->objects) partial_add(c, s);
+
+    // 整页空了：还给 bitmap
+    if (s->inuse == 0) {
+        partial_remove(c, s);
+        g_page_slab[s->page_idx] = NULL;
+        bitmap_free(g_phys_base + (uint64_t)s->page_idx * PAGE_SIZE, 1);
+        c->nr_slabs--;
+        free(s);
+    }
+}
+
+// 调试工具：打印页占用和每个 class 的 slab 数
+void sub_dump() {
+    printf("Map: ");
+    for (int i = 0; i < PAGE_COUNT; i++) {
+        if (!((g_bitmap >> i) & 1)) printf(".");
+        else if (g_page_slab[i]) printf("s");
+        else printf("P");
+    }
+    printf("   (s = sub-allocated, P = whole page)\n");
+    for (int i = 0; i < SUB_CLASS_COUNT; i++) {
+        if (g_caches[i].nr_slabs)
+            printf("  class %3uKB: %llu slab page(s)\n", g_class_size[i] / KB,
+                   (unsigned long long)g_caches[i].nr_slabs);
+    }
+}
+
+static int pages_used() {
+    return __builtin_popcountll(g_bitmap);
+}
+
+// =================测试主函数=================
+
+#define N_BUFS 1000
+
+int main() {
+    sub_init();
+    printf("[System] Sub-allocator on 128MB VRAM, 2MB pages, %d classes 4KB..256KB\n", SUB_CLASS_COUNT);
+
+    // 1. 基本功能：同 class 的 buffer 挤在一个页里
+    printf("\n--- Basic ---\n");
+    void *a = vram_alloc(4 * KB);
+    void *b = vram_alloc(3 * KB);
+    void *c = vram_alloc(100 * KB);
+    void *big = vram_alloc(5 * 1024 * 1024);
+    printf("a=%p b=%p (same page: %s) c=%p big=%p\n", a, b,
+           ((uint8_t *)a - g_phys_base) / PAGE_SIZE == ((uint8_t *)b - g_phys_base) / PAGE_SIZE ? "yes" : "no",
+           c, big);
+    sub_dump();
+    vram_free(a, 4 * KB);
+    vram_free(b, 3 * KB);
+    vram_free(c, 100 * KB);
+    vram_free(big, 5 * 1024 * 1024);
+    printf("After free: %d pages in use\n", pages_used());
+
+    // 2. 大量常量 buffer：4KB~256KB 随机大小
+    printf("\n--- %d constant buffers, 4KB..256KB ---\n", N_BUFS);
+    static void *bufs[N_BUFS];
+    static size_t sizes[N_BUFS];
+    uint64_t seed = 88172645463325252ULL;
+    int ok = 0;
+    for (int i = 0; i < N_BUFS; i++) {
+        seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+        // log 均匀：4KB * 2^(0..6) * [1, 2)
+        size_t base = (size_t)(4 * KB) << (seed % 6);
+        sizes[i] = base + (seed >> 8) % base;
+        bufs[i] = vram_alloc(sizes[i]);
+        if (bufs[i]) ok++;
+    }
+    uint64_t used = (uint64_t)pages_used() * PAGE_SIZE;
+    printf("Allocated %d/%d buffers, %.1f MB requested in %d pages (%.1f MB), overhead %.1f%%\n",
+           ok, N_BUFS, g_bytes_requested / 1048576.0, pages_used(), used / 1048576.0,
+           100.0 * (used - g_bytes_requested) / used);
+    printf("Whole-page bitmap_alloc would need %d pages (%.0f MB) and can only hold %d of them\n",
+           ok, ok * 2.0, PAGE_COUNT);
+
+    // 3. 释放一半，再全部释放，检查页会还给 bitmap
+    for (int i = 0; i < N_BUFS; i += 2) vram_free(bufs[i], sizes[i]), bufs[i] = NULL;
+    printf("After freeing half: %d pages in use\n", pages_used());
+    for (int i = 1; i < N_BUFS; i += 2) vram_free(bufs[i], sizes[i]);
+    printf("After freeing all:  %d pages in use\n", pages_used());
+    return 0;
+}